@@ -49,8 +49,8 @@ ENSEMBLEMLI = \
 	type/conn.mli	\
 	route/route.mli	\
 	infr/async.mli	\
-	trans/real.mli	\
 	type/alarm.mli	\
+	trans/real.mli	\
 	type/auth.mli	\
 	type/domain.mli	\
 	type/event.mli	\
@@ -136,8 +136,10 @@ ENSCOREOBJ = \
 	appl/timestamp$(CMO)	\
 \
 	trans/ipmc$(CMO)	\
-	trans/udp$(CMO)	\
 	trans/real$(CMO)	\
+	trans/epoll$(CMO)	\
+	trans/uring$(CMO)	\
+	trans/udp$(CMO)	\
 \
 	route/bypassr$(CMO)	\
 	infr/hsyssupp$(CMO)	\
@@ -180,6 +182,7 @@ ENSMINOBJ = \
 	layers/other/partial_appl$(CMO) \
 	layers/trans/stable$(CMO)	\
 	layers/trans/bottom$(CMO)	\
+	util/rto$(CMO)	\
 	layers/trans/mnak$(CMO)	\
 	layers/trans/pt2pt$(CMO)	\
 	layers/vsync/suspect$(CMO)	\
@@ -201,6 +204,7 @@ ENSMINOBJ = \
 	layers/flow/pt2ptwp$(CMO)	\
 	util/mcredit$(CMO)	\
 	layers/flow/mflow$(CMO)	\
+	layers/flow/cong$(CMO)	\
 	layers/total/sequencer$(CMO) \
 \
 	layers/bypass/fpmb$(CMO)	\
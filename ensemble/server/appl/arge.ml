@@ -282,7 +282,7 @@ let gc_compact pct =
 (**************************************************************)
 
 let aggregate    = bool set_ident false "aggregate" "aggregate messages"
-let alarm        = string set_ident "REAL" "alarm" "set alarm package to use"
+let alarm        = string set_ident "REAL" "alarm" "set alarm package to use (REAL, EPOLL, URING)"
 let force_modes  = bool set_ident false "force_modes" "disable transport modes checking"
 let glue         = string set_glue Glue.Imperative "glue" "set layer glue to use"
 let gossip_hosts = string set_string_list_option (Some ["localhost"]) "gossip_hosts" "set hosts for gossip servers"
@@ -312,6 +312,8 @@ let pgp          = string set_option None "pgp" "set my id for using pgp"
 let pgp_pass     = string set_option None "pgp_pass" "set my passphrase for using pgp"
 let pollcount    = int set_ident 0 "pollcount" "number of polling operations before blocking"
 let multiread    = bool set_ident false "multiread" "read all data from sockets before delivering"
+let recv_batch   = int set_pos_int 16 "recv_batch" "maximal number of packets to read from a socket at once"
+let recv_nocopy  = bool set_ident false "recv_nocopy" "parse received headers in place, without copying them"
 let sched_step   = int set_pos_int 200 "sched_step" "number of events to schedule before reading from network"
 let host_ip      = string set_option None "host_ip" "override host for host IP address"
 let udp_port     = int set_option (Some 0) "udp_port" "override port for UDP communication"
@@ -322,6 +324,19 @@ let short_names  = bool set_ident false "short_names" "use short names for endpo
 let sock_buf     = int  set_ident sock_buf_default "sock_buf" "size of kernel socket buffers"
 let chunk_size   = int set_ident (256*1024) "chunk_size" "set the size of memory chunks"
 let max_mem_size = int set_ident (6*1024*1024) "max_mem_size" "set the amount of memory for user data"
+let mem_hugepages = bool set_ident false "mem_hugepages" "back memory chunks with huge pages, where available"
+let mem_mlock    = bool set_ident false "mem_mlock" "lock memory chunks in RAM"
+let mem_slabs    = bool set_ident false "mem_slabs" "allocate user data from size classes, so retained messages do not pin whole chunks"
+let mem_compact  = bool set_ident false "mem_compact" "copy retained messages out of sparsely used chunks when memory runs low"
+let mem_quota    = int set_ident 0 "mem_quota" "bytes of user data each client of the daemon may hold, 0 for no limit"
+let mem_backpressure = bool set_ident false "mem_backpressure" "stop reading UDP sockets while the receive pool is exhausted"
+let mem_stall_max = int set_pos_int 50 "mem_stall_max" "milliseconds to stop reading for, with mem_backpressure"
+let max_msg_size = int set_pos_int (8*1024) "max_msg_size" "set the maximal UDP packet size (up to 65507, same for all members)"
+let compact_hdrs = bool set_ident false "compact_hdrs" "send protocol headers in a compact encoding rather than with Marshal"
+let udp_gso      = bool set_ident false "udp_gso" "send runs of equal-sized UDP packets with segmentation offload (Linux)"
+let udp_gro      = bool set_ident false "udp_gro" "receive coalesced UDP packets (Linux)"
+let udp_rx_stats = bool set_ident false "udp_rx_stats" "keep queueing delays and kernel drop counts of received UDP packets (Linux)"
+let udp_socks    = int set_pos_int 1 "udp_socks" "number of sockets receiving on the UDP port, with SO_REUSEPORT (Linux)"
 
 (**************************************************************)
 let verbose = ref false
@@ -576,7 +591,20 @@ let parse app_args badarg doc =
     List.iter trace traces
   end;
 
+  (* The packet size must be set before any buffers are
+   * allocated for it.
+   *)
+  begin
+    try Hsys.set_max_msg_size (get max_msg_size) with Failure s ->
+      eprintf "ARGE:%s, exiting\n" s ;
+      exit 1
+  end ;
+  Buf.use_compact (get compact_hdrs) ;
+
   (* Initialize the memory-manager with default values *)
+  Iovec.use_slabs (get mem_slabs) ;
+  Iovec.use_region (get mem_hugepages) (get mem_mlock) ;
+  Iovec.use_compaction (get mem_compact) ;
   Iovec.init 
     !verbose               (* Verbosity of the memory manager *)
     (get chunk_size)       (* chunk_size *)
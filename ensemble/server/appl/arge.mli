@@ -54,6 +54,8 @@ val pgp          : string option t	(* are we using pgp? *)
 val pgp_pass     : string option t	(* pass phrase for pgp *)
 val pollcount    : int t		(* number of failed polls before blocking *)
 val multiread    : bool t		(* do we read all data from sockets? *)
+val recv_batch   : int t		(* packets to read per receive call *)
+val recv_nocopy  : bool t		(* parse headers in place *)
 val sched_step   : int t		(* number of events to schedule per step *)
 val host_ip      : string option t	(* hostname override to a specific IP address *)
 val udp_port     : port option t	(* port override for UDP communication *)
@@ -63,6 +65,19 @@ val short_names  : bool t		(* use short names for endpoints *)
 val sock_buf     : int t                (* size of kernel socket buffers *)
 val chunk_size   : int t                (* the size of memory chunks *) 
 val max_mem_size : int t                (* the amount of memory for user data *)
+val mem_hugepages : bool t              (* back memory chunks with huge pages *)
+val mem_mlock    : bool t               (* lock memory chunks in RAM *)
+val mem_slabs    : bool t               (* allocate user data from size classes *)
+val mem_compact  : bool t               (* compact retained messages *)
+val mem_quota    : int t                (* memory per daemon client *)
+val mem_backpressure : bool t           (* stop reading when out of memory *)
+val mem_stall_max : int t               (* for at most this many milliseconds *)
+val max_msg_size : int t                (* the maximal UDP packet size *)
+val compact_hdrs : bool t               (* compact encoding of headers *)
+val udp_gso      : bool t               (* UDP segmentation offload for sends *)
+val udp_gro      : bool t               (* coalesced UDP receives *)
+val udp_rx_stats : bool t               (* kernel receive timestamps and drops *)
+val udp_socks    : int t                (* SO_REUSEPORT sockets on the UDP port *)
 
 (**************************************************************)
 val gc_compact  : int -> unit           (* Set GC compaction rate *)
@@ -21,7 +21,7 @@ let remove_timeout = Time.of_int 20
  *)
 let repeat_timeout = Time.of_string "0.1"
 
-let max_msg_len = Buf.int_of_len Buf.max_msg_len
+let max_msg_len = Buf.int_of_len (Buf.max_msg_len ())
   
   
 let create_server_sock port = 
@@ -125,12 +125,12 @@ let intf alarm initial_sock port =
     in
       
     let recv_gossip =
-      let buf = Buf.create Buf.max_msg_len in
+      let buf = Buf.create (Buf.max_msg_len ()) in
       fun () ->
 	if !verbose then 
 	  printf "REFLECT:#clients=%d\n" (hashtbl_size clients) ;
 	try
-          let (len,inet,port) = Hsys.recvfrom !sock_r buf Buf.len0 Buf.max_msg_len in
+          let (len,inet,port) = Hsys.recvfrom !sock_r buf Buf.len0 (Buf.max_msg_len ()) in
 	  if !verbose then (
 	    printf "REFLECT:recv_gossip: from (%s,%d)\n" 
 	      (Hsys.string_of_inet inet) port ;
@@ -173,6 +173,11 @@ let print () =
     let words = Array.of_list words in
     let words = sample 10 words in
     eprintf "TIMESTAMP:tenths=%s words\n" (string_of_int_array words) ;
-  )
+  ) ;
+
+  (* The time packets spent in kernel socket queues, before the
+   * samples above start.
+   *)
+  eprintf "TIMESTAMP:rx:%s\n" (Hsys.udp_rx_stats ())
 
 
@@ -172,8 +172,8 @@ let create alarm sock =
   
   Hsyssupp.client name alarm sock (fun info send ->
     let send msg =
-      let buf = marsh msg in
-      send buf len0 (Buf.length buf) Iovecl.empty
+      let buf,len = marsh msg in
+      send buf len0 len Iovecl.empty
     in
 
     send (Version("ENSEMBLE:groupd",(Version.string_of_id Version.id))) ;
@@ -253,8 +253,8 @@ let server alarm port join =
     in
 
     let send msg =
-      let buf = marsh msg in
-      send buf Buf.len0 (Buf.length buf) Iovecl.empty
+      let buf,len = marsh msg in
+      send buf Buf.len0 len Iovecl.empty
     in
 
     let sendmsg group endpt msg =
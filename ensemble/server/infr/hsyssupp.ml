@@ -92,7 +92,13 @@ let create_state () = {
 
 let max_msg_len =  Buf.len_of_int (8 * 4096) (*Buf.max_msg_len*)
   
-let tcp debug alarm sock deliver disable =
+(* The memory quota of each client accepted by a server.
+ *)
+let client_quota = ref 0
+
+let set_client_quota limit = client_quota := limit
+
+let tcp debug alarm quota sock deliver disable =
   Util.disable_sigpipe () ;
   let debug = "tcp" in 
   let send_pool = Iovec.get_send_pool () in
@@ -127,6 +133,7 @@ let tcp debug alarm sock deliver disable =
       | S_Iovec iovl -> Iovecl.free iovl
     end;
     Queuee.iter (fun (_,_,_,_,iovl) -> Iovecl.free iovl) s.q;
+    Iovec.release_quota quota ;
     Alarm.rmv_sock_recv alarm sock ;
     if s.send_s <> S_Null then (
       Alarm.rmv_sock_xmit alarm sock
@@ -139,7 +146,7 @@ let tcp debug alarm sock deliver disable =
   (* Space for the maximum header size. 
    * We use just one such buffer, the assumption is that this is scratch space. 
    *)
-  let prealloc_hdr = ref (Buf.create Buf.max_msg_len) in
+  let prealloc_hdr = ref (Buf.create (Buf.max_msg_len ())) in
 
   (* Deliver a packet, and cleanup.
    *)
@@ -190,11 +197,11 @@ let tcp debug alarm sock deliver disable =
                         "Sanity: ML length is smaller than 4 (ml_len=%d iov_len=%d)"
                         (int_of_len ml_len) (int_of_len iov_len)
                      )
-	        else if ml_len >|| Buf.max_msg_len then 
+	        else if ml_len >|| Buf.max_msg_len () then 
 	          failwith "ML header too large";
           
           let iov = 
-            try Iovec.alloc send_pool iov_len
+            try Iovec.alloc_quota quota send_pool iov_len
             with Socket.Out_of_iovec_memory -> Iovec.empty 
           in
             if (Iovec.len iov =|| iov_len) then (
@@ -239,7 +246,7 @@ let tcp debug alarm sock deliver disable =
           
           (* Wait for asynchronous allocation *)
           s.recv_s <- R_Alloc;
-          Iovec.alloc_async send_pool s.recv_total_iov_len (fun iov -> 
+          Iovec.alloc_async_quota quota send_pool s.recv_total_iov_len (fun iov -> 
             (* We got all the memory we asked for *)
             assert(Iovec.len iov =|| s.recv_total_iov_len);
             match s.recv_s with 
@@ -505,7 +512,12 @@ let server debug alarm port client =
     let disable_r = ref (fun _ -> failwith sanity) in
     let disable () = !disable_r () in
 
-    let send = tcp debug alarm sock recv disable in
+    let quota = 
+      if !client_quota > 0 then
+	Iovec.create_quota info !client_quota
+      else Iovec.no_quota
+    in
+    let send = tcp debug alarm quota sock recv disable in
 
     let recv,disable,() = client info send in
 
@@ -524,7 +536,7 @@ let client debug alarm sock serv_init =
   let disable_r = ref (fun _ -> failwith sanity) in
   let disable () = !disable_r () in
 
-  let send = tcp debug alarm sock recv disable in
+  let send = tcp debug alarm Iovec.no_quota sock recv disable in
   let recv,disable,state = serv_init debug send in
   recv_r := recv ;
   disable_r := disable ;
@@ -22,6 +22,13 @@ type 'a conn =
 (* Turn a TCP socket into a send and recv function.
  *)
 
+(* Limit the iovec memory held by each client accepted by
+ * [server] to this many bytes, 0 for no limit (the default).
+ * A client over its limit is not read from until it drops
+ * below it.
+ *)
+val set_client_quota : int -> unit
+
 val server : 
   debug -> 
   Alarm.t ->
@@ -237,7 +237,7 @@ let l state vs =
     dn_catch_r := (fun ev abv ->
       match getType ev, abv with
       | ECast, Empty -> (		(* hack, hack, hack *)
-	  let iov = Iovecl.flatten (getIov ev) in
+	  let iov = Iovecl.flatten name (getIov ev) in
 	  let res = bypass_ECast iov in	(* returns bool *)
 	  res
 	)
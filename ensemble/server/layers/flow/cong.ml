@@ -0,0 +1,449 @@
+(**************************************************************)
+(* CONG.ML : rate-based congestion control for multicast *)
+(* Notes:
+ * 1. This layer goes below Mnak, so that it sees the casts as
+ *    they go on the network.  Every cast is numbered, and
+ *    receivers report back what they got.  Holes in the
+ *    numbering are the same losses that cause Mnak to NAK.
+ * 2. Mnak's retransmissions and Naks, and other unreliable
+ *    messages, are not delayed, but their bytes are taken from
+ *    the token bucket, which holds back the casts that follow.
+ * 3. A receiver that has been sent casts but has not reported
+ *    for cong_report_k round trips is taken as a loss.  Under
+ *    total loss receivers have nothing to report.
+ * 4. The sending rate is in bytes, with the same overhead per
+ *    message as Mflow.
+ * 5. Reliable point-to-point messages are not rate controlled.
+ *)
+(**************************************************************)
+open Buf
+open Layer
+open View
+open Event
+open Util
+open Trans
+(**************************************************************)
+let name = Trace.filel "CONG"
+(**************************************************************)
+(* Data(seqno): cast number 'seqno' from its origin.
+
+ * Report(hi,recvd,delay): I have received 'recvd' of your
+ * casts, the latest being 'hi-1', which I got 'delay'
+ * microseconds ago.
+ *)
+type header = NoHdr
+  | Data of seqno
+  | Report of seqno * int * int
+
+type mark_state = Hi | Low
+
+(* Send times are kept for this many recent casts.
+ *)
+let history = 1024
+
+(**************************************************************)
+
+type 'abv state = {
+  sweep              : Time.t ;
+  mutable next_sweep : Time.t ;
+  mutable sweeping   : bool ;	(* A sweep timer is pending *)
+  clock              : Alarm.t ;	(* Times are taken from its clock *)
+  mutable failed     : bool Arrayf.t ;
+  overhead           : int ;
+  hi_wmark           : int ;
+  mutable mark       : mark_state ;
+  send_buf           : (Event.dn * 'abv) Queuee.t ;
+
+  (* The sending rate in bytes/sec, and a token bucket
+   * enforcing it.
+   *)
+  mutable rate       : float ;
+  min_rate           : float ;
+  max_rate           : float ;
+  increase           : float ;	(* Added to the rate every RTT *)
+  decrease           : float ;	(* Rate is multiplied by this on congestion *)
+  loss_th            : float ;	(* Loss rate that counts as congestion *)
+  delay_th           : float ;	(* As does an RTT this many times the minimum *)
+  burst              : float ;
+  report_k           : float ;	(* Round trips without a report that count as loss *)
+  mutable tokens     : float ;
+  mutable filled     : float ;	(* When tokens were last added *)
+  mutable decreased  : float ;	(* When rate was last decreased *)
+  mutable increased  : float ;	(* When rate was last increased *)
+
+  (* Sender side, per receiver.
+   *)
+  mutable seqno      : seqno ;
+  sent               : float array ; (* Send times, by seqno mod history *)
+  srtt               : float array ;
+  min_rtt            : float array ;
+  rep_hi             : seqno array ;
+  rep_recvd          : int array ;
+  rep_at             : float array ; (* When casts were last outstanding with no report *)
+
+  (* Receiver side, per sender.
+   *)
+  recv_hi            : seqno array ;
+  recv_n             : int array ;
+  recv_time          : float array ;
+  reported           : int array ;
+
+  mutable losses     : int ;
+  mutable delays     : int
+}
+
+(**************************************************************)
+
+let msg_len s iovl = float (int_of_len (Iovecl.len iovl) + s.overhead)
+
+let dump vf s = Layer.layer_dump name (fun (ls,vs) s -> [|
+  sprintf "rate=%.0f tokens=%.0f send_buf=%d\n" s.rate s.tokens (Queuee.length s.send_buf) ;
+  sprintf "srtt=%s\n" (string_of_array (sprintf "%.4f") s.srtt) ;
+  sprintf "min_rtt=%s\n" (string_of_array (sprintf "%.4f") s.min_rtt) ;
+  sprintf "losses=%d delays=%d\n" s.losses s.delays
+|]) vf s
+
+(**************************************************************)
+
+let init _ (ls,vs) =
+  let float_param p = float (Param.int vs.params p) in
+  let rate = float_param "cong_rate" in
+  { sweep      = Param.time vs.params "cong_sweep" ;
+    next_sweep = Time.zero ;
+    sweeping   = false ;
+    clock      = Alarm.get_hack () ;
+    failed     = ls.falses ;
+    overhead   = Param.int vs.params "cong_overhead" ;
+    hi_wmark   = Param.int vs.params "cong_hi_wmark" ;
+    mark       = Low ;
+    send_buf   = Queuee.create () ;
+    rate       = rate ;
+    min_rate   = float_param "cong_min_rate" ;
+    max_rate   = float_param "cong_max_rate" ;
+    increase   = float_param "cong_increase" ;
+    decrease   = Param.float vs.params "cong_decrease" ;
+    loss_th    = Param.float vs.params "cong_loss_th" ;
+    delay_th   = Param.float vs.params "cong_delay_th" ;
+    burst      = float_param "cong_burst" ;
+    report_k   = float_param "cong_report_k" ;
+    tokens     = float_param "cong_burst" ;
+    filled     = 0.0 ;
+    decreased  = 0.0 ;
+    increased  = 0.0 ;
+    seqno      = 0 ;
+    sent       = Array.create history 0.0 ;
+    srtt       = Array.create ls.nmembers 0.0 ;
+    min_rtt    = Array.create ls.nmembers 0.0 ;
+    rep_hi     = Array.create ls.nmembers 0 ;
+    rep_recvd  = Array.create ls.nmembers 0 ;
+    rep_at     = Array.create ls.nmembers 0.0 ;
+    recv_hi    = Array.create ls.nmembers 0 ;
+    recv_n     = Array.create ls.nmembers 0 ;
+    recv_time  = Array.create ls.nmembers 0.0 ;
+    reported   = Array.create ls.nmembers 0 ;
+    losses     = 0 ;
+    delays     = 0
+  }
+
+(**************************************************************)
+
+let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnnm_out=dnnm} =
+  let failwith = layer_fail dump vf s name in
+  let log = Trace.log2 name ls.name in
+  let logb = Trace.log3 Layer.buffer ls.name name in
+  let logc = Trace.log2 (name^"C") ls.name in
+  (* The alarm's clock is the one ETimer events carry, which is
+   * virtual under Netsim.
+   *)
+  let now () = Time.to_float (Alarm.gettime s.clock) in
+
+  (* Check the water-mark, as in Mflow.
+   *)
+  let check_wmark () =
+    if Queuee.length s.send_buf >= s.hi_wmark && s.mark = Low then (
+      logc (fun () -> sprintf "Hi, rate=%.0f" s.rate) ;
+      s.mark <- Hi ;
+      upnm (create name EFlowBlock[FlowBlock (None,true)])
+    ) else if Queuee.length s.send_buf = 0 && s.mark = Hi then (
+      logc (fun () -> sprintf "Low, rate=%.0f" s.rate) ;
+      s.mark <- Low ;
+      upnm (create name EFlowBlock[FlowBlock (None,false)])
+    )
+  in
+
+  (* Add the tokens accumulated since the last time.  The bucket
+   * holds a sweep's worth of sending, plus the burst.
+   *)
+  let fill time =
+    let tokens = s.tokens +. s.rate *. (time -. s.filled) in
+    let cap = s.rate *. (Time.to_float s.sweep) +. s.burst in
+    s.tokens <- if tokens > cap then cap else tokens ;
+    s.filled <- time
+  in
+
+  (* Charge a message that is sent at once.  The debt is
+   * limited to what the bucket can hold.
+   *)
+  let charge iovl time =
+    fill time ;
+    let cap = s.rate *. (Time.to_float s.sweep) +. s.burst in
+    s.tokens <- max (-. cap) (s.tokens -. msg_len s iovl)
+  in
+
+  let cast ev abv iovl time =
+    s.tokens <- s.tokens -. msg_len s iovl ;
+    s.sent.(s.seqno mod history) <- time ;
+    let seqno = s.seqno in
+    s.seqno <- succ s.seqno ;
+    dn ev abv (Data seqno)
+  in
+
+  (* Send as many buffered casts as the tokens allow.
+   *)
+  let release time =
+    fill time ;
+    while s.tokens > 0.0 && not (Queuee.empty s.send_buf) do
+      let ev,abv = Queuee.take s.send_buf in
+      match getType ev with
+      | ECast iovl -> cast ev abv iovl time
+      | _ -> failwith sanity
+    done ;
+    check_wmark ()
+  in
+
+  (* Congestion: back off, at most once per RTT.
+   *)
+  let congested rank time =
+    if time -. s.decreased > s.srtt.(rank) then (
+      s.rate <- max s.min_rate (s.rate *. s.decrease) ;
+      s.decreased <- time ;
+      log (fun () -> sprintf "congestion at %d, rate=%.0f" rank s.rate)
+    )
+  in
+
+  (* A report from a receiver: take an RTT sample from the
+   * latest cast it has, and compare what it got with what
+   * I sent in the meantime.
+   *)
+  let got_report rank hi recvd delay =
+    let time = now () in
+    s.rep_at.(rank) <- time ;
+    if hi > s.rep_hi.(rank) then (
+      if s.seqno - hi < history then (
+	let rtt = time -. s.sent.((pred hi) mod history) -. (float delay) /. 1000000.0 in
+	let rtt = if rtt > 0.0 then rtt else 0.0 in
+	if s.srtt.(rank) = 0.0 then (
+	  s.srtt.(rank) <- rtt ;
+	  s.min_rtt.(rank) <- rtt
+	) else (
+	  s.srtt.(rank) <- 0.875 *. s.srtt.(rank) +. 0.125 *. rtt ;
+	  if rtt < s.min_rtt.(rank) then s.min_rtt.(rank) <- rtt
+	)
+      ) ;
+
+      let expected = hi - s.rep_hi.(rank) in
+      let got = recvd - s.rep_recvd.(rank) in
+      let loss = float (expected - got) /. float expected in
+      s.rep_hi.(rank) <- hi ;
+      s.rep_recvd.(rank) <- recvd ;
+
+      if loss > s.loss_th then (
+	s.losses <- succ s.losses ;
+	congested rank time
+      ) else if s.delay_th > 0.0 && s.srtt.(rank) > s.delay_th *. s.min_rtt.(rank) then (
+	s.delays <- succ s.delays ;
+	congested rank time
+      )
+    )
+  in
+
+  (* A receiver with casts outstanding that has not reported
+   * for cong_report_k round trips (or sweeps, as reports go out
+   * once a sweep) counts as a loss, once per such period.
+   *)
+  let check_reports time =
+    for i = 0 to pred ls.nmembers do
+      if i <> ls.rank && not (Arrayf.get s.failed i) then (
+	if s.seqno <= s.rep_hi.(i) then (
+	  s.rep_at.(i) <- 0.0
+	) else if s.rep_at.(i) = 0.0 then (
+	  s.rep_at.(i) <- time
+	) else (
+	  let rtt = max s.srtt.(i) (Time.to_float s.sweep) in
+	  if time -. s.rep_at.(i) > s.report_k *. rtt then (
+	    s.rep_at.(i) <- time ;
+	    s.losses <- succ s.losses ;
+	    log (fun () -> sprintf "no report from %d" i) ;
+	    congested i time
+	  )
+	)
+      )
+    done
+  in
+
+  (* Additive increase: the rate grows by cong_increase per
+   * RTT, using the slowest live receiver's RTT.  Only a sender
+   * that is held back by the rate increases it.
+   *)
+  let increase time =
+    let elapsed = if s.increased = 0.0 then 0.0 else time -. s.increased in
+    s.increased <- time ;
+    if not (Queuee.empty s.send_buf) then (
+      let rtt = ref (Time.to_float s.sweep) in
+      for i = 0 to pred ls.nmembers do
+	if i <> ls.rank && not (Arrayf.get s.failed i) && s.srtt.(i) > !rtt then
+	  rtt := s.srtt.(i)
+      done ;
+      s.rate <- min s.max_rate (s.rate +. s.increase *. elapsed /. !rtt)
+    )
+  in
+
+  (* Sweeps are needed only while there is something to do:
+   * casts buffered, casts not yet reported on by a live
+   * receiver, or casts received and not yet reported.
+   *)
+  let busy () =
+    let busy = ref (not (Queuee.empty s.send_buf)) in
+    for i = 0 to pred ls.nmembers do
+      if i <> ls.rank && not (Arrayf.get s.failed i)
+      && (s.seqno > s.rep_hi.(i) || s.recv_n.(i) <> s.reported.(i)) then
+	busy := true
+    done ;
+    !busy
+  in
+
+  let start_sweep () =
+    if not s.sweeping then (
+      s.sweeping <- true ;
+      s.next_sweep <- Time.add (Alarm.gettime s.clock) s.sweep ;
+      dnnm (timerAlarm name s.next_sweep)
+    )
+  in
+
+  let up_hdlr ev abv hdr = match getType ev, hdr with
+
+    (* Count the cast and deliver it.
+     *)
+  | ECast _, Data(seqno) ->
+      let origin = getPeer ev in
+      if origin <> ls.rank then (
+	s.recv_n.(origin) <- succ s.recv_n.(origin) ;
+	if seqno >= s.recv_hi.(origin) then (
+	  s.recv_hi.(origin) <- succ seqno ;
+	  s.recv_time.(origin) <- now ()
+	) ;
+	start_sweep ()
+      ) ;
+      up ev abv
+
+  | _, NoHdr -> up ev abv
+  | _        -> failwith bad_header
+
+  and uplm_hdlr ev hdr = match getType ev,hdr with
+  | (ESend _|ESendUnrel _), Report(hi,recvd,delay) ->
+      let origin = getPeer ev in
+      if not (Arrayf.get s.failed origin) then
+	got_report origin hi recvd delay ;
+      free name ev
+  | _ -> failwith unknown_local
+
+  and upnm_hdlr ev = match getType ev with
+  | EFail ->
+      s.failed <- getFailures ev ;
+      upnm ev
+
+    (* ETimer: report to the senders I have heard from, adjust
+     * the rate, and send what it allows.  The timer is re-armed
+     * while there is more to do; when idle, the increase starts
+     * afresh with the next sweep.
+     *)
+  | ETimer ->
+      let now_t = getTime ev in
+      if s.sweeping && Time.ge now_t s.next_sweep then (
+	let time = Time.to_float now_t in
+	for i = 0 to pred ls.nmembers do
+	  if i <> ls.rank && not (Arrayf.get s.failed i)
+	  && s.recv_n.(i) <> s.reported.(i) then (
+	    let delay = truncate ((time -. s.recv_time.(i)) *. 1000000.0) in
+	    dnlm (sendUnrelPeer name i) (Report(s.recv_hi.(i),s.recv_n.(i),delay)) ;
+	    s.reported.(i) <- s.recv_n.(i)
+	  )
+	done ;
+
+	check_reports time ;
+	increase time ;
+	release time ;
+
+	if busy () then (
+	  s.next_sweep <- Time.add now_t s.sweep ;
+	  dnnm (timerAlarm name s.next_sweep)
+	) else (
+	  s.sweeping <- false ;
+	  s.increased <- 0.0
+	)
+      ) ;
+      upnm ev
+
+  | EExit ->
+      Queuee.clean (fun (ev,_) -> free name ev) s.send_buf ;
+      upnm ev
+
+  | EAccount ->
+      logb (fun () -> sprintf "blocked(msgs):%d rate=%.0f losses=%d delays=%d"
+	(Queuee.length s.send_buf) s.rate s.losses s.delays) ;
+      upnm ev
+
+  | EDump -> ( dump vf s ; upnm ev )
+  | _ -> upnm ev
+
+  and dn_hdlr ev abv = match getType ev with
+
+    (* Send casts if the rate allows, otherwise buffer them.
+     *)
+  | ECast iovl ->
+      if Queuee.empty s.send_buf then (
+	let time = now () in
+	fill time ;
+	if s.tokens > 0.0 then (
+	  cast ev abv iovl time
+	) else (
+	  Queuee.add (ev,abv) s.send_buf ;
+	  check_wmark ()
+	)
+      ) else (
+	Queuee.add (ev,abv) s.send_buf ;
+	check_wmark ()
+      ) ;
+      start_sweep ()
+
+    (* Unreliable messages, such as Mnak's retransmissions and
+     * Naks, go out at once but use up tokens.
+     *)
+  | ECastUnrel iovl | ESendUnrel iovl ->
+      charge iovl (now ()) ;
+      dn ev abv NoHdr
+
+  | _ -> dn ev abv NoHdr
+
+  and dnnm_hdlr = dnnm
+
+in {up_in=up_hdlr;uplm_in=uplm_hdlr;upnm_in=upnm_hdlr;dn_in=dn_hdlr;dnnm_in=dnnm_hdlr}
+
+let l args vs = Layer.hdr init hdlrs None (FullNoHdr NoHdr) args vs
+
+let _ =
+  Param.default "cong_sweep" (Param.Time (Time.of_string "0.01")) ;
+  Param.default "cong_rate" (Param.Int 1000000) ;
+  Param.default "cong_min_rate" (Param.Int 10000) ;
+  Param.default "cong_max_rate" (Param.Int 100000000) ;
+  Param.default "cong_increase" (Param.Int 50000) ;
+  Param.default "cong_decrease" (Param.Float 0.5) ;
+  Param.default "cong_loss_th" (Param.Float 0.02) ;
+  Param.default "cong_delay_th" (Param.Float 0.0) ;
+  Param.default "cong_burst" (Param.Int 50000) ;
+  Param.default "cong_report_k" (Param.Int 4) ;
+  Param.default "cong_overhead" (Param.Int 100) ;
+  Param.default "cong_hi_wmark" (Param.Int 100) ;
+  Layer.install name l
+
+(**************************************************************)
@@ -39,7 +39,9 @@ type 'abv state = {
   fuzzy_th   : int ;         (* fuzzy threahold for this layer *)
   overhead   : len ;
   send_buf   : (Event.dn * 'abv) Queuee.t ;
-  credit     : Mcredit.t
+  credit     : Mcredit.t ;
+  mutable acks_sent : int ;	(* Control traffic counter *)
+  mutable credit_sent : int	(* Credit sent in them, in units of ack_thresh *)
 } 
 
 (**************************************************************)
@@ -62,7 +64,8 @@ let string_of_queue_bytes s q =
   string_of_int (queue_bytes s q)
 
 let dump vf s = Layer.layer_dump name (fun (ls,vs) s -> [|
-  sprintf "send_buf=%s\n" (string_of_queue_len s.send_buf) 
+  sprintf "send_buf=%s\n" (string_of_queue_len s.send_buf) ;
+  sprintf "acks_sent=%d credit_sent=%d\n" s.acks_sent s.credit_sent
 (*; eprintf "%s\n" (Mcredit.to_string_list s.credit)*)
 |]) vf s
 
@@ -110,7 +113,9 @@ let init _ (ls,vs) =
     send_buf   = Queuee.create () ;
     fuzzy_th   = Param.int vs.params "mflow_fuzzy_th" ;
     overhead   = Buf.len_of_int (Param.int vs.params "mflow_overhead") ;
-    credit     = Mcredit.create ls.rank ls.nmembers ack_thresh send_credit recv_credit
+    credit     = Mcredit.create ls.rank ls.nmembers ack_thresh send_credit recv_credit ;
+    acks_sent  = 0 ;
+    credit_sent = 0
   }
 
 (**************************************************************)
@@ -184,6 +189,8 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
 	  let nacks = current_credit / s.ack_thresh in
 	  let remainder = current_credit - (nacks * s.ack_thresh) in
 	  dnlm (sendPeer name origin) (Ack nacks) ;
+	  s.acks_sent <- succ s.acks_sent ;
+	  s.credit_sent <- s.credit_sent + nacks ;
 	  Mcredit.set_credit s.credit origin remainder
         )
       ) ;
@@ -242,6 +249,7 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
 	  (string_of_queue_bytes s s.send_buf)) ;
       logl (fun () -> Mcredit.to_string_list s.credit) ;
       log (fun () -> sprintf "credit_left = %d" (Mcredit.left s.credit)) ;
+      logb (fun () -> sprintf "control: acks=%d credit=%d" s.acks_sent s.credit_sent) ;
       Mcredit.clear s.credit ;
       upnm ev
 
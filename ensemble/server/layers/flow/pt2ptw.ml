@@ -14,7 +14,11 @@ open Trans
 let name = Trace.filel "PT2PTW"
 (**************************************************************)
 
-type header = NoHdr | NoFlow | Ack of int
+(* Ack(credit): returns credit to the sender.
+
+ * DataAck(credit): a data message that also returns credit.
+ *)
+type header = NoHdr | NoFlow | Ack of int | DataAck of int
 
 (**************************************************************)
 
@@ -23,13 +27,19 @@ type mark_state = Hi | Low
 type 'abv state = {
   window : int ;
   ack_thresh : int ;
+  piggyback : int ;
   mark : mark_state array ;
   hi_wmark : int ;
   overhead : int ;
   send_buf : (Event.dn * 'abv) Queuee.t array ;
   send_credit : int array ;
   recv_credit : int array ;
-  mutable failed : bool Arrayf.t
+  mutable failed : bool Arrayf.t ;
+
+  (* Control traffic counters.
+   *)
+  mutable acks_sent : int ;
+  mutable acks_piggybacked : int
 }  
 
 (**************************************************************)
@@ -50,7 +60,8 @@ let string_of_queue_bytes s q =
 let dump vf s = Layer.layer_dump name (fun (ls,vs) s -> [|
   sprintf "send_buf=%s\n" (string_of_array string_of_queue_len s.send_buf) ;
   sprintf "send_credit=%s\n" (string_of_int_array s.send_credit) ;
-  sprintf "recv_credit=%s\n" (string_of_int_array s.recv_credit)
+  sprintf "recv_credit=%s\n" (string_of_int_array s.recv_credit) ;
+  sprintf "acks_sent=%d acks_piggybacked=%d\n" s.acks_sent s.acks_piggybacked
 |]) vf s
 
 (**************************************************************)
@@ -60,12 +71,15 @@ let init _ (ls,vs) =
   { window = window ;
     overhead = Param.int vs.params "pt2ptw_overhead" ;
     ack_thresh = Param.int vs.params "pt2ptw_ack_thresh" ;
+    piggyback = Param.int vs.params "pt2ptw_piggyback" ;
     mark = Array.create ls.nmembers Low ;
     hi_wmark = Param.int vs.params "pt2ptw_hi_wmark" ;
     send_buf = Array.init ls.nmembers (fun _ -> Queuee.create ()) ;
     send_credit = Array.create ls.nmembers window ;
     recv_credit = Array.create ls.nmembers 0 ;
-    failed = ls.falses
+    failed = ls.falses ;
+    acks_sent = 0 ;
+    acks_piggybacked = 0
   }
 
 (**************************************************************)
@@ -94,20 +108,68 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
     )
   in
 
+  (* Send a message for which we have credit.  Credit owed
+   * to the destination, once above pt2ptw_piggyback, goes
+   * along with it rather than in a later Ack.  A negative
+   * pt2ptw_piggyback disables this.
+   *)
+  let send dest ev abv iovl =
+    array_sub s.send_credit dest (msg_len s iovl) ;
+    let credit = s.recv_credit.(dest) in
+    if s.piggyback >= 0 && credit > s.piggyback then (
+      s.recv_credit.(dest) <- 0 ;
+      s.acks_piggybacked <- succ s.acks_piggybacked ;
+      dn ev abv (DataAck credit)
+    ) else (
+      dn ev abv NoHdr
+    )
+  in
+
+  (* Some credit was sent back, send more data if its waiting.
+   *)
+  let got_credit origin credit =
+    array_add s.send_credit origin credit ;
+
+    let buf = s.send_buf.(origin) in
+    while s.send_credit.(origin) > 0 && not (Queuee.empty buf) do
+      (* Queuee.take will not fail here.
+       *)
+      let ev,abv = Queuee.take buf in
+      match getType ev with
+      | ESend iovl -> send origin ev abv iovl
+      | _ -> failwith sanity
+    done ;
+
+    check_wmark origin
+  in
+
+  (* Increase amount of credit to pass back to sender.
+   * If the amount of credit is beyond the threshhold,
+   * send an acknowledgement.
+   *)
+  let got_data origin iovl =
+    array_add s.recv_credit origin (msg_len s iovl) ;
+    if s.recv_credit.(origin) > s.ack_thresh then (
+      dnlm (sendPeer name origin) (Ack(s.recv_credit.(origin))) ;
+      s.acks_sent <- succ s.acks_sent ;
+      s.recv_credit.(origin) <- 0 ;
+    )
+  in
+
   let up_hdlr ev abv hdr = match getType ev, hdr with
 
-    (* Increase amount of credit to pass back to sender.
-     * If the amount of credit is beyond the threshhold,
-     * send an acknowledgement.  Finally, deliver the
-     * message.  
+    (* Account for the message, then deliver it.
      *)
   | ESend iovl, NoHdr ->
+      got_data (getPeer ev) iovl ;
+      up ev abv
+
+    (* As above, also taking the credit returned with it.
+     *)
+  | ESend iovl, DataAck(credit) ->
       let origin = getPeer ev in
-      array_add s.recv_credit origin (msg_len s iovl) ;
-      if s.recv_credit.(origin) > s.ack_thresh then (
-	dnlm (sendPeer name origin) (Ack(s.recv_credit.(origin))) ;
-	s.recv_credit.(origin) <- 0 ;
-      ) ;
+      got_data origin iovl ;
+      got_credit origin credit ;
       up ev abv
 
   | ESend iovl, NoFlow ->
@@ -120,20 +182,7 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
     (* Some credit were sent back, send more data if its waiting.
      *)
   | ESend iovl, Ack(credit) ->
-      let origin = getPeer ev in 
-      array_add s.send_credit origin credit ;
-
-      let buf = s.send_buf.(origin) in
-      while s.send_credit.(origin) > 0 && not (Queuee.empty buf) do
-	(* Queuee.take will not fail here.
-	 *)
-	let ev,abv = Queuee.take buf in
-	dn ev abv NoHdr ;
-      	array_sub s.send_credit origin (msg_len s iovl)
-      done ;
-
-      check_wmark origin ;
-
+      got_credit (getPeer ev) credit ;
       free name ev 
   | _ -> failwith unknown_local
 
@@ -167,6 +216,8 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
 	(string_of_array string_of_queue_len s.send_buf)) ;
       logb (fun () -> sprintf "blocked(byte):%s" 
 	(string_of_array (string_of_queue_bytes s) s.send_buf)) ;
+      logb (fun () -> sprintf "control: acks=%d piggybacked=%d" 
+	s.acks_sent s.acks_piggybacked) ;
       upnm ev
 
   | EDump -> ( dump vf s ; upnm ev )
@@ -185,8 +236,7 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
       ) 
       else if s.send_credit.(dest) > 0 then (
         (* Normal case. I have enough credit. *)
-        array_sub s.send_credit dest (msg_len s iovl) ;
-        dn ev abv NoHdr
+        send dest ev abv iovl
       ) 
       else (
 	      log (fun () -> sprintf "messages are buffered") ;
@@ -205,6 +255,7 @@ let l args vs = Layer.hdr init hdlrs None (FullNoHdr NoHdr) args vs
 let _ = 
   Param.default "pt2ptw_window" (Param.Int 50000) ;
   Param.default "pt2ptw_ack_thresh" (Param.Int 25000) ;
+  Param.default "pt2ptw_piggyback" (Param.Int 12500) ;
   Param.default "pt2ptw_hi_wmark"    (Param.Int 100) ;
   Param.default "pt2ptw_overhead" (Param.Int 100) ;
   Layer.install name l
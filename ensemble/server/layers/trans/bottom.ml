@@ -74,13 +74,13 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
       if Arrayf.get s.failed (getPeer ev) then
 	Iovecl.free iov
       else
-	up (set name ev[Type (ECastUnrel iov)]) abv
+	up (set_typ name ev (ECastUnrel iov)) abv
 
   | ESend iov,Unrel ->
       if Arrayf.get s.failed (getPeer ev) then
 	Iovecl.free iov
       else
-	up (set name ev[Type (ESendUnrel iov)]) abv
+	up (set_typ name ev (ESendUnrel iov)) abv
 
   | EAuth,_ -> 
       if s.enabled then up ev abv else free name ev 
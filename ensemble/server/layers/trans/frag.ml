@@ -46,13 +46,22 @@ let dump = Layer.layer_dump name (fun (ls,vs) s -> [|
   sprintf "local=%s\n" (Arrayf.to_string string_of_bool s.local)
 |])
 
+(* The maximal fragment size.  Unless [frag_max_len] is set, it
+ * follows the maximal message size, leaving room for headers.
+ * Frag_abv uses it too.
+ *)
+let max_len vs =
+  let len = Param.int vs.params "frag_max_len" in
+  if len > 0 then len_of_int len
+  else Buf.max_msg_len () -|| len_of_int 2000
+
 let init _ (ls,vs) = 
   let local_frag = Param.bool vs.params "frag_local_frag" in
   let addr = ls.addr in
   let local = Arrayf.map (fun a -> (not local_frag) && Addr.same_process addr a) vs.address in
   let all_local = Arrayf.for_all ident local in
   let log = Trace.log2 name ls.name in
-  { max_len = len_of_int (Param.int vs.params "frag_max_len") ;
+  { max_len = max_len vs ;
     cast = Array.init ls.nmembers (fun _ -> {iov=[||];i=0}) ;
     send = Array.init ls.nmembers (fun _ -> {iov=[||];i=0}) ;
     all_local = all_local ;
@@ -211,8 +220,7 @@ let l args vs = Layer.hdr init hdlrs None (FullNoHdr NoHdr) args vs
 let l2 args vs = Layer.hdr_noopt init hdlrs args vs
 
 let _ = 
-  let frag_len = int_of_len (Buf.max_msg_len) - 2000 in
-  Param.default "frag_max_len" (Param.Int frag_len) ;
+  Param.default "frag_max_len" (Param.Int 0) ;
   Param.default "frag_local_frag" (Param.Bool false) ;
   Layer.install name l
     
@@ -50,7 +50,7 @@ let init _ (ls,vs) =
   let addr = ls.addr in
   let local = Arrayf.map (fun a -> (not local_frag) && Addr.same_process addr a) vs.address in
   let all_local = Arrayf.for_all ident local in
-  { max_len = len_of_int (Param.int vs.params "frag_max_len") ;
+  { max_len = Frag.max_len vs ;
     cast = Array.init ls.nmembers (fun _ -> {iov=[||];i=0}) ;
     send = Array.init ls.nmembers (fun _ -> {iov=[||];i=0}) ;
     all_local = all_local ;
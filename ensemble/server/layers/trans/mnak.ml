@@ -3,6 +3,7 @@
 (* Author: Mark Hayden, 12/95 *)
 (* Based on code by: Robbert vanRenesse *)
 (**************************************************************)
+open Buf
 open View
 open Event
 open Util
@@ -21,12 +22,21 @@ let name_nak = addinfo "nak" name
  * number 'lo' to 'hi'. 
  * BUG: comment should say, inclusive/exclusive.
 
+ * Naks(l): as Nak, for several holes, possibly of several
+ * members.
+
+ * Retransl(rank,seqno,lens): retransmission of member 'rank's
+ * messages 'seqno', 'seqno+1', ..., with the given lengths,
+ * catenated.  Only messages without headers from the layers
+ * above are sent this way.
  *)
 type header = NoHdr
   | Data    of seqno
   | Retrans of rank * seqno
   | Ack     of seqno
   | Nak     of rank * seqno * seqno
+  | Naks    of (rank * seqno * seqno) list
+  | Retransl of rank * seqno * len list
 
 let string_of_header = function
   | NoHdr -> "NoHdr"
@@ -34,6 +44,9 @@ let string_of_header = function
   | Ack seqno -> sprintf "Ack(%d)" seqno
   | Retrans(rank,seqno) -> sprintf "Retrans(%d,%d)" rank seqno
   | Nak(rank,lo,hi) -> sprintf "Nak(%d,%d,%d)" rank lo hi
+  | Naks l -> sprintf "Naks(%s)" (string_of_list (fun (rank,lo,hi) ->
+      sprintf "%d,%d,%d" rank lo hi) l)
+  | Retransl(rank,seqno,lens) -> sprintf "Retransl(%d,%d,%d)" rank seqno (List.length lens)
 
 (**************************************************************)
 (* These are for optimizations in the Layer module.
@@ -118,6 +131,36 @@ let low_probability n recently_heard =
   if range <=1 then always
   else sometimes range
 
+(**************************************************************)
+(* Retransl batches.  Each message of a batch adds its length
+ * to the header, at most 6 bytes once marshaled, so 8 bytes per
+ * message are counted against mnak_batch_len along with the
+ * data.  The number of messages is capped as well.
+ *)
+let batch_max = 64
+let batch_hdr = len_of_int 8
+
+(* Whether a message of [len] bytes fits into a batch of [n]
+ * messages and [total] bytes, of at most [limit] bytes.
+ *)
+let batch_fits limit n total len =
+  n < batch_max && total +|| len +|| batch_hdr <=|| limit
+
+(* The most holes one Naks message asks for.  With neighbor
+ * Naks, longer lists are split over several casts.
+ *)
+let naks_max = 64
+
+(* Split [l] after its first [n] elements.
+ *)
+let rec split_at n l = 
+  if n <= 0 then ([],l) else 
+    match l with
+    | [] -> ([],[])
+    | hd :: tl -> 
+	let first,rest = split_at (pred n) tl in
+	(hd :: first, rest)
+
 (**************************************************************)
 type 'abv state = {
   mutable coord : rank;
@@ -135,7 +178,25 @@ type 'abv state = {
   handle_fuzzy : seqno Arrayf.t -> seqno Arrayf.t -> seqno Arrayf.t -> rank ->
                                   int -> int -> 'abv Iq.t Arrayf.t -> unit ;
   neighbor_nak : bool ; (* Whether to transmit Naks only to my neighbors *)
-  mutable timer_timeout : Time.t
+  nak_holes : int ;     (* How many holes of a member one Nak asks for *)
+  batch_len : len ;     (* Longest batch of retransmissions, 0 for none *)
+  heard_timeout : Time.t ; (* How long overheard Naks suppress ours *)
+  mutable timer_timeout : Time.t ;
+
+  (* With mnak_adaptive, the time from a Nak to the repair gives
+   * a per-member RTO.  Overheard Naks are forgotten after it,
+   * sooner than heard_timeout, and Naks that are not answered
+   * within it are sent again.
+   *)
+  adaptive : bool ;
+  rto : Rto.t array ;
+  nak_at : float array ;    (* When the outstanding Nak was first sent, or 0.0 *)
+  nak_last : float array ;  (* When it was last sent *)
+  nak_seqno : seqno array ; (* The first message it asked for *)
+  nak_again : bool array ;  (* Whether it was sent more than once *)
+  heard_at : float array ;  (* When recently_heard was set *)
+  mutable alarm : float ;   (* Earliest alarm requested *)
+  clock : Alarm.t           (* Times are taken from its clock *)
 (*
   mutable acct_size  : int ;		(* # bytes buffered *)
   dbg_n		 : int array
@@ -151,7 +212,8 @@ let dump vf s = Layer.layer_dump name (fun (ls,vs) s -> [|
   sprintf "cast_read=%s\n" (Arrayf.int_to_string (Arrayf.map Iq.read s.buf)) ;
   sprintf "fuzzy_th=%d\n" s.fuzzy_th ;
   sprintf "fuzzy_k=%d\n" s.fuzzy_k ;
-  sprintf "local_fuzzy=%s\n" (string_of_array string_of_bool s.local_fuzzy)
+  sprintf "local_fuzzy=%s\n" (string_of_array string_of_bool s.local_fuzzy) ;
+  sprintf "rto=%s\n" (string_of_array Rto.to_string s.rto)
 (*
   ; sprintf "dbg_n  =%s\n" (string_of_int_array s.dbg_n)
   ; for i = 0 to pred ls.nmembers do
@@ -176,10 +238,29 @@ let init _ (ls,vs) =
     acked      = Array.create ls.nmembers 0 ;
     acker      = (succ ls.rank) mod ls.nmembers ;
     neighbor_nak = Param.bool vs.params "mnak_neighbor" ;
+    nak_holes  = int_max 1 (int_min naks_max (Param.int vs.params "mnak_nak_holes")) ;
+    batch_len  = (
+      let len = Param.int vs.params "mnak_batch_len" in
+      if len > 0 then len_of_int len
+      else if len < 0 then len0
+      else max_msg_len () -|| len_of_int 2000
+    ) ;
+    heard_timeout = Param.time vs.params "mnak_heard_timeout" ;
     fuzzy_th   = Param.int vs.params "mnak_fuzzy_th" ;
     fuzzy_k    = Param.int vs.params "mnak_fuzzy_k" ;
     local_fuzzy = Array.create ls.nmembers false ;
     timer_timeout = Time.zero;
+    adaptive   = Param.bool vs.params "mnak_adaptive" ;
+    rto        = Array.init ls.nmembers (fun _ ->
+      Rto.create (Param.time vs.params "mnak_heard_timeout")
+	(Param.time vs.params "mnak_min_rto") (Param.time vs.params "mnak_max_rto")) ;
+    nak_at     = Array.create ls.nmembers 0.0 ;
+    nak_last   = Array.create ls.nmembers 0.0 ;
+    nak_seqno  = Array.create ls.nmembers 0 ;
+    nak_again  = Array.create ls.nmembers false ;
+    heard_at   = Array.create ls.nmembers 0.0 ;
+    alarm      = infinity ;
+    clock      = Alarm.get_hack () ;
     handle_fuzzy =
       try
         List.assoc (Param.string vs.params "mnak_fuzzy_policy") fuzzy_handlers
@@ -200,6 +281,59 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
   let logn = Trace.log2 (name^"N") ls.name in (* Naks *)
   let logb = Trace.log3 Layer.buffer ls.name name in
   let failwith = layer_fail dump vf s name in
+  (* The alarm's clock is the one ETimer events carry, which is
+   * virtual under Netsim.
+   *)
+  let now () = Time.to_float (Alarm.gettime s.clock) in
+
+  let schedule time =
+    if time < s.alarm then (
+      s.alarm <- time ;
+      dnnm (timerAlarm name (Time.of_float time))
+    )
+  in
+
+  (* Adaptive mode: note the Naks being sent.  A Nak sent while
+   * one is outstanding for the same member is a repeat, and by
+   * Karn's rule its repair gives no RTT sample.
+   *)
+  let note_naks naks =
+    let time = now () in
+    List.iter (fun (rank,lo,_) ->
+      (* Only the first hole of each member counts.
+       *)
+      if s.nak_last.(rank) < time then (
+	if s.nak_at.(rank) = 0.0 then (
+	  s.nak_at.(rank) <- time ;
+	  s.nak_seqno.(rank) <- lo ;
+	  s.nak_again.(rank) <- false
+	) else (
+	  s.nak_again.(rank) <- true
+	) ;
+	s.nak_last.(rank) <- time ;
+	schedule (time +. Rto.rto s.rto.(rank))
+      )
+    ) naks
+  in
+
+  (* Adaptive mode: after reading rank's messages, check whether
+   * the outstanding Nak was answered.
+   *)
+  let check_repair rank buf =
+    if s.nak_at.(rank) > 0.0 && Iq.read buf >| s.nak_seqno.(rank) then (
+      let time = now () in
+      if not s.nak_again.(rank) then
+	Rto.sample s.rto.(rank) (time -. s.nak_at.(rank)) ;
+      if Iq.read buf <| Iq.hi buf then (
+	(* More holes were asked for by the same Nak.
+	 *)
+	s.nak_seqno.(rank) <- Iq.read buf ;
+	s.nak_again.(rank) <- true
+      ) else (
+	s.nak_at.(rank) <- 0.0
+      )
+    )
+  in
 
   (* Arguments to two functions below:
    * - rank: rank of member who's cast I've just gotten (or heard about)
@@ -207,49 +341,75 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
    *)
 
   (*
-   * CHECK_NAK: checks if missing a message, and sends appropriate
-   * Nak. If there is a hole then send a Nak to (in this order):
+   * CHECK_NAK: checks if missing messages, and sends appropriate
+   * Naks. If there are holes then send a Nak to (in this order):
    * 1. to original owner of message if he is not failed or fuzzy.
    * 2. to coord if I'm not the coord and coord is not fuzzy
    * 3. to entire group
+   * With neighbor Naks, all the holes go in one cast, even those
+   * of several members.
    *)
-  let check_nak rank is_stable =
+  let holes rank is_stable =
     let buf = Arrayf.get s.buf rank in
-    if_some (Iq.read_hole buf) (fun (lo,hi) ->
+    List.fold_right (fun (lo,hi) naks ->
       if is_stable || (hi > s.naked.(rank)) then (
-(*
-	if seqno >= lo then (
-*)
-	  (* Keep track of highest msg # we've naked.
-	   *)
-	      s.naked.(rank) <- int_max s.naked.(rank) hi ;
-	  logn (fun () -> sprintf "send:Nak(%d,%d..%d).\n" rank lo hi) ;
+	(* Keep track of highest msg # we've naked.
+	 *)
+	s.naked.(rank) <- int_max s.naked.(rank) hi ;
+	logn (fun () -> sprintf "send:Nak(%d,%d..%d).\n" rank lo hi) ;
+	(rank,lo,hi) :: naks
+      ) else naks
+    ) (Iq.read_holes buf s.nak_holes) []
+  in
 
+  let nak_hdr = function
+    | [rank,lo,hi] -> Nak(rank,lo,hi)
+    | naks -> Naks naks
+  in
+
+  let send_naks naks =
+    if s.adaptive then note_naks naks ;
     if s.neighbor_nak then (
-      let (know_lo,know_hi) = s.recently_heard.(rank) in
-        if lo < know_lo || hi > know_hi then (
-          let nak_ev = castUnrel name in
-          let nak_ev = set name nak_ev [TTL 1] in
-            dnlm nak_ev (Nak(rank,lo,hi))
-        )
-    ) else
-      if not (Arrayf.get s.failed rank) && not s.local_fuzzy.(rank) then (
-	      dnlm (sendPeer name rank) (Nak(rank,lo,hi))
-      ) else if s.coord <> ls.rank && not s.local_fuzzy.(s.coord) then (
-	      dnlm (sendPeer name s.coord) (Nak(rank,lo,hi))
+      let naks = List.filter (fun (rank,lo,hi) ->
+	let (know_lo,know_hi) = s.recently_heard.(rank) in
+	lo < know_lo || hi > know_hi
+      ) naks in
+      let rec cast = function
+	| [] -> ()
+	| naks ->
+	    let naks,rest = split_at naks_max naks in
+            let nak_ev = castUnrel name in
+            let nak_ev = set name nak_ev [TTL 1] in
+            dnlm nak_ev (nak_hdr naks) ;
+	    cast rest
+      in cast naks
+    ) else (
+      let rec loop = function
+	| [] -> ()
+	| ((rank,_,_) :: _) as naks ->
+	    let mine,rest = List.partition (fun (r,_,_) -> r = rank) naks in
+	    let hdr = nak_hdr mine in
+	    if not (Arrayf.get s.failed rank) && not s.local_fuzzy.(rank) then (
+	      dnlm (sendPeer name rank) hdr
+	    ) else if s.coord <> ls.rank && not s.local_fuzzy.(s.coord) then (
+	      dnlm (sendPeer name s.coord) hdr
 	    ) else (
 	      (* Don't forget to set the Unreliable option
 	       * for the STABLE layer (see note in stable.ml).
 	       *)
-	      dnlm (castUnrel name)  (Nak(rank,lo,hi))
-	    )
-(*
-	)
-*)
-      )
+	      dnlm (castUnrel name) hdr
+	    ) ;
+	    loop rest
+      in loop naks
     )
   in
 
+  let check_nak rank is_stable =
+    match holes rank is_stable with
+    | [] -> ()
+    | naks -> send_naks naks
+  in
+
   (* READ_PREFIX: called to read messages from beginning of buffer.
    *)
   let read_prefix rank =
@@ -259,6 +419,7 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
       let iov = Iovecl.copy iov in
       up (castPeerIov name rank iov) abv
     ) ;
+    if s.adaptive then check_repair rank buf ;
 
 (*  if Iq.read buf >= s.naked.(rank) then*) (
       check_nak rank false
@@ -283,6 +444,95 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
     )
   in
 
+  (* RETRANS: answer a Nak from [origin] for [rank]'s messages
+   * [lo..hi].  Runs of messages without headers from above are
+   * batched into one message of up to batch_len bytes,
+   * including their lengths in the header (see batch_fits).
+   *)
+  let retrans origin recently_heard rank lo hi =
+      let buf = Arrayf.get s.buf rank in
+
+      (* We do not retransmit messages that we have not been
+       * able to read.  See the notes for Iq.clean_unread in
+       * the Efail handler.  Note: this should probably be
+       * [pred (Iq.read buf)], but then again there should
+       * be no messages in that last slot.
+       *
+       * We retransmit according to the following rules:
+       * 1) If I am coordinator or original sender, I always reply
+       * 2) Else, if (not coord or originator and) coordinator is fuzzy,
+       *          reply with high probability (max{2/n,1/4})
+       * 3) Else, (not coord or originator and coordinator is not fuzzy)
+       *          reply with low probability (2/n)
+       *)
+      let hi = int_min hi (Iq.read buf) in
+
+      let reply_policy =
+        if rank = ls.rank or ls.rank = s.coord or
+                  s.handle_fuzzy == selective_fuzzy or
+                  s.handle_fuzzy == shared_fuzzy then
+          always
+        else if s.local_fuzzy.(s.coord) then
+          high_probability ls.nmembers recently_heard
+        else
+          low_probability ls.nmembers recently_heard
+      in
+
+      (* The batch being built: its first seqno, its number of
+       * messages and their length, and the messages in reverse.
+       *)
+      let batch_lo = ref 0 in
+      let batch_n = ref 0 in
+      let batch_len = ref len0 in
+      let batch = ref [] in
+      let flush () =
+	match !batch with
+	| [] -> ()
+	| [iov] ->
+	    batch := [] ;
+	    batch_n := 0 ;
+            dn (sendUnrelPeerIov name origin iov) Local_nohdr (Retrans(rank,!batch_lo))
+	| l ->
+	    let l = List.rev l in
+	    batch := [] ;
+	    batch_n := 0 ;
+	    let lens = List.map Iovecl.len l in
+	    let iov = Iovecl.concata (Arrayf.of_list l) in
+            dn (sendUnrelPeerIov name origin iov) Local_nohdr (Retransl(rank,!batch_lo,lens))
+      in
+      
+      for seqno = lo to hi do
+        if reply_policy () then
+          match Iq.get buf seqno with
+          | Iq.GData(iov,Local_nohdr) 
+	    when batch_fits s.batch_len 0 len0 (Iovecl.len iov) ->
+	      let len = Iovecl.len iov in
+	      if !batch_n > 0
+	      && (seqno <> !batch_lo + !batch_n
+	         || not (batch_fits s.batch_len !batch_n !batch_len len))
+	      then
+		flush () ;
+	      if !batch_n = 0 then (
+		batch_lo := seqno ;
+		batch_len := len0
+	      ) ;
+	      batch := Iovecl.copy iov :: !batch ;
+	      incr batch_n ;
+	      batch_len := !batch_len +|| len +|| batch_hdr
+          | Iq.GData(iov,abv) ->
+	      flush () ;
+              let iov = Iovecl.copy iov in
+              dn (sendUnrelPeerIov name origin iov) abv (Retrans(rank,seqno))
+	| Iq.GReset | Iq.GUnset ->
+	    (* Do nothing...
+	     *)
+	    log (fun () -> sprintf "Nak from %d for message I think is Unset or Reset" origin) ;
+      done ;
+      flush () ;
+
+      logn (fun () -> sprintf "SEND: Retransmitting some parts of %d..%d to %d\n" lo hi origin)
+  in
+
   let up_hdlr ev abv hdr = match getType ev, hdr with
 
     (* ECast:Data: Got a data message from other
@@ -362,85 +612,70 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
       ) ;
       free name ev
 
+    (* Retransl: Got a batch of retransmissions.
+     *)
+  | (ECast iov|ESend iov|ECastUnrel iov|ESendUnrel iov), Retransl(rank,seqno,lens) ->
+      if rank <> ls.rank then (
+	ignore (List.fold_left (fun (seqno,ofs) len ->
+	  let msg = Iovecl.sub iov ofs len in
+	  recv_cast rank seqno Local_nohdr msg ;
+	  Iovecl.free msg ;
+	  (succ seqno, ofs +|| len)
+	) (seqno,len0) lens)
+      ) ;
+      free name ev
+
   | _, NoHdr -> up ev abv
   | _        -> failwith bad_header
 
   and uplm_hdlr ev hdr = match getType ev,hdr with
 
     (* Nak: got a request for retransmission.  Send any
-     * messages I have in the requested interval, lo..hi.
+     * messages I have in the requested intervals.
      *)
-  | (ESend iov|ECast iov|ECastUnrel iov|ESendUnrel iov), Nak(rank,lo,hi) ->
-      (* Retransmit any of the messages asked for that I have.
-       *)
+  | (ESend iov|ECast iov|ECastUnrel iov|ESendUnrel iov), (Nak _ | Naks _) ->
       (* TODO: check if request is for message from failed member
        * and I'm coordinator and I don't have what is being asked for
        *)
-      let recently_heard = 
-        let (know_lo,know_hi) = s.recently_heard.(rank) in
-        let new_lo = min lo know_lo in
-        let new_hi = max hi know_hi in
+      let naks = match hdr with
+	| Nak(rank,lo,hi) -> [rank,lo,hi]
+	| Naks naks -> naks
+	| _ -> failwith sanity
+      in
+
+      let naks = List.map (fun (rank,lo,hi) ->
+	let recently_heard = 
+          let (know_lo,know_hi) = s.recently_heard.(rank) in
+          let new_lo = min lo know_lo in
+          let new_hi = max hi know_hi in
           if new_lo < lo || new_hi > hi then (
             s.recently_heard.(rank) <- (new_lo,new_hi);
+	    if s.adaptive then (
+	      let time = now () in
+	      s.heard_at.(rank) <- time ;
+	      schedule (time +. Rto.rto s.rto.(rank))
+	    ) ;
             true
           )
           else
             false
-      in
-        
-
+	in
+	(rank,lo,hi,recently_heard)
+      ) naks in
 
       let origin = getPeer ev in
       if s.neighbor_nak &&  origin = ls.rank then
         logn (fun () -> sprintf "Received my own NAK cast.  Ignoring.\n")
-      else begin
+      else (
         let ttl = match getTTL ev with
           Some(x) -> x
         | None -> 0 
         in
-      logn (fun () -> sprintf "recd:origin=%d:original=%d:Nak(%d..%d), ttl=%d\n" origin rank lo hi ttl) ;
-      let buf = Arrayf.get s.buf rank in
-
-      (* We do not retransmit messages that we have not been
-       * able to read.  See the notes for Iq.clean_unread in
-       * the Efail handler.  Note: this should probably be
-       * [pred (Iq.read buf)], but then again there should
-       * be no messages in that last slot.
-       *
-       * We retransmit according to the following rules:
-       * 1) If I am coordinator or original sender, I always reply
-       * 2) Else, if (not coord or originator and) coordinator is fuzzy,
-       *          reply with high probability (max{2/n,1/4})
-       * 3) Else, (not coord or originator and coordinator is not fuzzy)
-       *          reply with low probability (2/n)
-       *)
-      let hi = int_min hi (Iq.read buf) in
-
-      let reply_policy =
-        if rank = ls.rank or ls.rank = s.coord or
-                  s.handle_fuzzy == selective_fuzzy or
-                  s.handle_fuzzy == shared_fuzzy then
-          always
-        else if s.local_fuzzy.(s.coord) then
-          high_probability ls.nmembers recently_heard
-        else
-          low_probability ls.nmembers recently_heard
-      in
-      
-      for seqno = lo to hi do
-        if reply_policy () then
-          match Iq.get buf seqno with
-          | Iq.GData(iov,abv) ->
-              let iov = Iovecl.copy iov in
-              dn (sendUnrelPeerIov name origin iov) abv (Retrans(rank,seqno))
-	| Iq.GReset | Iq.GUnset ->
-	    (* Do nothing...
-	     *)
-	    log (fun () -> sprintf "Nak from %d for message I think is Unset or Reset" origin) ;
-      done ;
-
-      logn (fun () -> sprintf "SEND: Retransmitting some parts of %d..%d to %d\n" lo hi origin);
-      end;
+	List.iter (fun (rank,lo,hi,recently_heard) ->
+	  logn (fun () -> sprintf "recd:origin=%d:original=%d:Nak(%d..%d), ttl=%d\n" origin rank lo hi ttl) ;
+	  retrans origin recently_heard rank lo hi
+	) naks
+      ) ;
       free name ev
 
 
@@ -514,13 +749,16 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
        *)
       (* TODO: when max=stable then we must zap the iq (you remember why...) *)
       let maxs = getNumCasts ev in
-      for rank = 0 to pred ls.nmembers do
+      let naks = ref [] in
+      for rank = pred ls.nmembers downto 0 do
       	if rank <>| ls.rank then (
 	  let buf = Arrayf.get s.buf rank in
 	  Iq.set_hi buf (Arrayf.get maxs rank) ; (*BUG?*)
-	  check_nak rank true
+	  naks := holes rank true @ !naks
 	)
       done ;
+      if !naks <> [] then
+	send_naks !naks ;
 
       (* Handle messages that were acked by all except for fuzzy nodes
        * Issue - a conflict between partial deletion of messages and
@@ -550,12 +788,44 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
 
   | EDump -> ( dump vf s ; upnm ev )
   | EInit -> dnnm (timerAlarm name Time.zero); upnm ev
-  | ETimer -> 
+  | ETimer ->
+      (* Adaptive mode: forget overheard Naks, and Nak again,
+       * once the RTO of the member has passed.
+       *)
+      if s.adaptive && Time.to_float (getTime ev) >= s.alarm then (
+	s.alarm <- infinity ;
+	let time = now () in
+	for rank = 0 to pred ls.nmembers do
+	  if s.recently_heard.(rank) <> (-1,-1) then (
+	    let deadline = s.heard_at.(rank) +. Rto.rto s.rto.(rank) in
+	    if time >= deadline then
+	      s.recently_heard.(rank) <- (-1,-1)
+	    else
+	      schedule deadline
+	  ) ;
+
+	  if s.nak_at.(rank) > 0.0 then (
+	    let deadline = s.nak_last.(rank) +. Rto.rto s.rto.(rank) in
+	    if time >= deadline then (
+	      Rto.backoff s.rto.(rank) ;
+	      match holes rank true with
+	      | [] -> s.nak_at.(rank) <- 0.0
+	      | naks -> send_naks naks
+	    ) else (
+	      schedule deadline
+	    )
+	  )
+	done
+      ) ;
+
+      (* In any mode, forget all overheard Naks every
+       * heard_timeout.
+       *)
       if Time.ge (getTime ev) s.timer_timeout then (
         for i = 0 to pred ls.nmembers do
           s.recently_heard.(i) <- (-1,-1)
         done;
-        s.timer_timeout <- Time.add (getTime ev) (Time.of_int 1);
+        s.timer_timeout <- Time.add (getTime ev) s.heard_timeout;
         dnnm (timerAlarm name s.timer_timeout);
       );
       upnm ev
@@ -608,6 +878,12 @@ let l2 args vs = Layer.hdr_noopt init hdlrs args vs
 let _ = 
   Param.default "mnak_iq_init" (Param.Int 0) ;
   Param.default "mnak_neighbor" (Param.Bool true) ;
+  Param.default "mnak_nak_holes" (Param.Int 8) ;
+  Param.default "mnak_batch_len" (Param.Int 0) ;
+  Param.default "mnak_heard_timeout" (Param.Time (Time.of_int 1)) ;
+  Param.default "mnak_adaptive" (Param.Bool false) ;
+  Param.default "mnak_min_rto" (Param.Time (Time.of_string "0.001")) ;
+  Param.default "mnak_max_rto" (Param.Time (Time.of_int 2)) ;
   Param.default "mnak_fuzzy_th" (Param.Int 10) ;
   Param.default "mnak_fuzzy_k" (Param.Int 3) ;
   Param.default "mnak_fuzzy_policy" (Param.String "Never") ;
@@ -54,6 +54,7 @@ let constructor = function
 
 type 'abv state = {
   sweep         : Time.t ;
+  ack_appl      : bool ;
   mutable next_sweep : Time.t ;
   mutable failed : bool Arrayf.t ;
 
@@ -61,7 +62,28 @@ type 'abv state = {
   recvs		: 'abv Iq.t Arrayf.t ;
   naked         : seqno array ;
   acked		: seqno array ;
-  retrans       : seqno array
+  retrans       : seqno array ;
+
+  (* With pt2pt_adaptive, retransmissions are timed by a
+   * per-peer RTO rather than the sweep, and acks go out
+   * pt2pt_ack_delay after the data.
+   *)
+  adaptive      : bool ;
+  ack_delay     : float ;
+  rto           : Rto.t array ;
+  timing        : seqno array ;		(* Seqno being timed, or -1 *)
+  timing_at     : float array ;		(* When it was sent *)
+  progress      : float array ;		(* When the send window last moved *)
+  ack_due       : float array ;		(* When to ack, or 0.0 *)
+  mutable alarm : float ;		(* Earliest alarm requested *)
+  clock         : Alarm.t ;		(* Times are taken from its clock *)
+
+  (* Control traffic counters.
+   *)
+  mutable acks_sent : int ;
+  mutable acks_piggybacked : int ;
+  mutable naks_sent : int ;
+  mutable retransmits : int
 }
 
 (**************************************************************)
@@ -80,20 +102,39 @@ let dump vf s = Layer.layer_dump name (fun (ls,vs) s -> [|
   sprintf "recv_hi=%s\n" (Arrayf.int_to_string (Arrayf.map Iq.hi s.recvs)) ;
   sprintf "recv_size=%s\n" (Arrayf.int_to_string (Arrayf.map iq_size s.recvs)) ;
   sprintf "send_size=%s\n" (Arrayf.int_to_string (Arrayf.map iq_size s.sends)) ;
-  sprintf "retrans=%s\n" (string_of_int_array s.retrans)
+  sprintf "retrans=%s\n" (string_of_int_array s.retrans) ;
+  sprintf "acks_sent=%d acks_piggybacked=%d naks_sent=%d retransmits=%d\n"
+    s.acks_sent s.acks_piggybacked s.naks_sent s.retransmits ;
+  sprintf "rto=%s\n" (string_of_array Rto.to_string s.rto)
 |]) vf s
 
 (**************************************************************)
 
 let init _ (ls,vs) = {
+  adaptive	= Param.bool vs.params "pt2pt_adaptive" ;
+  ack_delay	= Time.to_float (Param.time vs.params "pt2pt_ack_delay") ;
+  rto		= Array.init ls.nmembers (fun _ ->
+    Rto.create (Param.time vs.params "pt2pt_sweep")
+      (Param.time vs.params "pt2pt_min_rto") (Param.time vs.params "pt2pt_max_rto")) ;
+  timing	= Array.create ls.nmembers (-1) ;
+  timing_at	= Array.create ls.nmembers 0.0 ;
+  progress	= Array.create ls.nmembers 0.0 ;
+  ack_due	= Array.create ls.nmembers 0.0 ;
+  alarm		= infinity ;
+  clock		= Alarm.get_hack () ;
   sweep		= Param.time vs.params "pt2pt_sweep" ;
+  ack_appl	= Param.bool vs.params "pt2pt_ack_appl" ;
   next_sweep	= Time.zero ;
   sends		= Arrayf.init ls.nmembers (fun _ -> Iq.create name Local_nohdr) ;
   recvs		= Arrayf.init ls.nmembers (fun _ -> Iq.create name Local_nohdr) ;
   acked		= Array.create ls.nmembers 0 ;
   naked		= Array.create ls.nmembers 0 ;
   retrans       = Array.create ls.nmembers 0 ;
-  failed	= ls.falses
+  failed	= ls.falses ;
+  acks_sent	= 0 ;
+  acks_piggybacked = 0 ;
+  naks_sent	= 0 ;
+  retransmits	= 0
 }
 
 (**************************************************************)
@@ -102,6 +143,123 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
   let failwith = layer_fail dump vf s name in
   let log = Trace.log2 name ls.name in
   let logb = Trace.log3 Layer.buffer ls.name name in
+  (* The alarm's clock is the one ETimer events carry, which is
+   * virtual under Netsim.
+   *)
+  let now () = Time.to_float (Alarm.gettime s.clock) in
+
+  let schedule time =
+    if time < s.alarm then (
+      s.alarm <- time ;
+      dnnm (timerAlarm name (Time.of_float time))
+    )
+  in
+
+  let send_ack i =
+    let head = Iq.lo (Arrayf.get s.recvs i) in
+    if head >| s.acked.(i) then (
+      log (fun () -> sprintf "sending ack to %d for %d, acked was %d" i head s.acked.(i)) ;
+      dnlm (sendPeer name i) (Ack head) ;
+      s.acks_sent <- succ s.acks_sent ;
+      s.acked.(i) <- head
+    )
+  in
+
+  (* Retransmit my messages lo..hi-1 to i.  By Karn's rule,
+   * a retransmitted message gives no RTT sample.
+   *)
+  let retransmit i lo hi =
+    let sends = Arrayf.get s.sends i in
+    let list = Iq.list_of_iq_interval sends (lo,hi) in
+    List.iter (fun (seqno,iov,abv) ->
+      log (fun () -> sprintf "retransmitting %d to %d" seqno i) ;
+      let iov = Iovecl.copy iov in
+      s.retransmits <- succ s.retransmits ;
+      dn (sendPeerIov name i iov) abv (Data seqno)
+    ) list ;
+    if list <> [] then
+      s.timing.(i) <- -1
+  in
+
+  (* Adaptive mode: sent message seqno to dest.  Time it if no
+   * other message is being timed, and start the retransmission
+   * timer if it is the only one outstanding.
+   *)
+  let sent dest seqno =
+    let time = now () in
+    if s.timing.(dest) < 0 then (
+      s.timing.(dest) <- seqno ;
+      s.timing_at.(dest) <- time
+    ) ;
+    if Iq.lo (Arrayf.get s.sends dest) =| seqno then (
+      s.progress.(dest) <- time ;
+      s.retrans.(dest) <- succ seqno ;
+      schedule (time +. Rto.rto s.rto.(dest))
+    )
+  in
+
+  (* Adaptive mode: the send window to origin moved.  Take an
+   * RTT sample and restart the retransmission timer for the
+   * messages still outstanding.
+   *)
+  let progress origin =
+    let time = now () in
+    let sends = Arrayf.get s.sends origin in
+    let timed = s.timing.(origin) in
+    if timed >= 0 && Iq.lo sends >| timed then (
+      Rto.sample s.rto.(origin) (time -. s.timing_at.(origin)) ;
+      s.timing.(origin) <- -1
+    ) ;
+    s.progress.(origin) <- time ;
+    s.retrans.(origin) <- Iq.hi sends ;
+    if Iq.lo sends <| Iq.hi sends then
+      schedule (time +. Rto.rto s.rto.(origin))
+  in
+
+  (* Adaptive mode: ack the data from origin shortly, unless the
+   * ack gets piggybacked first.
+   *)
+  let ack_later origin =
+    if s.ack_due.(origin) = 0.0 
+    && Iq.lo (Arrayf.get s.recvs origin) >| s.acked.(origin) then (
+      let time = now () +. s.ack_delay in
+      s.ack_due.(origin) <- time ;
+      schedule time
+    )
+  in
+
+  (* Adaptive mode: send acks that are due and retransmit to
+   * peers whose RTO expired, backing it off.
+   *)
+  let timeouts () =
+    let time = now () in
+    for i = 0 to pred ls.nmembers do
+      if i <>| ls.rank && not (Arrayf.get s.failed i) then (
+	if s.ack_due.(i) > 0.0 then (
+	  if time >= s.ack_due.(i) then (
+	    s.ack_due.(i) <- 0.0 ;
+	    send_ack i
+	  ) else (
+	    schedule s.ack_due.(i)
+	  )
+	) ;
+
+	let sends = Arrayf.get s.sends i in
+	if Iq.lo sends <| Iq.hi sends then (
+	  let deadline = s.progress.(i) +. Rto.rto s.rto.(i) in
+	  if time >= deadline then (
+	    retransmit i (Iq.lo sends) s.retrans.(i) ;
+	    Rto.backoff s.rto.(i) ;
+	    s.progress.(i) <- time ;
+	    s.retrans.(i) <- Iq.hi sends ;
+	    schedule (time +. Rto.rto s.rto.(i))
+	  ) else (
+	    schedule deadline
+	  )
+	)
+      )
+    done
+  in
 
   (* Code for handling acks and data.  Note that handle_ack
    * does not modify the event, but handle_data does.
@@ -109,9 +267,14 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
   let handle_ack ev ack =
     let origin = getPeer ev in
     let sends = Arrayf.get s.sends origin in
+    let lo = Iq.lo sends in
     Iq.set_lo sends ack ;
+    if s.adaptive && Iq.lo sends >| lo then
+      progress origin ;
     log (fun () -> sprintf "got ack from %d for %d (new lo=%d)" origin ack (Iq.lo sends)) ;
-  and handle_data iov ev seqno abv =
+  in
+
+  let handle_data iov ev seqno abv =
     let origin = getPeer ev in
     let recvs = Arrayf.get s.recvs origin in
 
@@ -123,6 +286,7 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
        *)
       (*Arraye.set s.recvs origin*) 
       ignore (Iq.opt_update_update recvs seqno) ;
+      if s.adaptive then ack_later origin ;
       up ev abv
     ) else (
       log (fun () -> sprintf "slow path origin=%d seqno=%d hi=%d" origin seqno (Iq.hi recvs)) ;
@@ -130,7 +294,8 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
 	Iq.get_prefix recvs (fun seqno iov abv ->
 	  let iov = Iovecl.copy iov in
 	  up (sendPeerIov name origin iov) abv
-	)
+	) ;
+	if s.adaptive then ack_later origin
       ) else (
 	log (fun () -> sprintf "slow path, redundant trans origin=%d seqno=%d lo=%d hi=%d" 
 	      origin seqno (Iq.lo recvs) (Iq.hi recvs))
@@ -156,6 +321,7 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
 	    (* Keep track of highest msg # we've naked.
 	     *)
 	    s.naked.(origin) <- max s.naked.(origin) hi ;
+	    s.naks_sent <- succ s.naks_sent ;
 	    dnlm (sendPeer name origin) (Nak(lo,hi)) ;
 	  )
 	)
@@ -195,15 +361,14 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
 
       (* Ack: Unbuffer any acked messages.
        *)
+      let old_lo = Iq.lo sends in
       Iq.set_lo sends lo ;
+      if s.adaptive && Iq.lo sends >| old_lo then
+	progress origin ;
 
       (* Retransmit any of the messages asked for that I have.
        *)
-      let list = Iq.list_of_iq_interval sends (lo,hi) in
-      List.iter (fun (seqno,iov,abv) ->
-	let iov = Iovecl.copy iov in
-        dn (sendPeerIov name origin iov) abv (Data seqno)
-      ) list ;
+      retransmit origin lo hi ;
 
       Iovecl.free iov
 
@@ -239,32 +404,27 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
 	  if i <>| ls.rank && not (Arrayf.get s.failed i) then (
 	    (* Send out acknowledgements.
 	     *)
-	    let recvs = Arrayf.get s.recvs i in
-	    let sends = Arrayf.get s.sends i in
-	    let head = Iq.lo recvs in
-	    if head >| s.acked.(i) then (
-	      log (fun () -> sprintf "sending ack to %d for %d, acked was %d" i head s.acked.(i)) ;
-	      dnlm (sendPeer name i) (Ack head) ;
-	      s.acked.(i) <- head
-	    ) ;
+	    send_ack i ;
 
 	    (* Retransmit any unacknowledged messages I've sent up to the previous
 	     * rounds.  This gives the other endpoints a chance to acknowledge
-	     * my messages.
+	     * my messages.  In adaptive mode, this is done by timeouts.
 	     *)
-	    let hi = s.retrans.(i) in
-	    s.retrans.(i) <- Iq.hi sends ;
-	    let lo = Iq.lo sends in
-	    let list = Iq.list_of_iq_interval sends (lo,hi) in
-	    List.iter (fun (seqno,iov,abv) ->
-	      log (fun () -> sprintf "retransmitting %d to %d" seqno i) ;
-	      let iov = Iovecl.copy  iov in
-	      dn (sendPeerIov name i iov) abv (Data seqno)
-	    ) list
+	    if not s.adaptive then (
+	      let sends = Arrayf.get s.sends i in
+	      let hi = s.retrans.(i) in
+	      s.retrans.(i) <- Iq.hi sends ;
+	      retransmit i (Iq.lo sends) hi
+	    )
 	  )
 	done
       ) ;
 
+      if s.adaptive && Time.to_float time >= s.alarm then (
+	s.alarm <- infinity ;
+	timeouts ()
+      ) ;
+
       upnm ev
 
   | EExit ->
@@ -279,6 +439,8 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
        *)
       logb (fun () -> sprintf "recv(bytes)=%s" (Arrayf.int_to_string (Arrayf.map iq_size s.recvs))) ;
       logb (fun () -> sprintf "send(bytes)=%s" (Arrayf.int_to_string (Arrayf.map iq_size s.sends))) ;
+      logb (fun () -> sprintf "control: acks=%d piggybacked=%d naks=%d retrans=%d"
+	s.acks_sent s.acks_piggybacked s.naks_sent s.retransmits) ;
       upnm ev
 
   | EDump -> ( dump vf s ; upnm ev )
@@ -302,22 +464,29 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
        * added for the functional optimizations.
        *)
       (*Arraye.set s.sends origin*) let _ = (Iq.add sends iov abv) in
+      if s.adaptive then sent dest seqno ;
 
       (* Non-application messages piggyback an acknowledgement.  The key
        * here is for the Pt2ptw ack messages to cause an ack to be piggy
-       * backed by this layer.
+       * backed by this layer.  Application messages do so when an ack to
+       * dest is due in adaptive mode, so that a reply carries the ack of
+       * its request, or always with pt2pt_ack_appl.  Otherwise they keep
+       * the optimized Data header.  Once everything from dest is
+       * acked here, no ack is due any more.
        *)
       let hdr = 
-	if getApplMsg ev then (
+	if getApplMsg ev && not (s.ack_appl || s.ack_due.(dest) > 0.0) then (
 	  Data seqno
 	) else (
 	  let recvs = Arrayf.get s.recvs dest in
 	  let head = Iq.lo recvs in
+	  s.ack_due.(dest) <- 0.0 ;
 	  if head <=| s.acked.(dest) then (
 	    Data seqno
 	  ) else (
 	    log (fun () -> sprintf "sending ack to %d for %d, acked was %d" dest head s.acked.(dest)) ;
 	    s.acked.(dest) <- head ;
+	    s.acks_piggybacked <- succ s.acks_piggybacked ;
 	    DataAck(seqno,head)
 	  )
 	)
@@ -335,6 +504,11 @@ let l2 args vs = Layer.hdr_noopt init hdlrs args vs
 
 let _ = 
   Param.default "pt2pt_sweep" (Param.Time (Time.of_int 1)) ;
+  Param.default "pt2pt_ack_appl" (Param.Bool false) ;
+  Param.default "pt2pt_adaptive" (Param.Bool false) ;
+  Param.default "pt2pt_ack_delay" (Param.Time (Time.of_string "0.002")) ;
+  Param.default "pt2pt_min_rto" (Param.Time (Time.of_string "0.001")) ;
+  Param.default "pt2pt_max_rto" (Param.Time (Time.of_int 2)) ;
   Layer.install name l
 
 (**************************************************************)
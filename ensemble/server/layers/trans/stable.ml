@@ -19,7 +19,23 @@ let name = Trace.filel "STABLE"
 let log_iov = Trace.log "IOV"
 (**************************************************************)
 
-type header = Gossip of (seqno Arrayf.t) * (bool Arrayf.t)
+(* Gossip(row,failed): my row of the acknowledgement matrix.
+
+ * In tree mode, the live members form a tree by rank, with
+ * stable_tree_fanout children per member:
+
+ * Digest(failed,mins,maxs): the minimum and maximum acks of
+ * each member's messages, over the subtree of the sender, sent
+ * to its parent.  The tree depends on the failed members, so
+ * digests built under other failures are dropped.
+
+ * Result(failed,mins,maxs): the same over the whole group,
+ * cast by the root.
+ *)
+type header = 
+  | Gossip of (seqno Arrayf.t) * (bool Arrayf.t)
+  | Digest of (bool Arrayf.t) * (seqno Arrayf.t) * (seqno Arrayf.t)
+  | Result of (bool Arrayf.t) * (seqno Arrayf.t) * (seqno Arrayf.t)
 
 type state = {
   sweep		   : Time.t ;
@@ -28,6 +44,11 @@ type state = {
    *)
   spacing          : Time.t ;  
   acks             : seqno array array ;
+  tree             : bool ;               (* Started in tree mode *)
+  mutable fanout   : int ;                (* Tree mode if positive *)
+  digests          : (seqno Arrayf.t * seqno Arrayf.t) option array ; (* From my children *)
+  patience         : int ;                (* Sweeps to wait for missing digests *)
+  mutable waited   : int ;
   local_fuzzy_th   : int ;
   global_fuzzy_th  : int ;
   local_fuzzy      : bool array ;
@@ -80,7 +101,19 @@ let init _ (ls,vs) = {
   global_fuzzy_th = Param.int vs.params "stable_global_fuzzy_th" ;
   local_fuzzy   = Array.copy (Arrayf.to_array ls.falses);
   global_fuzzy  = Array.copy (Arrayf.to_array ls.falses);
-  acks          = Array.create_matrix ls.nmembers ls.nmembers 0 ; (* matrix (from,to) *)
+  tree          = Param.int vs.params "stable_tree_fanout" > 0 ;
+  fanout        = Param.int vs.params "stable_tree_fanout" ;
+  patience      = Param.int vs.params "stable_tree_patience" ;
+  waited        = 0 ;
+  (* In tree mode, only my own row is used.
+   *)
+  acks          = 
+    if Param.int vs.params "stable_tree_fanout" > 0 then
+      Array.init ls.nmembers (fun i -> 
+	Array.create (if i = ls.rank then ls.nmembers else 0) 0)
+    else
+      Array.create_matrix ls.nmembers ls.nmembers 0 ; (* matrix (from,to) *)
+  digests       = Array.create ls.nmembers None ;
   next_gossip = Time.invalid;
   dbg_mins	= ls.zeroes ;
   dbg_maxs  	= ls.zeroes
@@ -92,6 +125,39 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
   let log = Trace.log2 name ls.name in
   let failwith = layer_fail dump vf s name in
 
+  (*
+   * STABLE: Send down a EStable event, given the minimum and
+   * maximum acks of each member's messages.  Fuzzy members count
+   * only towards the stability of fuzzy members.  In tree mode,
+   * digests may be older than the last stability delivered, so
+   * stability is never allowed to go back, also after falling
+   * back to the matrix.
+   *)
+  let stable mins maxs own_acked =
+    let mins = 
+      if s.tree then Arrayf.map2 int_max mins s.dbg_mins else mins
+    in
+    let own = s.acks.(ls.rank) in
+    let min_local = Array.mapi (fun j seqno -> 
+      if s.local_fuzzy.(j) then int_min seqno own.(j) else own.(j)
+    ) (Arrayf.to_array mins) in
+    let min_global = Array.mapi (fun j seqno -> 
+      if s.global_fuzzy.(j) then int_min seqno own.(j) else own.(j)
+    ) (Arrayf.to_array mins) in
+    s.dbg_mins <- mins ;
+    s.dbg_maxs <- maxs ;
+
+    (* Send dn EStable event.
+     *)
+    dnnm (create name EStable[
+      Stability mins ;
+      NumCasts maxs ;
+      LocalFuzzyStability (Arrayf.of_array min_local) ;
+      GlobalFuzzyStability (Arrayf.of_array min_global) ;
+      OwnAcked own_acked
+    ]) ;
+  in
+
   (*
    * DO_STABLE: Recalculate stability.  Send down a EStable event.
    *)
@@ -99,8 +165,6 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
     log (fun () -> sprintf "doing stablity");
     let mins = Array.copy s.acks.(ls.rank) in
     let maxs = Array.create ls.nmembers 0 in
-    let min_local = Array.copy s.acks.(ls.rank) in
-    let min_global = Array.copy s.acks.(ls.rank) in
 
     (* For each member, update ack entry and find new stability.
      *)
@@ -110,27 +174,86 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
         for j = 0 to pred ls.nmembers do
 	  let seqno = row.(j) in
 	  if seqno >| maxs.(j) then maxs.(j) <- seqno ;
-	  if seqno <| mins.(j) then mins.(j) <- seqno ;
-          if s.local_fuzzy.(j) & seqno <| min_local.(j) then min_local.(j) <- seqno ;
-          if s.global_fuzzy.(j) & seqno <| min_global.(j) then min_global.(j) <- seqno 
+	  if seqno <| mins.(j) then mins.(j) <- seqno
 	done
       )
     done ;
 
-    let mins = Arrayf.of_array mins in
-    let maxs = Arrayf.of_array maxs in
-    s.dbg_mins <- mins ;
-    s.dbg_maxs <- maxs ;
+    stable (Arrayf.of_array mins) (Arrayf.of_array maxs)
+      (Arrayf.of_array (Array.map (fun row -> row.(ls.rank)) s.acks))
+  in
 
-    (* Send dn EStable event.
+  (* The tree of live members: the i-th live member, by rank, has
+   * members fanout*i+1 .. fanout*i+fanout as children.  Returns
+   * my parent, if any, and my children.
+   *)
+  let tree () =
+    let live = Arrayf.filter (fun i -> not (Arrayf.get s.failed i)) (Arrayf.of_array (Array.init ls.nmembers ident)) in
+    let n = Arrayf.length live in
+    let pos = 
+      let rec find i = if Arrayf.get live i = ls.rank then i else find (succ i) in
+      find 0
+    in
+    let parent = 
+      if pos = 0 then None else Some (Arrayf.get live ((pred pos) / s.fanout))
+    in
+    let children = ref [] in
+    for i = s.fanout * pos + s.fanout downto s.fanout * pos + 1 do
+      if i < n then children := Arrayf.get live i :: !children
+    done ;
+    parent, !children
+  in
+
+  (* MATRIX: fall back from tree mode to the acknowledgement
+   * matrix, for the rest of the view.
+   *)
+  let matrix () =
+    if s.fanout > 0 then (
+      log (fun () -> "falling back to the ack matrix") ;
+      s.fanout <- 0 ;
+      for i = 0 to pred ls.nmembers do
+	if i <> ls.rank then
+	  s.acks.(i) <- Array.create ls.nmembers 0
+      done
+    )
+  in
+
+  (*
+   * TREE_STABLE: Combine my row with the digests of my children.
+   * Pass the result to my parent, or if I am the root, deliver
+   * it and cast it to everyone.  As acks only grow, older digests
+   * are only conservative, as long as the tree does not change:
+   * digests are dropped on failures.
+   *)
+  let tree_stable () =
+    let mins = Array.copy s.acks.(ls.rank) in
+    let maxs = Array.copy s.acks.(ls.rank) in
+    let parent,children = tree () in
+    List.iter (fun child ->
+      if_some s.digests.(child) (fun (cmins,cmaxs) ->
+        for j = 0 to pred ls.nmembers do
+	  let seqno = Arrayf.get cmins j in
+	  if seqno <| mins.(j) then mins.(j) <- seqno ;
+	  let seqno = Arrayf.get cmaxs j in
+	  if seqno >| maxs.(j) then maxs.(j) <- seqno
+	done
+      )
+    ) children ;
+
+    (* Until all my children have reported, the last stability
+     * I delivered is the best bound I have.
      *)
-    dnnm (create name EStable[
-      Stability mins ;
-      NumCasts maxs ;
-      LocalFuzzyStability (Arrayf.of_array min_local) ;
-      GlobalFuzzyStability (Arrayf.of_array min_global) ;
-      OwnAcked (Arrayf.of_array (Array.map (fun row -> row.(ls.rank)) s.acks))
-    ]) ;
+    let complete = List.for_all (fun child -> s.digests.(child) <> None) children in
+    s.waited <- if complete then 0 else succ s.waited ;
+    let mins = if complete then Arrayf.of_array mins else s.dbg_mins in
+    let maxs = Arrayf.of_array maxs in
+    match parent with
+    | Some parent ->
+	dnlm (sendUnrelPeer name parent) (Digest(s.failed,mins,maxs))
+    | None ->
+	log (fun () -> "tree root, casting stability") ;
+	stable mins maxs (Arrayf.init ls.nmembers (fun _ -> Arrayf.get mins ls.rank)) ;
+	dnlm (castUnrel name) (Result(s.failed,mins,maxs))
   in
 
   let up_hdlr ev abv () = up ev abv
@@ -144,6 +267,9 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
       if (not (Arrayf.get failed ls.rank)) (* BUG: could auto-fail him *)
       && (not (Arrayf.get s.failed origin))
       then (
+	(* The sender fell back to the matrix, so must I.
+	 *)
+	matrix () ;
 	let local = s.acks.(origin) in
 	for i = 0 to pred ls.nmembers do
 	  let remote = Arrayf.get remote i in
@@ -153,6 +279,25 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
       ) ;
       free name ev
 
+    (* Digest: from one of my children in tree mode.
+     *)
+  | (ECast _ |ESend _ |ECastUnrel _ |ESendUnrel _), Digest(failed,mins,maxs) ->
+      let origin = getPeer ev in
+      if s.fanout > 0 && not (Arrayf.get s.failed origin) && failed = s.failed then
+	s.digests.(origin) <- Some(mins,maxs) ;
+      free name ev
+
+    (* Result: the root's result in tree mode.  Members
+     * only know the stability of their own messages, which
+     * everyone has acked.
+     *)
+  | (ECast _ |ESend _ |ECastUnrel _ |ESendUnrel _), Result(failed,mins,maxs) ->
+      let origin = getPeer ev in
+      if s.fanout > 0 && origin <> ls.rank && not (Arrayf.get s.failed origin)
+      && failed = s.failed then
+	stable mins maxs (Arrayf.init ls.nmembers (fun _ -> Arrayf.get mins ls.rank)) ;
+      free name ev
+
   | _ -> failwith unknown_local
    
   and upnm_hdlr ev = match getType ev with
@@ -169,6 +314,12 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
      *)
   | EFail ->
       s.failed <- getFailures ev ;
+
+      (* The tree is reshaped, so the digests of my children
+       * may cover other subtrees than they do now.
+       *)
+      Array.fill s.digests 0 ls.nmembers None ;
+      s.waited <- 0 ;
       dnnm (create name EStableReq[]) ;
       upnm ev
 
@@ -227,9 +378,18 @@ let hdlrs s ((ls,vs) as vf) {up_out=up;upnm_out=upnm;dn_out=dn;dnlm_out=dnlm;dnn
       for i = 0 to pred ls.nmembers do
         s.acks.(ls.rank).(i) <- Arrayf.get casts i
       done ;
-      do_stable () ;
-      let my_row = Arrayf.of_array s.acks.(ls.rank) in
-      dnlm (castUnrel name) (Gossip(my_row,s.failed)) ;
+      (* A child that does not report holds back stability
+       * in tree mode, so after a while use the matrix.
+       *)
+      if s.fanout > 0 && s.patience > 0 && s.waited > s.patience then
+	matrix () ;
+      if s.fanout > 0 then (
+	tree_stable ()
+      ) else (
+	do_stable () ;
+	let my_row = Arrayf.of_array s.acks.(ls.rank) in
+	dnlm (castUnrel name) (Gossip(my_row,s.failed))
+      ) ;
       upnm ev
 
   | EDump -> dump vf s ; upnm ev
@@ -265,6 +425,8 @@ let _ =
   Param.default "stable_explicit_ack" (Param.Bool false) ;
   Param.default "stable_local_fuzzy_th" (Param.Int 100) ;
   Param.default "stable_global_fuzzy_th" (Param.Int 100) ;
+  Param.default "stable_tree_fanout" (Param.Int 0) ;
+  Param.default "stable_tree_patience" (Param.Int 10) ;
   Layer.install name l
 
 (**************************************************************)
@@ -143,56 +143,250 @@ let make_marsh debug =
   (marsh,unmarsh)
 
 (**************************************************************)
-let max_msg_len = 8192 (*Socket.max_msg_len ()*)
+(* A compact encoding for the ML part of messages.  Protocol
+ * headers are small trees of integers and constant constructors,
+ * which Marshal encodes behind a 20-byte header and with a sharing
+ * table.  Here, each value is a code byte:
+ *
+ * [0x00-0x3f]  the integer itself
+ * [0x40]       an integer, zigzag varint follows
+ * [0x41]       a string, varint length and bytes follow
+ * [0x80-0xfe]  a block of (code-0x80) fields, tag byte and fields follow
+ * [0xff]       a block, varint size, tag byte and fields follow
+ *
+ * preceded by a magic byte that Marshal never starts with.
+ * Varints hold up to 64 bits, whatever the word size of the
+ * sender; a receiver with narrower integers rejects wider values.
+ * Values holding anything else (floats, closures, custom blocks)
+ * are left to Marshal.  Sharing is not preserved, which is safe
+ * for headers since they are immutable; shared subtrees are
+ * written again, so cyclic values overflow the buffer and are
+ * also left to Marshal.
+ *)
+let compact_magic = 0xc3
+
+let compact = ref false
+let compact_msgs = ref 0
+let compact_bytes = ref 0
+let marsh_msgs = ref 0
+let marsh_bytes = ref 0
+
+let use_compact b = compact := b
+
+let _ =
+  Trace.install_root (fun () -> [
+    sprintf "BUF:headers:compact=%b compact=(%d msgs,%d bytes) marshal=(%d msgs,%d bytes)"
+      !compact !compact_msgs !compact_bytes !marsh_msgs !marsh_bytes
+  ])
+
+(* The position in the buffer being written or read, and its
+ * limit.
+ *)
+type cursor = {
+  cbuf : string ;
+  mutable cpos : int ;
+  clim : int
+}
+
+let compact_fail () = failwith "Buf.compact"
+
+let put_byte c b =
+  if c.cpos >= c.clim then compact_fail () ;
+  String.unsafe_set c.cbuf c.cpos (Char.unsafe_chr b) ;
+  c.cpos <- succ c.cpos
+
+(* [n] is taken as unsigned.
+ *)
+let rec put_varint c n =
+  if n land (lnot 0x7f) = 0 then put_byte c n else (
+    put_byte c (0x80 lor (n land 0x7f)) ;
+    put_varint c (n lsr 7)
+  )
+
+let rec put_value c o =
+  if Obj.is_int o then (
+    let i = (Obj.obj o : int) in
+    if i >= 0 && i < 0x40 then put_byte c i else (
+      put_byte c 0x40 ;
+      put_varint c (if i >= 0 then i lsl 1 else ((lnot i) lsl 1) lor 1)
+    )
+  ) else (
+    let tag = Obj.tag o in
+    if tag = Obj.string_tag then (
+      let s = (Obj.obj o : string) in
+      let n = String.length s in
+      put_byte c 0x41 ;
+      put_varint c n ;
+      if n > c.clim - c.cpos then compact_fail () ;
+      String.unsafe_blit s 0 c.cbuf c.cpos n ;
+      c.cpos <- c.cpos + n
+    ) else if tag < Obj.lazy_tag then (
+      let size = Obj.size o in
+      if size = 0 then compact_fail () ;
+      if size < 0x7f then put_byte c (0x80 lor size) else (
+	put_byte c 0xff ;
+	put_varint c size
+      ) ;
+      put_byte c tag ;
+      for i = 0 to pred size do
+	put_value c (Obj.field o i)
+      done
+    ) else compact_fail ()
+  )
+
+let compact_to_buffer buf ofs len obj =
+  if ofs < 0 || len < 0 || ofs + len > String.length buf then
+    invalid_arg "Buf.compact_to_buffer" ;
+  let c = { cbuf = buf ; cpos = ofs ; clim = ofs + len } in
+  put_byte c compact_magic ;
+  put_value c (Obj.repr obj) ;
+  c.cpos - ofs
+
+let get_byte c =
+  if c.cpos >= c.clim then compact_fail () ;
+  let b = Char.code (String.unsafe_get c.cbuf c.cpos) in
+  c.cpos <- succ c.cpos ;
+  b
+
+(* Bits shifted out of an integer make the input invalid here.
+ *)
+let rec get_varint c shift =
+  let b = get_byte c in
+  let v = b land 0x7f in
+  if shift >= Sys.word_size - 1 || (v lsl shift) lsr shift <> v then
+    compact_fail () ;
+  if b land 0x80 = 0 then v lsl shift
+  else (v lsl shift) lor (get_varint c (shift + 7))
+
+let rec get_value c =
+  let b = get_byte c in
+  if b < 0x40 then Obj.repr b
+  else if b = 0x40 then (
+    let n = get_varint c 0 in
+    if n land 1 = 0 then Obj.repr (n lsr 1) else Obj.repr (lnot (n lsr 1))
+  ) else if b = 0x41 then (
+    let n = get_varint c 0 in
+    if n < 0 || n > c.clim - c.cpos then compact_fail () ;
+    let s = String.sub c.cbuf c.cpos n in
+    c.cpos <- c.cpos + n ;
+    Obj.repr s
+  ) else if b >= 0x80 then (
+    let size = if b = 0xff then get_varint c 0 else b land 0x7f in
+    let tag = get_byte c in
+    (* Every field takes at least a byte.  Blocks are created
+     * with Obj.new_block, as their tags and sizes are only known
+     * here, and it initializes the fields before they are set.
+     *)
+    if tag >= Obj.lazy_tag || size <= 0 || size > c.clim - c.cpos then
+      compact_fail () ;
+    let o = Obj.new_block tag size in
+    for i = 0 to pred size do
+      Obj.set_field o i (get_value c)
+    done ;
+    o
+  ) else compact_fail ()
+
+let compact_of_string buf ofs len =
+  if ofs < 0 || len < 0 || ofs + len > String.length buf then
+    compact_fail () ;
+  let c = { cbuf = buf ; cpos = ofs ; clim = ofs + len } in
+  if get_byte c <> compact_magic then compact_fail () ;
+  Obj.obj (get_value c)
+
+(* Encode an object at [ofs], in at most [len] bytes, and return
+ * its length.  Raises Failure if it does not fit.  The compact
+ * encoding takes at least two bytes, so zero means that it was
+ * not used.
+ *)
+let marsh_to_buffer buf ofs len obj =
+  let molen =
+    if !compact then
+      try compact_to_buffer buf ofs len obj with Failure _ -> 0
+    else 0
+  in
+  if molen > 0 then (
+    incr compact_msgs ;
+    compact_bytes := !compact_bytes + molen ;
+    molen
+  ) else (
+    let molen = Marshal.to_buffer buf ofs len obj [] in
+    incr marsh_msgs ;
+    marsh_bytes := !marsh_bytes + molen ;
+    molen
+  )
+
+let is_compact byte = byte = compact_magic
+
+let prealloc_unmarsh buf ofs len =
+  if len <= 0 || ofs < 0 || ofs + len > String.length buf then
+    failwith "Buf.prealloc_unmarsh: truncated" ;
+  if is_compact (Char.code buf.[ofs]) then
+    compact_of_string buf ofs len
+  else if len < Marshal.header_size 
+       || Marshal.total_size buf ofs > len then
+    failwith "Buf.prealloc_unmarsh: truncated"
+  else
+    Marshal.from_string buf ofs
+
+(**************************************************************)
+let max_msg_len () = Socket.max_msg_size ()
 
 type prealloc = {
-  chunk_size : len ;     (* The chucks size to allocate *)
+  mutable chunk_size : len ;     (* The chucks size to allocate *)
   mutable buf : t ;      (* A preallocated (long) buffer *)
   mutable ofs : len ;    (* The offset in [str] *)
 }
 
 let p = 
-  let chunk_size = 2 *|| max_msg_len in
+  let chunk_size = 2 *|| max_msg_len () in
   {
     chunk_size = chunk_size ;
     buf = create chunk_size ; 
     ofs = 0 
   } 
 
+(* Start a new buffer, sized for the current maximal message
+ * length.
+ *)
+let fresh_buf () =
+  p.chunk_size <- 2 *|| max_msg_len () ;
+  p.buf <- String.create p.chunk_size
+
 (* 
 *)
 let advance len = 
-  p.buf <- String.create p.chunk_size ;
+  fresh_buf () ;
   p.ofs <- 0
     
-let prealloc len f = 
+(* As prealloc, but return the substring as a tuple rather than
+ * passing it to a closure.
+ *)
+let prealloc_ret len = 
   if p.ofs + len > String.length p.buf then (
-    p.buf <- String.create p.chunk_size ;
-    p.ofs <- len ;
-    f p.buf 0 len;
-  ) else (
-    f p.buf p.ofs len;
-    p.ofs <- p.ofs + len;
-  )
+    fresh_buf () ;
+    p.ofs <- 0
+  ) ;
+  let ofs = p.ofs in
+  p.ofs <- p.ofs + len ;
+  (p.buf,ofs,len)
 
-
-(* Mashal an ML object into a substring and send it. 
+(* Mashal an ML object into a substring.
  *)  
-let prealloc_marsh len obj f = 
+let prealloc_marsh_ret len obj = 
   (* The case where the cached buffer is too short, and we need to
    * start from scratch.
    *)
   let fresh_start () = 
-    p.buf <- String.create p.chunk_size ;
+    fresh_buf () ;
     let molen = 
       try
-	Marshal.to_buffer p.buf len (p.chunk_size -|| len) obj []
+	marsh_to_buffer p.buf len (p.chunk_size -|| len) obj
       with Failure _ -> 
 	printf "Fatal error, ML object too large";
 	exit 0
     in
-    f p.buf 0 (len+molen);
-    p.ofs <- len + molen
+    p.ofs <- len +|| molen ;
+    (p.buf,0,len +|| molen)
   in
 
   if p.ofs + len >|| p.chunk_size then (
@@ -200,15 +394,22 @@ let prealloc_marsh len obj f =
   ) else (
       try
 	let molen = 
-	  Marshal.to_buffer p.buf (p.ofs+len) (p.chunk_size -|| p.ofs -|| len)
-	    obj []
+	  marsh_to_buffer p.buf (p.ofs+len) (p.chunk_size -|| p.ofs -|| len)
+	    obj
 	in    
-	log (fun () -> sprintf "writing into ofs=%d, max_len=%d, molen=%d"
-	  (p.ofs+len) (p.chunk_size - p.ofs - len) molen);
-	f p.buf p.ofs (len +|| molen);
+	let ofs = p.ofs in
 	p.ofs <- p.ofs +|| len +|| molen;
+	(p.buf,ofs,len +|| molen)
       with Failure _ -> 
 	fresh_start ()
   )
-  
-  
+
+let prealloc len f = 
+  let buf,ofs,len = prealloc_ret len in
+  f buf ofs len
+
+(* Mashal an ML object into a substring and send it. 
+ *)  
+let prealloc_marsh len obj f = 
+  let buf,ofs,len = prealloc_marsh_ret len obj in
+  f buf ofs len
@@ -77,9 +77,10 @@ val make_marsh : debug ->
   (('a -> t) * (t -> ofs -> 'a))
 
 (**************************************************************)
-(* The maximum length of messages on the network. 
+(* The maximum length of messages on the network, see
+ * Socket.max_msg_size.
  *)
-val max_msg_len : len
+val max_msg_len : unit -> len
 (**************************************************************)
 (* We use a preallocated buffer pool, into which objects are
  * marshaled. 
@@ -100,5 +101,34 @@ val prealloc : len -> (t -> ofs -> len -> unit) -> unit
 (* Mashal an ML object into a substring and send it. 
 *)  
 val prealloc_marsh : len -> 'a -> (t -> ofs -> len -> unit) -> unit
+
+(* As above, but return the substring rather than passing it
+ * to a function.
+ *)
+val prealloc_ret : len -> t * ofs * len
+val prealloc_marsh_ret : len -> 'a -> t * ofs * len
+
+(* Whether ML objects are written in a compact binary encoding,
+ * rather than with Marshal, where they allow it.  Receivers
+ * accept both, with prealloc_unmarsh, which decodes an object of
+ * [len] bytes at an offset.  It raises Failure if the object is
+ * truncated or malformed.
+ *)
+val use_compact : bool -> unit
+val prealloc_unmarsh : t -> ofs -> len -> 'a
+
+(* The compact encoding alone.  [compact_to_buffer buf ofs len obj]
+ * returns the length written, and raises Failure if [obj] does
+ * not fit in [len] bytes or holds values that the encoding does
+ * not support.  [compact_of_string] raises Failure on input that
+ * is truncated or malformed.
+ *)
+val compact_to_buffer : t -> ofs -> len -> 'a -> len
+val compact_of_string : t -> ofs -> len -> 'a
+
+(* Whether the first byte of an ML object marks the compact
+ * encoding.
+ *)
+val is_compact : int -> bool
   
 (**************************************************************)
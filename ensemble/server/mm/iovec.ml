@@ -17,7 +17,27 @@ open Printf
 
 type t = Socket.Iov.t
 type pool = Socket.Iov.pool
+type quota = Socket.Iov.quota
+type pool_stats = Socket.Iov.pool_stats = {
+  ps_name : string;
+  ps_size : int;
+  ps_chunks : int;
+  ps_free_chunks : int;
+  ps_allocated : int;
+  ps_pending : int;
+  ps_waiting : int;
+  ps_grows : int;
+  ps_fallbacks : int;
+  ps_occupancy : int array;
+  ps_oldest_pinned : float
+}
     
+let use_slabs = Socket.Iov.use_slabs
+
+let use_region = Socket.Iov.use_region
+
+let use_compaction = Socket.Iov.use_compaction
+
 let init = Socket.Iov.init
 
 let shutdown = Socket.Iov.shutdown
@@ -36,6 +56,15 @@ let buf_of t =
 let buf_of_full buf ofs t = 
   Socket.Iov.string_of_t_full (Buf.string_of buf) (int_of_len ofs) t
     
+let int16_of_sub t ofs = 
+  Socket.Iov.int16_of_sub t (int_of_len ofs)
+
+let int32_of_sub t ofs = 
+  Socket.Iov.int32_of_sub t (int_of_len ofs)
+
+let subeq t ofs buf = 
+  Socket.Iov.subeq t (int_of_len ofs) (Buf.string_of buf)
+
 let of_buf pool buf ofs len = 
   Socket.Iov.t_of_string pool (Buf.string_of buf) (int_of_len ofs) (int_of_len len)
     
@@ -48,6 +77,22 @@ let alloc_async pool ilen cont_fun =
 
 let alloc pool ilen = 
   Socket.Iov.alloc pool (int_of_len ilen)
+
+let set_recv_stall = Socket.Iov.set_recv_stall
+
+let recv_wait = Socket.Iov.recv_wait
+
+let no_quota = Socket.Iov.no_quota
+
+let create_quota = Socket.Iov.create_quota
+
+let release_quota = Socket.Iov.release_quota
+
+let alloc_quota q pool ilen = 
+  Socket.Iov.alloc_quota q pool (int_of_len ilen)
+
+let alloc_async_quota q pool ilen cont_fun = 
+  Socket.Iov.alloc_async_quota q pool (int_of_len ilen) cont_fun
       
 let sub t ofs len' =
   assert (ofs +|| len' <=|| len t);
@@ -70,6 +115,10 @@ let copy = Socket.Iov.copy
  * [ilen] is the length of the iovl.
  *)
 let flatten = Socket.Iov.flatten
+
+let compact = Socket.Iov.compact
+
+let compact_epoch = Socket.Iov.compact_epoch
   
 let debug () = (-1,-1)
   
@@ -77,6 +126,21 @@ let marshal pool a flags = Socket.Iov.marshal pool a flags
   
 let unmarshal t = Socket.Iov.unmarshal t
 
+(* Both encodings take at least two bytes.  The compact one is
+ * decoded from a copy.
+ *)
+let unmarsh_sub t ofs len = 
+  if Buf.is_compact (int16_of_sub t ofs lsr 8) then (
+    let t = sub t ofs len in
+    let buf = buf_of t in
+    free t ;
+    Buf.prealloc_unmarsh buf len0 len
+  ) else (
+    Socket.Iov.unmarshal_sub t (int_of_len ofs) (int_of_len len)
+  )
+
 let get_stats = Socket.Iov.get_stats
+let pool_stats = Socket.Iov.pool_stats
+let string_of_pool_stats = Socket.Iov.string_of_pool_stats
 (**************************************************************)
   
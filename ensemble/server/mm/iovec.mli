@@ -13,7 +13,39 @@ open Buf
  *)
 type t = Socket.Iov.t
 type pool = Socket.Iov.pool
+type quota = Socket.Iov.quota
+
+(* A snapshot of a pool, see Socket.Iov.
+ *)
+type pool_stats = Socket.Iov.pool_stats = {
+  ps_name : string;
+  ps_size : int;
+  ps_chunks : int;
+  ps_free_chunks : int;
+  ps_allocated : int;
+  ps_pending : int;
+  ps_waiting : int;
+  ps_grows : int;
+  ps_fallbacks : int;
+  ps_occupancy : int array;
+  ps_oldest_pinned : float
+}
     
+(* Allocate iovecs from slabs of fixed-size objects, so that a
+ * retained iovec does not pin a whole chunk.  Must be called
+ * before init.
+ *)
+val use_slabs : bool -> unit
+
+(* Map the chunks of each pool in one region, with huge pages
+ * and/or locked in memory.  [use_region hugepages mlock].
+ *)
+val use_region : bool -> bool -> unit
+
+(* Enable compaction of retained iovecs, see [compact].
+ *)
+val use_compaction : bool -> unit
+
 (* initialize the memory-manager. 
  * [init verbose chunk_size max_mem_size send_pool_pcnt min_alloc_size incr_step]
  *)
@@ -34,6 +66,13 @@ val buf_of : t -> Buf.t
 val buf_of_full : Buf.t -> len -> t -> unit
 val of_buf : pool -> Buf.t -> ofs -> len -> t
 
+(* Read at an offset without copying, as Buf.int16_of_substring,
+ * Buf.read_int32 and Buf.subeq16.
+ *)
+val int16_of_sub : t -> ofs -> int
+val int32_of_sub : t -> ofs -> int
+val subeq : t -> ofs -> Buf.t -> bool
+
 val empty : t
 
 (* Length of an iovec
@@ -46,6 +85,24 @@ val alloc_async : pool -> len -> (t -> unit) -> unit
  * user has no more free memory to hand out.
  *)
 val alloc : pool -> len -> t
+
+(* Backpressure on receives, see Socket.Iov.  With a stall
+ * function set, a receive that finds the recv pool exhausted
+ * calls it, and reads nothing if it returns true.  [recv_wait
+ * pool f] calls [f] once [pool] can take packets again.
+ *)
+val set_recv_stall : (unit -> bool) option -> unit
+val recv_wait : pool -> (unit -> unit) -> unit
+
+(* Per-owner quotas, see Socket.Iov.  [create_quota name limit],
+ * with [limit] in bytes, 0 for no limit.  Usage is reported by
+ * get_stats.
+ *)
+val no_quota : quota
+val create_quota : string -> int -> quota
+val release_quota : quota -> unit
+val alloc_quota : quota -> pool -> len -> t
+val alloc_async_quota : quota -> pool -> len -> (t -> unit) -> unit
   
 val sub : t -> ofs -> len -> t
   
@@ -66,6 +123,15 @@ val copy : t -> t
  *)
 val flatten : t array -> t
 
+(* If [t] keeps a chunk that is otherwise mostly unused, copy it
+ * into a chunk for long-lived data, and free it.  Otherwise
+ * returns [t].  [compact_epoch] changes whenever a pool runs
+ * low on chunks, which is when holders of long-lived iovecs
+ * should compact them.
+ *)
+val compact : t -> t
+val compact_epoch : unit -> int
+
 (**************************************************************)  
 (* For debugging. Return the number of references to the iovec.
 *)
@@ -83,8 +149,17 @@ val debug : unit -> int * int
 val marshal : pool -> 'a -> Marshal.extern_flags list -> t
 val unmarshal : t-> 'a
 
+(* As Buf.prealloc_unmarsh, from [len] bytes at an offset.
+ *)
+val unmarsh_sub : t -> ofs -> len -> 'a
+
 (**************************************************************)
 val get_stats : unit -> string
+
+(* The send and recv pools, as of now.
+ *)
+val pool_stats : unit -> pool_stats list
+val string_of_pool_stats : pool_stats -> string
 (**************************************************************)
   
   
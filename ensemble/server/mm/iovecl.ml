@@ -48,7 +48,71 @@ let len il =
 
 (**************************************************************)
 
-let flatten il =  Iovec.flatten (Arrayf.to_array_break il)
+let count_nonempty il =
+  let nonempty = Pervasives.ref 0 in
+  for i = 0 to pred (Arrayf.length il) do
+    if Iovec.len (Arrayf.get il i) <>|| len0 then
+      incr nonempty
+  done ;
+  !nonempty
+
+(* The number of flattens that copied, and the bytes copied, by
+ * caller.
+ *)
+let flatten_stats = Hashtbl.create 7
+
+let string_of_flatten_stats () =
+  let l = hashtbl_to_list flatten_stats in
+  string_of_list (fun (debug,(n,bytes)) -> 
+    sprintf "%s:%d/%d" debug n bytes
+  ) l
+
+let _ = 
+  Trace.install_root (fun () -> [
+    sprintf "IOVECL:flatten:%s" (string_of_flatten_stats ())
+  ])
+
+let flatten debug il =  
+  let n = Arrayf.length il in
+  if n >|| 1 && count_nonempty il <=|| 1 then (
+    (* At most one part holds data, take it as is.
+     *)
+    let rec loop i = 
+      if i =|| pred n || Iovec.len (Arrayf.get il i) <>|| len0 then
+	Iovec.copy (Arrayf.get il i)
+      else loop (succ i)
+    in loop 0
+  ) else (
+    if n >|| 1 then (
+      let (calls,bytes) = 
+	try Hashtbl.find flatten_stats debug with Not_found -> (0,0)
+      in
+      Hashtbl.replace flatten_stats debug 
+	(succ calls, bytes + int_of_len (len il))
+    ) ;
+    Iovec.flatten (Arrayf.to_array_break il)
+  )
+
+let buf_of il = 
+  let buf = Buf.create (len il) in
+  let ofs = Pervasives.ref len0 in
+  for i = 0 to pred (Arrayf.length il) do
+    let iov = Arrayf.get il i in
+    Iovec.buf_of_full buf !ofs iov ;
+    ofs := !ofs +|| Iovec.len iov
+  done ;
+  buf
+
+let compact il = 
+  let changed = Pervasives.ref false in
+  let il' = 
+    Arrayf.map (fun iov ->
+      let iov' = Iovec.compact iov in
+      if iov' != iov then changed := true ;
+      iov'
+    ) il
+  in
+  if !changed then il' else il
 
 let concata iovll = Arrayf.flatten iovll
 
@@ -223,7 +287,7 @@ let make_marsh pool free_iovl =
     of_iovec iov
 
   and unmarsh iovl = 
-    let iov = Iovec.flatten (to_iovec_array iovl) in
+    let iov = flatten "IOVECL:unmarsh" iovl in
     let obj = Iovec.unmarshal iov in
     Iovec.free iov ;
     if free_iovl then free iovl;
@@ -233,14 +297,6 @@ let make_marsh pool free_iovl =
   
 (**************************************************************)
   
-let count_nonempty il =
-  let nonempty = Pervasives.ref 0 in
-  for i = 0 to pred (Arrayf.length il) do
-    if Iovec.len (Arrayf.get il i) <>|| len0 then
-      incr nonempty
-  done ;
-  !nonempty
-
 (**************************************************************)
 (**************************************************************)
 (**************************************************************)
@@ -31,10 +31,22 @@ val len : t -> len
 
 (* Flatten an iovec array into a single iovec.  Copying only
  * occurs if the array has more than 1 non-empty iovec.
- * The reference count is incremented if this is a singleton
- * array.
+ * Otherwise, the reference count of the non-empty iovec is
+ * incremented.  Use only where contiguous memory is really
+ * needed; the bytes copied are counted by the [debug] name of
+ * the caller, and reported as IOVECL:flatten.
  *)
-val flatten : t -> Iovec.t
+val flatten : debug -> t -> Iovec.t
+
+(* Copy the contents of an iovec array into a new buffer,
+ * without flattening it first.
+ *)
+val buf_of : t -> Buf.t
+
+(* Compact each of the iovecs, see Iovec.compact.  Returns the
+ * same iovecl if none was copied.
+ *)
+val compact : t -> t
 
 (* Catenate an array of iovec arrays. Used in conjunction with 
  * flatten.
@@ -47,7 +47,8 @@ type 'a t = {
   mutable alen   : int ;
   mutable mask   : int ;
   zero           : 'a ;
-  name           : debug
+  name           : debug ;
+  mutable epoch  : int			(* See Iovec.compact_epoch *)
 }
 
 (**************************************************************)
@@ -173,7 +174,8 @@ let create debug zeroa =
     hi   = 0 ;
     read = 0 ;
     zero = zeroa ;
-    name = debug
+    name = debug ;
+    epoch = Iovec.compact_epoch ()
   } in
 (*
   grow iq 8 ;
@@ -236,12 +238,33 @@ let do_set item iov msg =
   item.iov <- Iovecl.copy iov ;
   true
 
+(**************************************************************)
+(* Messages may stay in the queue for long, until they become
+ * stable.  When the iovec pools run low on chunks, copy those
+ * that keep otherwise unused chunks, so that the chunks can be
+ * freed.  This happens at most once per change of the epoch.
+ *)
+
+let compact iq =
+  iq.epoch <- Iovec.compact_epoch () ;
+  for i = iq.lo to pred (int_min iq.hi (maxi iq)) do
+    let item = get_unsafe iq i in
+    match item.ctl with
+    | Data -> item.iov <- Iovecl.compact item.iov
+    | Unset -> ()
+  done
+
+let check_compact iq =
+  if Iovec.compact_epoch () <>| iq.epoch then
+    compact iq
+
 (**************************************************************)
 
 let set iq i iov msg =
   if i <| iq.lo then (
     false
   ) else (
+    check_compact iq ;
     set_hi iq (succ i) ;
     if i >=| maxi iq then
       overflow iq i ;
@@ -275,6 +298,7 @@ let opt_insert_check iq i =
 
 let opt_insert_doread iq i iov msg =
   assert (i >=| iq.lo) ;
+  check_compact iq ;
   let next = succ i in
   iq.read <- next ;
   iq.hi   <- next ;
@@ -445,4 +469,23 @@ let read_hole iq =
   assert(iq.read >= iq.lo) ;
   hole_help iq iq.read
 
+let rec next_unset iq i =
+  if i >=| iq.hi then 
+    i
+  else (
+    match get_ctl iq i with
+    | Data -> next_unset iq (succ i)
+    | _ -> i
+  )
+
+let read_holes iq n =
+  assert(iq.read >= iq.lo) ;
+  let rec loop i n =
+    if n <= 0 then [] else (
+      match hole_help iq i with
+      | None -> []
+      | Some(lo,hi) -> (lo,hi) :: loop (next_unset iq hi) (pred n)
+    )
+  in loop iq.read n
+
 (**************************************************************)
@@ -59,6 +59,10 @@ val hole		: 'a t -> (seqno * seqno) option
 
 val read		: 'a t -> seqno
 val read_hole		: 'a t -> (seqno * seqno) option
+
+(* As read_hole, but return up to [n] holes, in order.
+ *)
+val read_holes		: 'a t -> int -> (seqno * seqno) list
 val read_prefix		: 'a t -> (seqno -> Iovecl.t -> 'a -> unit) -> unit
 
 (* The opt_update functions are used where the normal
@@ -74,6 +78,12 @@ val opt_update_update	: 'a t -> seqno -> 'a t
 
 val free                : 'a t -> unit
 
+(* Compact the iovecs held in the queue, see Iovec.compact.
+ * This is done by itself when a message is added after the
+ * iovec pools have run low on chunks.
+ *)
+val compact             : 'a t -> unit
+
 (* Clear entries that haven't been read yet.
  *)
 val clear_unread        : 'a t -> unit
@@ -317,8 +317,8 @@ let marsh_upcall id msg send_f =
 	write_string m c_ls.c_name;
 	write_view_id m c_ls.c_view_id;
 	
-	let buf = Marsh.marsh_done m in
-	send_f buf len0 (Buf.length buf) Iovecl.empty
+	let buf,len = Marsh.marsh_done m in
+	send_f buf len0 len Iovecl.empty
 	  
     | UReceive(origin,cs,iovl) -> (
 	let buf = prealloc_send_buf in
@@ -627,6 +627,47 @@ module Server = struct
     (recv,disable,())
 end
   
+(**************************************************************)
+(* Memory telemetry.  The state of the iovec pools is appended
+ * to [file] every [period] seconds, and whenever the daemon gets
+ * SIGUSR1.  Without a file, SIGUSR1 prints it to stderr.
+ *)
+let mem_stats alarm file period =
+  let dump () =
+    let time = Time.to_string (Alarm.gettime alarm) in
+    let lines = List.map (fun p ->
+      sprintf "time=%s %s\n" time (Iovec.string_of_pool_stats p)
+    ) (Iovec.pool_stats ()) in
+    match file with
+    | None -> 
+	List.iter (fun l -> eprintf "ENSEMBLED:mem:%s" l) lines
+    | Some file -> (
+	try
+	  let co = open_out_gen [Open_append;Open_text;Open_creat] 0o644 file in
+	  List.iter (output_string co) lines ;
+	  close_out co
+	with Sys_error e ->
+	  eprintf "ENSEMBLED:mem_stats:%s\n" e
+      )
+  in
+
+  (* There is no SIGUSR1 on Windows.
+   *)
+  begin try 
+    Sys.set_signal Sys.sigusr1 (Sys.Signal_handle (fun _ -> dump ()))
+  with Invalid_argument _ -> ()
+  end ;
+
+  if file <> None && period > 0 then (
+    let sched_r = ref None in
+    let loop time =
+      dump () ;
+      Alarm.schedule (some_of name !sched_r) (Time.add time (Time.of_int period))
+    in
+    sched_r := Some (Alarm.alarm alarm loop) ;
+    loop (Alarm.gettime alarm)
+  )
+
 (**************************************************************)
   
 let run () =
@@ -636,9 +677,13 @@ let run () =
   Arge.set Arge.pollcount 0 ;
   let set_ident name v = v in
   let tcp_port = ref 5002 in
+  let mem_stats_file = ref None in
+  let mem_stats_period = ref 10 in
 
   Arge.parse [
-    "-tcp_port", Arg.Int(fun i -> tcp_port:=i), "set daemon TCP channel"
+    "-tcp_port", Arg.Int(fun i -> tcp_port:=i), "set daemon TCP channel" ;
+    "-mem_stats_file", Arg.String(fun s -> mem_stats_file := Some s), "append iovec pool statistics to this file" ;
+    "-mem_stats_period", Arg.Int(fun i -> mem_stats_period := i), "seconds between pool statistics, with -mem_stats_file"
   ] (Arge.badarg name) "Ensemble daemon";
 
   let alarm = Appl.alarm name in
@@ -649,6 +694,8 @@ let run () =
    *)
   let _ = Domain.of_mode alarm Addr.Udp in
 
+  Hsyssupp.set_client_quota (Arge.get Arge.mem_quota) ;
+  mem_stats alarm !mem_stats_file !mem_stats_period ;
   let chan = Hsyssupp.server name alarm !tcp_port in
   chan (Server.f alarm) ;
 
@@ -201,9 +201,7 @@ module WITH_IOV = struct
     let len = Iovecl.len iovl in
     assert (len >= md5len) ;
     let d_iovl = Iovecl.sub iovl len0 md5len in
-    let d_iov = Iovecl.flatten d_iovl in
-    let d = Iovec.buf_of d_iov in
-    Iovec.free d_iov ;
+    let d = Iovecl.buf_of d_iovl in
     Iovecl.free d_iovl ;
     let iovl = Iovecl.sub iovl md5len (len -|| md5len) in
     let d' = Buf.of_string (digest iovl) in
@@ -0,0 +1,284 @@
+(**************************************************************)
+(* SELFTEST.ML: checks of library code that can be exercised *)
+(* without a running group. *)
+(**************************************************************)
+(* This is compiled against the library sources rather than the
+ * Ensemble module, so that it can reach modules, such as Iq and
+ * the layers, that are not exported.  It exits with a non-zero
+ * status if any check fails.
+ *)
+open Trans
+open Util
+open Buf
+open Printf
+(**************************************************************)
+let name = Trace.file "SELFTEST"
+(**************************************************************)
+
+let failures = ref 0
+
+let check what ok =
+  if not ok then (
+    eprintf "SELFTEST:failed:%s\n" what ;
+    incr failures
+  )
+
+let string_of_holes l =
+  string_of_list (fun (lo,hi) -> sprintf "%d..%d" lo hi) l
+
+(**************************************************************)
+(* Iq.read_holes: the holes after the read pointer, in order,
+ * each as [lo,hi) up to the next message present.
+ *)
+
+let iq () =
+  let iq = Iq.create name () in
+  List.iter (fun seqno ->
+    ignore (Iq.assign iq seqno Iovecl.empty ())
+  ) [0;1;3;4;7] ;
+  Iq.set_hi iq 10 ;
+  Iq.read_prefix iq (fun _ _ _ -> ()) ;
+  check "Iq.read" (Iq.read iq = 2) ;
+
+  let holes n expect =
+    let got = Iq.read_holes iq n in
+    check (sprintf "Iq.read_holes %d=%s" n (string_of_holes got)) (got = expect)
+  in
+  holes 0 [] ;
+  holes 1 [2,3] ;
+  holes 2 [2,3;5,7] ;
+  holes 8 [2,3;5,7;8,10] ;
+
+  (* Filling the first hole moves the read pointer past it.
+   *)
+  ignore (Iq.assign iq 2 Iovecl.empty ()) ;
+  Iq.read_prefix iq (fun _ _ _ -> ()) ;
+  check "Iq.read after fill" (Iq.read iq = 5) ;
+  holes 8 [5,7;8,10] ;
+
+  (* No holes once everything up to hi is present.
+   *)
+  List.iter (fun seqno ->
+    ignore (Iq.assign iq seqno Iovecl.empty ())
+  ) [5;6;8;9] ;
+  Iq.read_prefix iq (fun _ _ _ -> ()) ;
+  holes 8 [] ;
+  Iq.free iq
+
+(**************************************************************)
+(* Mnak retransmission batches: limits on the number of
+ * messages and their bytes, and the allowance for the header.
+ *)
+
+let mnak_batch () =
+  let limit = len_of_int 1000 in
+  check "batch_fits:empty" (Mnak.batch_fits limit 0 len0 (len_of_int 100)) ;
+  check "batch_fits:len"
+    (not (Mnak.batch_fits limit 1 (len_of_int 900) (len_of_int 100))) ;
+  check "batch_fits:disabled" (not (Mnak.batch_fits len0 0 len0 len0)) ;
+  check "batch_fits:max"
+    (not (Mnak.batch_fits (len_of_int 100000) Mnak.batch_max len0 len0)) ;
+
+  (* Zero-length messages are still limited, by count and by
+   * their header allowance.
+   *)
+  let rec fill n total =
+    if Mnak.batch_fits limit n total len0 then
+      fill (succ n) (total +|| Mnak.batch_hdr)
+    else n
+  in
+  let n = fill 0 len0 in
+  check (sprintf "batch of empty messages=%d" n) (n > 0 && n <= Mnak.batch_max) ;
+
+  (* The lengths of a full batch fit in its header allowance.
+   *)
+  let lens = Array.to_list (Array.create Mnak.batch_max (len_of_int 65000)) in
+  let hdr = Marshal.to_string (Mnak.Retransl(1000,1000000,lens)) [] in
+  let allowance = Mnak.batch_max * int_of_len Mnak.batch_hdr + 64 in
+  check (sprintf "Retransl header=%d allowance=%d" (String.length hdr) allowance)
+    (String.length hdr <= allowance)
+
+(**************************************************************)
+(* Rto: Jacobson's estimator, its bounds, and backoff.  Karn's
+ * rule is kept by the callers, which take no sample from a
+ * repaired retransmission; what Rto owes them is that a backoff
+ * leaves the estimate alone and the next sample replaces it.
+ *)
+
+let rto () =
+  let close what expect got =
+    check (sprintf "%s=%.6f expected %.6f" what got expect)
+      (abs_float (got -. expect) < 1e-9)
+  in
+  let min = Time.of_float 0.01 and max = Time.of_float 1.0 in
+
+  let t = Rto.create (Time.of_float 0.5) min max in
+  check "Rto.sampled:initial" (not (Rto.sampled t)) ;
+  close "Rto.rto:initial" 0.5 (Rto.rto t) ;
+
+  (* The first sample sets srtt=r and rttvar=r/2, and the next
+   * ones average in with gains of 1/8 and 1/4.
+   *)
+  Rto.sample t 0.1 ;
+  check "Rto.sampled" (Rto.sampled t) ;
+  close "Rto.srtt:first" 0.1 (Rto.srtt t) ;
+  close "Rto.rto:first" 0.3 (Rto.rto t) ;
+  Rto.sample t 0.2 ;
+  close "Rto.srtt:second" 0.1125 (Rto.srtt t) ;
+  close "Rto.rto:second" 0.3625 (Rto.rto t) ;
+
+  (* Backoff doubles up to the bound without touching srtt, and
+   * the next sample drops it again.
+   *)
+  Rto.backoff t ;
+  close "Rto.rto:backoff" 0.725 (Rto.rto t) ;
+  for i = 1 to 10 do Rto.backoff t done ;
+  close "Rto.rto:max" 1.0 (Rto.rto t) ;
+  close "Rto.srtt:backoff" 0.1125 (Rto.srtt t) ;
+  Rto.sample t 0.1125 ;
+  check "Rto.rto:after backoff" (Rto.rto t < 0.3625) ;
+
+  (* A round trip that took no measurable time is still the
+   * first sample, and the timeout stays above the minimum.
+   *)
+  let t = Rto.create (Time.of_float 0.5) min max in
+  Rto.sample t 0.0 ;
+  check "Rto.sampled:zero" (Rto.sampled t) ;
+  close "Rto.rto:min" 0.01 (Rto.rto t) ;
+  Rto.sample t 0.2 ;
+  close "Rto.srtt:after zero" 0.025 (Rto.srtt t) ;
+  close "Rto.rto:after zero" 0.225 (Rto.rto t)
+
+(**************************************************************)
+(* Buf's compact encoding: round trips, rejection of bad input,
+ * and its speed and size against Marshal on a typical header.
+ *)
+
+type hdr =
+  | NoHdr
+  | Data of int * int
+  | Nak of int * int * int list
+  | Named of string * hdr
+
+let compact () =
+  let buf = Buf.create (len_of_int 4096) in
+  let ofs = len_of_int 7 and len = len_of_int 4000 in
+  let round what v =
+    let molen = Buf.compact_to_buffer buf ofs len v in
+    let v' = Buf.prealloc_unmarsh buf ofs molen in
+    check (sprintf "compact:%s" what) (v' = v) ;
+    molen
+  in
+  ignore (round "int" [0;1;63;64;-1;-64;max_int;min_int;0x7fffffff;-0x80000000]) ;
+  ignore (round "string" ("", String.make 300 'x')) ;
+  ignore (round "constructors" [NoHdr;Data(1,2);Nak(3,-4,[5;6]);Named("a",NoHdr)]) ;
+  ignore (round "large block" (Array.init 200 (fun i -> i * 1000))) ;
+  ignore (round "nested" (Some (Some (Some [|[];[1]|])), ("x", (1,2,3)))) ;
+
+  (* Every proper prefix is truncated, and must be rejected
+   * rather than read past.
+   *)
+  let molen = round "prefix" (Nak(1000,2000,[1;2;3]), "abc") in
+  for i = 0 to pred (int_of_len molen) do
+    let ok = 
+      try ignore (Buf.compact_of_string buf ofs (len_of_int i)) ; false
+      with Failure _ -> true
+    in
+    check (sprintf "compact:truncated at %d" i) ok
+  done ;
+
+  (* Bad codes, huge sizes, and varints that overflow.
+   *)
+  List.iter (fun bytes ->
+    let s = String.concat "" (List.map (fun b -> String.make 1 (Char.chr b)) bytes) in
+    let b = Buf.of_string s in
+    let ok =
+      try ignore (Buf.prealloc_unmarsh b len0 (Buf.length b)) ; false
+      with Failure _ -> true
+    in
+    check (sprintf "compact:malformed %s" (string_of_int_list bytes)) ok
+  ) [
+    [0xc3;0x50] ;
+    [0xc3;0xff;0xff;0xff;0xff;0x0f;0] ;
+    [0xc3;0x41;0x80;0x80;0x04] ;
+    [0xc3;0x40;0xff;0xff;0xff;0xff;0xff;0xff;0xff;0xff;0xff;0x7f] ;
+    [0xc3;0x81;0xfa;0]
+  ] ;
+
+  (* Floats are left to Marshal.
+   *)
+  check "compact:float" (
+    try ignore (Buf.compact_to_buffer buf ofs len 1.5) ; false
+    with Failure _ -> true
+  ) ;
+
+  let v = [Data(17,123456);Nak(2,300,[301;302]);NoHdr] in
+  let n = 100000 in
+  let time f =
+    let t0 = Sys.time () in
+    for i = 1 to n do f () done ;
+    (Sys.time () -. t0) /. float n *. 1e9
+  in
+  let clen = Buf.compact_to_buffer buf ofs len v in
+  let ctime = time (fun () ->
+    let molen = Buf.compact_to_buffer buf ofs len v in
+    ignore (Buf.compact_of_string buf ofs molen : hdr list)
+  ) in
+  let s = Buf.string_of buf in
+  let mlen = Marshal.to_buffer s 0 4000 v [] in
+  let mtime = time (fun () ->
+    ignore (Marshal.to_buffer s 0 4000 v []) ;
+    ignore (Marshal.from_string s 0 : hdr list)
+  ) in
+  printf "SELFTEST:compact:%d bytes %.0f ns, marshal:%d bytes %.0f ns\n"
+    (int_of_len clen) ctime mlen mtime
+
+(**************************************************************)
+(* Event allocation: the per-message constructors build the
+ * record directly, and allocate less of the minor heap than an
+ * event built from a field list.  The counters see both.
+ *)
+
+let events () =
+  let n = 100000 in
+  let sink = ref (Event.castEv name) in
+  let words f =
+    let w0 = Hsys.minor_words () in
+    for i = 1 to n do sink := f () done ;
+    float (Hsys.minor_words () - w0) /. float n
+  in
+  let fields0,core0 = Event.alloc_stats () in
+  let direct = words (fun () -> Event.castPeerIov name 1 Iovecl.empty) in
+  let listed = words (fun () -> Event.create name (Event.ECast Iovecl.empty) [Event.Peer 1]) in
+  let fields1,core1 = Event.alloc_stats () in
+  check "events:peer" (Event.getPeer !sink = 1) ;
+  check (sprintf "events:words direct=%.1f field list=%.1f" direct listed)
+    (direct < listed) ;
+  check "events:counters" (fields1 - fields0 = n && core1 - core0 = n) ;
+  printf "SELFTEST:events:%.1f words per event, %.1f from a field list\n" direct listed
+
+(**************************************************************)
+
+let tests = [
+  "iq", iq ;
+  "mnak_batch", mnak_batch ;
+  "rto", rto ;
+  "compact", compact ;
+  "events", events
+]
+
+let run () =
+  List.iter (fun (test,f) ->
+    printf "SELFTEST:%s\n" test ;
+    f ()
+  ) tests ;
+  if !failures > 0 then (
+    eprintf "SELFTEST:%d failures\n" !failures ;
+    exit 1
+  ) ;
+  printf "SELFTEST:OK\n" ;
+  exit 0
+
+let _ = Appl.exec ["selftest"] run
+
+(**************************************************************)
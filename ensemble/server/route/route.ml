@@ -35,7 +35,10 @@ type id =
  * [key] contains an extra integer to improve the hash function.
 *)
 type key = Conn.id * Conn.key * int
-type merge = Buf.t -> Buf.ofs -> Buf.len -> Iovecl.t -> unit
+type merge = {
+  merge_buf : Buf.t -> Buf.ofs -> Buf.len -> Iovecl.t -> unit ;
+  merge_iov : Iovec.t -> Iovecl.t -> unit
+}
 type data = Conn.id * Buf.t * Security.key * pre_processor *
      ((Conn.id * Buf.t * Security.key * pre_processor) Arrayf.t ->
        merge Arrayf.t)
@@ -445,13 +448,30 @@ let merge info =
     ) info 
   in
   let info = Arrayf.flatten info in
-  merge4iov info
+  { merge_buf = merge4iov (Arrayf.map (fun m -> m.merge_buf) info) ;
+    merge_iov = merge2iov (Arrayf.map (fun m -> m.merge_iov) info) }
 
 let delay f =
   let delayed a b c d =
-    (f ()) a b c d
+    (f ()).merge_buf a b c d
+  and delayed_iov a b =
+    (f ()).merge_iov a b
   in
-  delayed
+  { merge_buf = delayed ; merge_iov = delayed_iov }
+
+(* For routers that parse headers only from a Buf: copy a header
+ * in iovec memory into a scratch buffer first.
+ *)
+let merge_of_buf upcall =
+  let scratch = ref Buf.empty in
+  let upcall_iov hdr iovl =
+    let len = Iovec.len hdr in
+    if Buf.length !scratch <|| len then
+      scratch := Buf.create len ;
+    Iovec.buf_of_full !scratch len0 hdr ;
+    upcall !scratch len0 len iovl
+  in
+  { merge_buf = upcall ; merge_iov = upcall_iov }
 
 
 let handlers () =
@@ -477,6 +497,16 @@ let deliver handlers buf ofs len iovl =
     );
 
   let handler = Handler.find handlers pack0 in
-  handler buf ofs len iovl
+  handler.merge_buf buf ofs len iovl
+
+let deliver_iov handlers hdr iovl = 
+  if Iovec.len hdr <|| md5len then (
+    Iovecl.free iovl ;
+    drop (fun () -> sprintf "size below minimum:len=%d" (int_of_len (Iovec.len hdr)))
+  ) else (
+    let pack0 = Iovec.int16_of_sub hdr (md5len -|| len4) in
+    let handler = Handler.find handlers pack0 in
+    handler.merge_iov hdr iovl
+  )
 
 (**************************************************************)
@@ -21,6 +21,12 @@ val handlers : unit -> handlers
  * iovec - a user-land iovec.
  *)
 val deliver : handlers -> Buf.t -> Buf.ofs -> Buf.len -> Iovecl.t -> unit
+
+(* As deliver, for an ML header that is still in iovec memory.
+ * The routers parse it in place, so that packets are dropped or
+ * delivered without copying it.  The header is not consumed.
+ *)
+val deliver_iov : handlers -> Iovec.t -> Iovecl.t -> unit
 (**************************************************************)
 
 (* transmit an Ensemble packet, this includes the ML part, and a
@@ -28,6 +34,14 @@ val deliver : handlers -> Buf.t -> Buf.ofs -> Buf.len -> Iovecl.t -> unit
  *)
 type xmitf = Buf.t -> Buf.ofs -> Buf.len -> Iovecl.t -> unit
 
+(* The receive functions of a router for one connection id: from
+ * an ML header in a Buf, and from one still in iovec memory.
+ *)
+type merge = {
+  merge_buf : Buf.t -> Buf.ofs -> Buf.len -> Iovecl.t -> unit ;
+  merge_iov : Iovec.t -> Iovecl.t -> unit
+}
+
 (* Type of routers. ['xf] is the type of a message send function. 
  *)
 type 'xf t
@@ -65,7 +79,7 @@ val create :
   ((bool -> 'xf) -> pre_processor) ->
   (Conn.id -> Buf.t) ->			(* packer *)
   ((Conn.id * digest * Security.key * pre_processor) Arrayf.t -> 
-    (Buf.t -> Buf.ofs -> Buf.len -> Iovecl.t -> unit) Arrayf.t) -> (* merge *)
+    merge Arrayf.t) -> (* merge *)
   (xmitf -> Security.key -> digest -> Conn.id -> 'xf) ->  (* blast *)
   'xf t
 
@@ -93,6 +107,11 @@ val merge2iovr : (Iovecl.t -> 'a -> unit) Arrayf.t -> Iovecl.t -> 'a -> unit
 val merge3iov : ('a -> 'b -> Iovecl.t -> unit) Arrayf.t -> 'a -> 'b -> Iovecl.t -> unit
 val merge4iov : ('a -> 'b -> 'c -> Iovecl.t -> unit) Arrayf.t -> 'a -> 'b -> 'c -> Iovecl.t -> unit
 
+(* The merge of a router that parses only from a Buf.  Headers
+ * in iovec memory are copied into a scratch buffer.
+ *)
+val merge_of_buf : (Buf.t -> Buf.ofs -> Buf.len -> Iovecl.t -> unit) -> merge
+
 (**************************************************************)
 
 val pack_of_conn : Conn.id -> Buf.t
@@ -23,7 +23,7 @@ let pack_of_conn c =
 
 let const handler = Route.Signed handler
 
-let unmarsh obj ofs = Marshal.from_string (Buf.string_of obj) (int_of_len ofs)
+let unmarsh = Buf.prealloc_unmarsh
 
 let f () =
   let zeros = 
@@ -75,7 +75,7 @@ let f () =
 	  else insecureh rank None seqno iovl
 	) else
 	  try 
-	    let mo = unmarsh hdr (ofs +|| md5len_plus_8 +|| md5len) in
+	    let mo = unmarsh hdr (ofs +|| md5len_plus_8 +|| md5len) molen in
 	    log (fun () -> "deliver Some");
 	    if check then secureh rank (Some mo) seqno iovl
 	    else insecureh rank (Some mo) seqno iovl
@@ -97,7 +97,7 @@ let f () =
       Arrayf.map (fun ((pack,key),upcalls) ->
 	let secure   = Route.merge4iov (Arrayf.map (fun u -> u true ) upcalls) in
 	let insecure = Route.merge4iov (Arrayf.map (fun u -> u false) upcalls) in
-	recv pack key secure insecure
+	Route.merge_of_buf (recv pack key secure insecure)
       ) upcalls
     in
     upcalls
@@ -108,9 +108,6 @@ let f () =
    * The idea is to marshal an ml object into a pre-allocated
    * buffer, and then write the rest of the parameters into
    * the beginning of the buffer. 
-   *
-   * We pass the [f] function into buf. This saves allocating an
-   * intermediated (buf,ofs,len) structure. 
    * 
    * The format of the ML part of the message is:
    * [16byte connection_id] [4byte sender] [4byte seqno] [16byte digest]
@@ -131,36 +128,35 @@ let f () =
       | Security.Common key' -> Security.buf_of_mac key'.Security.mac in 
     
     fun mo seqno iovl ->
-      let f hdr ofs len = 
-	Buf.blit pack len0 hdr ofs md5len;
-	Buf.write_int32 hdr (ofs +|| md5len) sender ;
-	Buf.write_int32 hdr (ofs +|| md5len_plus_4) seqno ;
-
-	if Iovecl.len iovl >|| len0 then 
-	  log (fun () -> sprintf "blast: ml_len=%d iovl_len=%d %s %s"
-	    (int_of_len len) (int_of_len (Iovecl.len iovl))
-	    (Util.hex_of_string (Buf.string_of pack ))
-	    (Conn.string_of_id conn)
-	  );
-	
-	(* Handling the md5 hash. 
-	 * 1) Zero the designated area, 2) Comupte the md5
-	 * 3) write the result.
-	 *)
-	Buf.blit zeros len0 hdr (ofs +|| md5len_plus_8) md5len; 
-	let ctx = Hsys.md5_init_full (Buf.string_of key) in
-	Hsys.md5_update ctx hdr ofs len;
-	Hsys.md5_update_iovl ctx iovl;
-	let d = Buf.of_string (Hsys.md5_final ctx) in
-	Buf.blit d len0 hdr (ofs +|| md5len_plus_8) md5len; 
-	
-	xmit hdr ofs len iovl
-      in
-      match mo with
+      let hdr,ofs,len = match mo with
 	| None -> 
-	    Buf.prealloc (md5len_plus_8 +|| md5len) f
+	    Buf.prealloc_ret (md5len_plus_8 +|| md5len)
 	| Some obj -> 
-	    Buf.prealloc_marsh (md5len_plus_8 +|| md5len) obj f
+	    Buf.prealloc_marsh_ret (md5len_plus_8 +|| md5len) obj
+      in
+      Buf.blit pack len0 hdr ofs md5len;
+      Buf.write_int32 hdr (ofs +|| md5len) sender ;
+      Buf.write_int32 hdr (ofs +|| md5len_plus_4) seqno ;
+
+      if Iovecl.len iovl >|| len0 then 
+	log (fun () -> sprintf "blast: ml_len=%d iovl_len=%d %s %s"
+	  (int_of_len len) (int_of_len (Iovecl.len iovl))
+	  (Util.hex_of_string (Buf.string_of pack ))
+	  (Conn.string_of_id conn)
+	);
+      
+      (* Handling the md5 hash. 
+       * 1) Zero the designated area, 2) Comupte the md5
+       * 3) write the result.
+       *)
+      Buf.blit zeros len0 hdr (ofs +|| md5len_plus_8) md5len; 
+      let ctx = Hsys.md5_init_full (Buf.string_of key) in
+      Hsys.md5_update ctx hdr ofs len;
+      Hsys.md5_update_iovl ctx iovl;
+      let d = Buf.of_string (Hsys.md5_final ctx) in
+      Buf.blit d len0 hdr (ofs +|| md5len_plus_8) md5len; 
+      
+      xmit hdr ofs len iovl
   in
   
   Route.create name true const pack_of_conn merge blast
@@ -26,7 +26,7 @@ let pack_of_conn c =
 let f () =
   let const handler = Route.Unsigned(handler true) in
 
-  let unmarsh obj ofs = Marshal.from_string (Buf.string_of obj) (int_of_len ofs) in
+  let unmarsh = Buf.prealloc_unmarsh in
 
   let merge info =
     let upcalls = Arrayf.map (function
@@ -54,7 +54,7 @@ let f () =
 	    upcalls rank None seqno iovl
 	  ) else (
 	    try 
-	      let mo = unmarsh hdr (ofs +|| md5len_plus_8) in
+	      let mo = unmarsh hdr (ofs +|| md5len_plus_8) molen in
 	      Route.info (fun () -> "before upcalls");
 	      upcalls rank (Some mo) seqno iovl
 	    with _ -> 
@@ -62,7 +62,36 @@ let f () =
 	      Route.drop (fun () -> sprintf "Bad parsing of ML header")
 	  ) 
 	)
-      in upcall
+      in
+
+      (* As above, parsing the header in iovec memory.
+       *)
+      let upcall_iov hdr iovl = 
+	let len = Iovec.len hdr in
+	if len <|| md5len_plus_8 then (
+	  Iovecl.free iovl ;
+	  Route.drop (fun () -> sprintf "%s:size below minimum:len=%d\n" name (int_of_len len))
+	) else if not (Iovec.subeq hdr len0 pack) then (
+	  Iovecl.free iovl ;
+	  Route.drop (fun () -> sprintf "%s:rest of Conn.id did not match" name)
+	) else (
+	  let rank  = Iovec.int32_of_sub hdr md5len in
+	  let seqno = Iovec.int32_of_sub hdr md5len_plus_4 in
+	  Route.info (fun () -> sprintf "rank=%d seqno=%d" rank seqno);
+	  let molen = len -|| md5len_plus_8 in
+	  if molen =|| len0 then (
+	    upcalls rank None seqno iovl
+	  ) else (
+	    try 
+	      let mo = Iovec.unmarsh_sub hdr md5len_plus_8 molen in
+	      upcalls rank (Some mo) seqno iovl
+	    with _ -> 
+	      Iovecl.free iovl ;
+	      Route.drop (fun () -> sprintf "Bad parsing of ML header")
+	  ) 
+	)
+      in
+      { Route.merge_buf = upcall ; Route.merge_iov = upcall_iov }
     ) upcalls
   in
 
@@ -71,9 +100,6 @@ let f () =
    * The idea is to marshal an ml object into a pre-allocated
    * buffer, and then write the rest of the parameters into
    * the beginning of the buffer. 
-   *
-   * We pass the [f] function into buf. This saves allocating an
-   * intermediated (buf,ofs,len) structure. 
    *)
   let blast xmit _ pack conn _ =
     let sender =
@@ -84,19 +110,18 @@ let f () =
     in
 
     fun mo seqno iovl ->
-      let f hdr ofs len = 
-	Buf.blit pack len0 hdr ofs md5len;
-	Buf.write_int32 hdr (ofs +|| md5len) sender ;
-	Buf.write_int32 hdr (ofs +|| md5len_plus_4) seqno ;
-	log (fun () -> sprintf "blast: ml_len=%d iovl_len=%d" 
-	  (int_of_len len) (int_of_len (Iovecl.len iovl)));
-	xmit hdr ofs len iovl
-      in
-      match mo with
+      let hdr,ofs,len = match mo with
 	| None -> 
-	    Buf.prealloc md5len_plus_8 f
+	    Buf.prealloc_ret md5len_plus_8
 	| Some obj -> 
-	    Buf.prealloc_marsh md5len_plus_8 obj f
+	    Buf.prealloc_marsh_ret md5len_plus_8 obj
+      in
+      Buf.blit pack len0 hdr ofs md5len;
+      Buf.write_int32 hdr (ofs +|| md5len) sender ;
+      Buf.write_int32 hdr (ofs +|| md5len_plus_4) seqno ;
+      log (fun () -> sprintf "blast: ml_len=%d iovl_len=%d" 
+	(int_of_len len) (int_of_len (Iovecl.len iovl)));
+      xmit hdr ofs len iovl
   in
   Route.create name false const pack_of_conn merge blast
 
@@ -39,14 +39,17 @@ type base = {
   total_len : int;     (* The total length of the C-buffer *)
   id : int;            (* The identity of this chunk *)
   mutable count : int; (* A reference count *)
-  pool : pool          (* Which pool does this chunk belong to *)
+  mutable live : int;  (* The total length of the references to it *)
+  pool : pool;         (* Which pool does this chunk belong to *)
+  slot : slot          (* For a slab object, where it lives *)
 }
     
 (* An iovector is an extent out of a C-buffer *)
 and t = { 
   base : base ;  
   ofs : int ;
-  len : int
+  len : int ;
+  quota : quota        (* Who is charged for it *)
 }
 
 and pool = {
@@ -57,9 +60,75 @@ and pool = {
   mutable chunk : base option;      (* The current chunk  *)
   mutable pos : int ;
   mutable allocated : int;          (* The total allocated space *)
-  mutable pending : (len * (t -> unit)) Queue.t (* A list of pending allocation requests *)
+  mutable pending : (len * (t -> unit)) Queue.t; (* A list of pending allocation requests *)
+  waiting : (unit -> unit) Queue.t; (* Receivers waiting for memory, see recv_wait *)
+  mutable slabs : slab array;      (* Size classes, empty if slabs are not used *)
+  mutable lived : base option;      (* The chunk compacted iovecs are copied into *)
+  mutable lived_pos : int;
+  mutable regions : cbuf list;      (* The regions holding the chunks, if any *)
+  mutable taken : float array;      (* When each chunk was last taken, by id *)
+  mutable grows : int;              (* Times the pool was grown *)
+  mutable fallbacks : int           (* Packets received into the ML heap *)
+}
+
+(* A slab is a set of chunks carved into objects of a single
+ * size.  Each object has a base of its own, with its own
+ * refcount, so a chunk is pinned only by the objects in use
+ * and not by its neighbours.
+ *)
+and slab = {
+  obj_size : int;
+  mutable partial : slab_chunk list; (* Chunks with free objects *)
+  mutable nchunks : int;             (* Chunks held by the slab *)
+  mutable live : int;                (* Objects in use *)
+  mutable allocs : int               (* Total allocations *)
+}
+
+and slab_chunk = {
+  sc_base : base;                    (* The underlying chunk *)
+  sc_slab : slab;
+  mutable sc_objs : base array;      (* Its objects *)
+  sc_free : int array;               (* Stack of free objects *)
+  mutable sc_nfree : int
+}
+
+and slot = 
+  | No_slot
+  | Slot of slab_chunk * int
+
+(* A quota limits the memory referenced by the iovecs of one
+ * owner, such as a client of the daemon.  Every reference is
+ * charged, so an iovec and its copy count twice.
+ *)
+and quota = {
+  q_name : string;
+  q_limit : int;                     (* In bytes, 0 for no limit *)
+  mutable q_used : int;              (* Referenced by live iovecs *)
+  mutable q_reserved : int;          (* Requested from a pool, not yet allocated *)
+  mutable q_peak : int;
+  mutable q_deferred : int;          (* Allocations that had to wait *)
+  q_pending : (pool * len * (t -> unit)) Queue.t (* Waiting for the quota *)
 }
     
+(* A snapshot of a pool, see pool_stats.  Chunks in use are
+ * counted by how much of them live iovecs reference, in
+ * quarters.  A chunk is pinned when iovecs hold it, but the pool
+ * no longer allocates from it.
+ *)
+type pool_stats = {
+  ps_name : string;
+  ps_size : int;                     (* Bytes the pool may hand out *)
+  ps_chunks : int;
+  ps_free_chunks : int;
+  ps_allocated : int;                (* Bytes in chunks taken, or wasted in them *)
+  ps_pending : int;                  (* Asynchronous allocations waiting *)
+  ps_waiting : int;                  (* Stalled receivers waiting *)
+  ps_grows : int;
+  ps_fallbacks : int;                (* Packets received into the ML heap *)
+  ps_occupancy : int array;          (* [<25%] [<50%] [<75%] [>=75%] *)
+  ps_oldest_pinned : float           (* Age in seconds, 0 if none *)
+}
+
 (* Instead of using the raw malloc function, we take
  * memory chunks of size CHUNK from the user. We then
  * try to allocated from them any message that can fit. 
@@ -82,6 +151,13 @@ type alloc_state = {
   mutable incr_step : int;               (* By how many chunks to increase a pool 
                                             when it dries up *)
   mutable maximum : int ;                (* The maximum allowed size of memory *)
+  mutable slabs : bool;                  (* Allocate from size classes *)
+  mutable slab_spare : slab_chunk option; (* An empty slab chunk kept aside *)
+  mutable region : int;                  (* Flags for mapping pools in regions, or 0 *)
+  mutable compact : bool;                (* Compact retained iovecs *)
+  mutable compact_epoch : int;           (* Times a pool ran low on chunks *)
+  mutable compacted : int;               (* Iovecs copied by compaction *)
+  mutable compacted_bytes : int;
   mutable send_pool : pool option;       (* A pool for sent-messages *)
   mutable recv_pool : pool option;       (* A pool for receiving messages *)
   mutable extra_pool : pool              (* A pool for all extra memory. *)
@@ -100,6 +176,15 @@ external copy_cbuf_ext_to_cbuf_ext : cbuf -> ofs -> cbuf -> ofs -> len -> unit
 external free_cbuf : cbuf -> unit 
   = "mm_cbuf_free" "noalloc"
     
+external cbuf_int16 : cbuf -> ofs -> int
+  = "mm_cbuf_int16" "noalloc"
+    
+external cbuf_int32 : cbuf -> ofs -> int
+  = "mm_cbuf_int32" "noalloc"
+    
+external cbuf_subeq : cbuf -> ofs -> string -> bool
+  = "mm_cbuf_subeq" "noalloc"
+    
 (* Flatten an array of iovectors. The destination iovec is
  * preallocated.
  *)
@@ -110,6 +195,23 @@ external mm_flatten : t array -> t -> unit
  *)
 external mm_alloc : int -> cbuf
   = "mm_cbuf_alloc"
+
+(* Allocation of a whole region for the chunks of a pool, see
+ * mm.c.  [mm_region_alloc len flags] maps the region,
+ * [mm_region_sub region ofs] is a cbuf for a part of it, and
+ * [mm_region_flags region] tells which of the flags were
+ * honored.
+ *)
+external mm_region_alloc : int -> int -> cbuf
+  = "mm_region_alloc"
+external mm_region_sub : cbuf -> ofs -> cbuf
+  = "mm_region_sub"
+external mm_region_flags : cbuf -> int
+  = "mm_region_flags" "noalloc"
+
+let region_hugetlb = 1
+let region_mlock = 2
+let region_thp = 4
     
 (* Create an empty iovec. We do this on the C side, so
  * that it will be usable by C functions that may return
@@ -130,6 +232,24 @@ let string_of_array    f a = string_of_list f (Array.to_list a)
   
 (* Initialization section *)    
 
+(* The quota of iovecs nobody is charged for.  Nothing is
+ * counted against it, so that iovecs cost no accounting when
+ * quotas are not in use.
+ *)
+let no_quota = {
+  q_name = "none";
+  q_limit = 0;
+  q_used = 0;
+  q_reserved = 0;
+  q_peak = 0;
+  q_deferred = 0;
+  q_pending = Queue.create ()
+}
+
+(* The quotas in use, for statistics.
+ *)
+let quotas = ref []
+
 let create_empty_pool name = {
   name = name;
   size = 0;
@@ -138,7 +258,15 @@ let create_empty_pool name = {
   chunk = None;
   pos = 0;
   allocated = 0;
-  pending = Queue.create ()
+  pending = Queue.create ();
+  waiting = Queue.create ();
+  slabs = [||];
+  lived = None;
+  lived_pos = 0;
+  regions = [];
+  taken = [||];
+  grows = 0;
+  fallbacks = 0
 }
   
 let s = {
@@ -148,11 +276,65 @@ let s = {
   min_alloc_size = 0;
   incr_step = 0;
   maximum = 0;
+  slabs = false;
+  slab_spare = None;
+  region = 0;
+  compact = false;
+  compact_epoch = 0;
+  compacted = 0;
+  compacted_bytes = 0;
   send_pool = None;
   recv_pool = None;
   extra_pool = create_empty_pool "Invalid"
 }
   
+(* The size classes of a pool using slabs: powers of two from
+ * slab_min up to a quarter of a chunk.  Larger requests are
+ * allocated from the current chunk, as usual.
+ *)
+let slab_min = 256
+
+let create_slabs chunk_size = 
+  let rec loop size = 
+    if size >|| chunk_size / 4 then [] else {
+      obj_size = size;
+      partial = [];
+      nchunks = 0;
+      live = 0;
+      allocs = 0
+    } :: loop (2 *|| size)
+  in Array.of_list (loop slab_min)
+
+(* Allocate [n] chunks for [pool], either one by one, or carved
+ * from a single region.
+ *)
+let alloc_chunks pool n chunk_size first_id = 
+  let cbuf = 
+    if s.region =|| 0 then (
+      fun _ -> mm_alloc chunk_size
+    ) else (
+      let region = mm_region_alloc (n *|| chunk_size) s.region in
+      pool.regions <- region :: pool.regions;
+      fun i -> mm_region_sub region (i *|| chunk_size)
+    )
+  in
+  Array.init n (fun i -> {
+    cbuf = cbuf i;
+    total_len = chunk_size;
+    id = i + first_id;
+    count=0; 
+    live=0;
+    pool = pool;
+    slot = No_slot
+  })
+
+(* Take a free chunk, noting when, for pool_stats.
+ *)
+let pop_chunk pool = 
+  let chunk = Queue.pop pool.free_chunks in
+  pool.taken.(chunk.id) <- Unix.gettimeofday ();
+  chunk
+
 let create_pool name size chunk_size =
   let num_chunks = size / chunk_size in
   if num_chunks = 0 then 
@@ -170,19 +352,19 @@ let create_pool name size chunk_size =
     pos = 0;
     allocated = 0;
     pending = Queue.create ();
+    waiting = Queue.create ();
+    slabs = if s.slabs then create_slabs chunk_size else [||];
+    lived = None;
+    lived_pos = 0;
+    regions = [];
+    taken = Array.make num_chunks 0.0;
+    grows = 0;
+    fallbacks = 0
   } in
-  let chunk_array = Array.init num_chunks (fun i -> 
-    let cbuf = mm_alloc chunk_size in  {
-      cbuf = cbuf;
-      total_len = chunk_size;
-      id = i;
-      count=0; 
-      pool = pool;
-    }
-  ) in
+  let chunk_array = alloc_chunks pool num_chunks chunk_size 0 in
   Array.iter (fun chunk -> Queue.add chunk pool.free_chunks) chunk_array;
   pool.chunk_array <- chunk_array;
-  let init_chunk = Queue.pop pool.free_chunks in
+  let init_chunk = pop_chunk pool in
   init_chunk.count <- 1;
   pool.chunk <- Some init_chunk;
   pool
@@ -190,11 +372,16 @@ let create_pool name size chunk_size =
 let clear_pool pool = 
   Queue.clear pool.free_chunks;
   Array.iter (fun chunk -> free_cbuf chunk.cbuf) pool.chunk_array;
+  List.iter free_cbuf pool.regions;
+  pool.regions <- [];
   pool.chunk_array <- [||];
   pool.chunk <- None;
   pool.pos <- 0;
+  pool.lived <- None;
+  pool.lived_pos <- 0;
   pool.allocated <- 0;
   Queue.clear pool.pending;
+  Queue.clear pool.waiting;
   ()
 
 let grow_pool pool = 
@@ -203,27 +390,73 @@ let grow_pool pool =
 
   (* create new chunks *)
   let base_len = 1 + Array.length pool.chunk_array in
-  let new_chunks = Array.init s.incr_step (fun i -> 
-    let cbuf = mm_alloc s.chunk_size in  {
-      cbuf = cbuf;
-      total_len = s.chunk_size;
-      id = i + base_len;
-      count=0; 
-      pool = pool;
-    }
-  ) in
+  let new_chunks = alloc_chunks pool s.incr_step s.chunk_size base_len in
   (* add them to free list *)
   Array.iter (fun chunk -> Queue.add chunk pool.free_chunks) new_chunks;
-  (* resize the array *)
+  (* resize the arrays *)
   pool.chunk_array <- Array.append pool.chunk_array new_chunks;
+  pool.taken <- Array.append pool.taken 
+    (Array.make (base_len +|| s.incr_step -|| Array.length pool.taken) 0.0);
+  pool.grows <- succ pool.grows;
   ()
 
 
+(* For each size class: size:chunks/live/capacity/allocations.
+ *)
+let string_of_slab slab = 
+  let capacity = slab.nchunks *|| (s.chunk_size / slab.obj_size) in
+  sprintf "%d:%d/%d/%d/%d" slab.obj_size slab.nchunks slab.live capacity slab.allocs
+
+(* How the regions of a pool were mapped.
+ *)
+let string_of_regions regions = 
+  let flags = List.fold_left (fun f r -> f lor mm_region_flags r) 0 regions in
+  let names = 
+    List.filter (fun (bit,_) -> flags land bit <>|| 0) 
+      [region_hugetlb,"hugetlb"; region_thp,"thp"; region_mlock,"mlock"]
+  in
+  sprintf "regions=%d%s" (List.length regions)
+    (String.concat "" (List.map (fun (_,name) -> ","^name) names))
+
 let get_pool_stats pool = 
-  sprintf "refs=%s pos=%d alloced=%d"
+  sprintf "refs=%s pos=%d alloced=%d%s%s"
     (string_of_array (fun chunk -> sprintf "%d" chunk.count) pool.chunk_array)
     pool.pos
     pool.allocated
+    (if Array.length pool.slabs =|| 0 then "" else 
+      sprintf " slabs=%s" (string_of_array string_of_slab pool.slabs))
+    (if pool.regions = [] then "" else 
+      sprintf " %s" (string_of_regions pool.regions))
+
+(* Enable compaction of retained iovecs, see [compact], before
+ * init.  Once chunks are handed out, the long-lived chunks and the
+ * epochs kept by holders of retained iovecs assume it is fixed.
+ *)
+let use_compaction b = 
+  if s.initialized then 
+    failwith "sanity: use_compaction called after the memory-manager was initialized";
+  s.compact <- b
+
+(* With slabs, retained iovecs are always compacted into them.
+ *)
+let compacting () = s.compact || s.slabs
+
+(* Map the chunks of each pool in a single region, with huge
+ * pages and/or locked in memory, before init.
+ *)
+let use_region hugepages mlock = 
+  if s.initialized then 
+    failwith "sanity: use_region called after the memory-manager was initialized";
+  s.region <- 
+    (if hugepages then region_hugetlb else 0) lor
+    (if mlock then region_mlock else 0)
+
+(* Choose the allocation policy, before init.
+ *)
+let use_slabs b = 
+  if s.initialized then 
+    failwith "sanity: use_slabs called after the memory-manager was initialized";
+  s.slabs <- b
 
 (* initialize the memory-manager. 
  * [init chunk_size max_mem_size min_alloc_size]
@@ -237,6 +470,9 @@ let init verbose chunk_size max_mem_size send_pool_pcnt min_alloc_size incr_step
   s.maximum <- max_mem_size;
   s.min_alloc_size <- min_alloc_size;
   s.incr_step <- incr_step;
+  if chunk_size <|| max_msg_size () then 
+    failwith (sprintf "chunk_size=%d is smaller than max_msg_size=%d" 
+      chunk_size (max_msg_size ()));
   if s.verbose then (
     printf "ciovec, chunk_size=%d  max_mem_size=%d\n" chunk_size max_mem_size;
     flush stdout;
@@ -252,6 +488,16 @@ let init verbose chunk_size max_mem_size send_pool_pcnt min_alloc_size incr_step
   
 (* Release all the memory used *)
 let shutdown () = 
+  (* The spare slab chunk is free, but counted as allocated.
+   *)
+  begin match s.slab_spare with
+    | None -> ()
+    | Some sc -> 
+	s.slab_spare <- None;
+	let pool = sc.sc_base.pool in
+	pool.allocated <- pool.allocated -|| s.chunk_size
+  end;
+
   (* No memory is allocated, everything can be released *)
   s.initialized <- false;
   s.verbose <- false;
@@ -286,10 +532,62 @@ let get_recv_pool () = match s.recv_pool with
   | Some pool -> pool
 
 (**************************************************************)
+let string_of_quota q = 
+  sprintf "%s:used=%d limit=%d peak=%d deferred=%d waiting=%d"
+    q.q_name q.q_used q.q_limit q.q_peak q.q_deferred (Queue.length q.q_pending)
+
 let get_stats () = 
-  sprintf "send_pool={%s}  recv_pool={%s}" 
+  sprintf "send_pool={%s}  recv_pool={%s}%s%s" 
     (get_pool_stats (get_send_pool ()))
     (get_pool_stats (get_recv_pool ()))
+    (if compacting () then 
+      sprintf "  compacted=%d (%d bytes) epoch=%d" s.compacted s.compacted_bytes s.compact_epoch
+    else "")
+    (if !quotas = [] then "" else 
+      sprintf "  quotas=%s" (string_of_list string_of_quota !quotas))
+
+let note_fallback pool = 
+  pool.fallbacks <- succ pool.fallbacks
+
+let get_pool_stats_r now pool = 
+  let occupancy = Array.make 4 0 in
+  let oldest = ref now in
+  Array.iter (fun chunk ->
+    if chunk.count >|| 0 then (
+      let q = min 3 (chunk.live *|| 4 / s.chunk_size) in
+      occupancy.(q) <- succ occupancy.(q);
+      let current = match pool.chunk, pool.lived with
+	| Some c, _ when c == chunk -> true
+	| _, Some c when c == chunk -> true
+	| _ -> false
+      in
+      if not current then
+	oldest := min !oldest pool.taken.(chunk.id)
+    )
+  ) pool.chunk_array;
+  {
+    ps_name = pool.name;
+    ps_size = pool.size;
+    ps_chunks = Array.length pool.chunk_array;
+    ps_free_chunks = Queue.length pool.free_chunks;
+    ps_allocated = pool.allocated;
+    ps_pending = Queue.length pool.pending;
+    ps_waiting = Queue.length pool.waiting;
+    ps_grows = pool.grows;
+    ps_fallbacks = pool.fallbacks;
+    ps_occupancy = occupancy;
+    ps_oldest_pinned = now -. !oldest
+  }
+
+let pool_stats () = 
+  let now = Unix.gettimeofday () in
+  List.map (get_pool_stats_r now) [get_send_pool (); get_recv_pool ()]
+
+let string_of_pool_stats p = 
+  sprintf "pool=%s size=%d chunks=%d free_chunks=%d allocated=%d pending=%d waiting=%d grows=%d fallbacks=%d occupancy=%s oldest_pinned=%.3f"
+    p.ps_name p.ps_size p.ps_chunks p.ps_free_chunks p.ps_allocated 
+    p.ps_pending p.ps_waiting p.ps_grows p.ps_fallbacks
+    (string_of_array string_of_int p.ps_occupancy) p.ps_oldest_pinned
 
 (**************************************************************)
 
@@ -300,7 +598,8 @@ let num_refs t = t.base.count
 let chunk_sub chunk ofs len = 
   assert (chunk.total_len >=|| ofs +|| len);
   chunk.count <- succ chunk.count;
-  {base=chunk; ofs=ofs; len=len}
+  chunk.live <- chunk.live +|| len;
+  {base=chunk; ofs=ofs; len=len; quota=no_quota}
   
 let empty_cbuf = mm_empty ()
   
@@ -309,14 +608,26 @@ let empty =
     cbuf=mm_empty (); 
     total_len = 0;
     count=1; 
+    live=0;
     id=(-1);
-    pool = s.extra_pool
+    pool = s.extra_pool;
+    slot = No_slot
   } in
-  {base=empty_chunk; ofs=0; len=0}
+  {base=empty_chunk; ofs=0; len=0; quota=no_quota}
   
+(* With compaction, count the times a chunk is taken from a pool
+ * that has less than a quarter of its chunks free.  Holders of
+ * retained iovecs compact them when the count changes.
+ *)
+let note_chunk_taken pool = 
+  if compacting ()
+  && Queue.length pool.free_chunks *|| 4 <|| Array.length pool.chunk_array then
+    s.compact_epoch <- succ s.compact_epoch
+
 let alloc_new_chunk pool = 
   log (fun () -> "alloc_new_chunk");
-  let chunk = Queue.pop pool.free_chunks in
+  note_chunk_taken pool;
+  let chunk = pop_chunk pool in
   assert(chunk.count =|| 0);
   chunk.count <- 1;
   pool.pos <- 0;
@@ -365,6 +676,120 @@ let free_old_chunk_alloc_new pool =
     false
   )
     
+(**************************************************************)
+(* Slabs.
+ *)
+
+(* Return an empty slab chunk to its pool.
+ *)
+let slab_release sc = 
+  log (fun () -> sprintf "slab_release: chunk=%d" sc.sc_base.id);
+  sc.sc_base.count <- 0;
+  free_chunk_and_refresh sc.sc_base
+
+(* Take a free chunk for [slab], growing the pool if it has room
+ * but no free chunks, and carve it into objects.
+ *)
+let slab_carve pool slab = 
+  if pool.allocated +|| s.chunk_size >|| pool.size then (
+    log (fun () -> sprintf "slab_carve: no space, allocated=%d" pool.allocated);
+    raise Out_of_iovec_memory
+  );
+  if Queue.is_empty pool.free_chunks then 
+    grow_pool pool;
+  note_chunk_taken pool;
+  let chunk = pop_chunk pool in
+  assert(chunk.count =|| 0);
+  chunk.count <- 1;
+  pool.allocated <- pool.allocated +|| s.chunk_size;
+  let n = s.chunk_size / slab.obj_size in
+  let sc = {
+    sc_base = chunk;
+    sc_slab = slab;
+    sc_objs = [||];
+    sc_free = Array.init n (fun i -> pred n -|| i);
+    sc_nfree = n
+  } in
+  sc.sc_objs <- Array.init n (fun i -> {
+    cbuf = chunk.cbuf;
+    total_len = chunk.total_len;
+    id = chunk.id;
+    count = 0;
+    live = 0;
+    pool = pool;
+    slot = Slot(sc,i)
+  });
+  log (fun () -> sprintf "slab_carve: size=%d chunk=%d" slab.obj_size chunk.id);
+  sc
+
+(* Take a chunk for [slab]: the spare if it was carved for
+ * [slab], or else a new one.  A spare of another size class in
+ * the same pool is released first, as it may be the only chunk
+ * left.
+ *)
+let slab_grow pool slab = 
+  let sc = match s.slab_spare with
+    | Some sc when sc.sc_slab == slab ->
+	s.slab_spare <- None;
+	sc
+    | Some sc when sc.sc_base.pool == pool ->
+	s.slab_spare <- None;
+	slab_release sc;
+	slab_carve pool slab
+    | _ -> 
+	slab_carve pool slab
+  in
+  slab.nchunks <- succ slab.nchunks;
+  slab.partial <- sc :: slab.partial;
+  sc
+
+let slab_alloc pool slab len = 
+  let sc = match slab.partial with
+    | sc :: _ -> sc
+    | [] -> slab_grow pool slab
+  in
+  sc.sc_nfree <- pred sc.sc_nfree;
+  let i = sc.sc_free.(sc.sc_nfree) in
+  if sc.sc_nfree =|| 0 then
+    slab.partial <- List.tl slab.partial;
+  slab.live <- succ slab.live;
+  slab.allocs <- succ slab.allocs;
+  chunk_sub sc.sc_objs.(i) (i *|| slab.obj_size) len
+
+(* Return object [i] to its chunk.  A chunk whose objects are all
+ * free leaves its slab.  One such chunk is kept as a spare, over
+ * all size classes, so that a slab that drops to no objects and
+ * back does not return and take a chunk each time; others go
+ * back to the pool.
+ *)
+let slab_free sc i = 
+  let slab = sc.sc_slab in
+  sc.sc_free.(sc.sc_nfree) <- i;
+  sc.sc_nfree <- succ sc.sc_nfree;
+  slab.live <- pred slab.live;
+  if sc.sc_nfree =|| 1 then
+    slab.partial <- sc :: slab.partial;
+  if sc.sc_nfree =|| Array.length sc.sc_objs then (
+    slab.partial <- List.filter (fun sc' -> sc' != sc) slab.partial;
+    slab.nchunks <- pred slab.nchunks;
+    match s.slab_spare with
+    | None -> s.slab_spare <- Some sc
+    | Some _ -> slab_release sc
+  )
+
+(* The size class for an allocation of [len] bytes, or -1 if it
+ * does not come from a slab.
+ *)
+let slab_class pool len = 
+  let n = Array.length pool.slabs in
+  if n =|| 0 || len >|| pool.slabs.(pred n).obj_size then -1 else (
+    let rec loop i = 
+      if pool.slabs.(i).obj_size >=|| len then i else loop (succ i)
+    in loop 0
+  )
+
+(**************************************************************)
+
 (* Decrement the refount, and free the cbuf if the count
  * reaches zero. 
  *)
@@ -377,9 +802,14 @@ let free t =
       );
     (*log (fun () -> sprintf "free: len=%d" t.iov.len);*)
     t.base.count <- pred t.base.count;
+    t.base.live <- t.base.live -|| t.len;
+    if t.quota != no_quota then
+      t.quota.q_used <- t.quota.q_used -|| t.len;
     if t.base.count =|| 0 then (
       log (fun () -> sprintf "freeing a buffer (len=%d)" t.base.total_len);
-      ignore (free_chunk_and_refresh t.base)
+      match t.base.slot with
+      | Slot(sc,i) -> slab_free sc i
+      | No_slot -> free_chunk_and_refresh t.base
     );
   )
     
@@ -404,7 +834,10 @@ let alloc_from_current_chunk pool chunk len =
   iov
     
 let alloc pool len = 
-  if len >|| 0 then (
+  let cls = if len >|| 0 then slab_class pool len else -1 in
+  if cls >=|| 0 then (
+    slab_alloc pool pool.slabs.(cls) len
+  ) else if len >|| 0 then (
     match pool.chunk with 
         None -> raise Out_of_iovec_memory
       | Some chunk -> 
@@ -462,6 +895,7 @@ let check_pre_alloc pool =
   match pool.chunk with 
     | None -> false
     | Some chunk -> 
+        let max_msg_size = max_msg_size () in
         if s.chunk_size -|| pool.pos >=|| max_msg_size then (
           (* Normal case, there is enough space in the current chunk. Allocate
            * there. 
@@ -485,17 +919,42 @@ let check_pre_alloc pool =
             false
         )
           
+(* The number of max_msg_size packets that can be received into
+ * the current chunk. Only valid after check_pre_alloc returned true,
+ * and then it is at least one.
+ *)
+let prealloc_slots pool = 
+  (s.chunk_size -|| pool.pos) / max_msg_size ()
+
+(* The number of bytes left in the current chunk, with the same
+ * conditions.
+ *)
+let prealloc_room pool = 
+  s.chunk_size -|| pool.pos
+
+(* Create an iovec at offset [ofs] from the current position in the
+ * cached chunk, without moving the position.
+ *)
+let sub_alloc pool ofs len = 
+  let chunk = some_of pool.chunk in
+  chunk_sub chunk (pool.pos +|| ofs) len
+
+(* We have used [total_len] space from the cached iovec.
+ * Update our postion in it.
+ *)
+let advance pool total_len = 
+  pool.pos <- pool.pos +|| total_len;
+  assert (pool.pos <=|| s.chunk_size);
+  pool.allocated <- pool.allocated +|| total_len
+
 (* We have allocated [len] space from the cached iovec.
  * Update our postion in it.
  *)
 let advance_and_sub_alloc pool total_len ofs len= 
   (* This isn't very good. We assume advance works hand-in-hand with pre_alloc. 
    *)
-  let chunk = some_of pool.chunk in
-  let iov = chunk_sub chunk (pool.pos +|| ofs) len in
-  pool.pos <- pool.pos +|| total_len;
-  assert (pool.pos <=|| s.chunk_size);
-  pool.allocated <- pool.allocated +|| total_len;
+  let iov = sub_alloc pool ofs len in
+  advance pool total_len;
   iov
     
 
@@ -529,11 +988,119 @@ let rec satisfy_pending_pool pool =
     )
   )
     
+(* Backpressure on receives.  With a stall handler set, a
+ * receive that finds no iovec memory asks it whether to read the
+ * packet anyway, into the ML heap and without its iovec data.
+ * If not, nothing is read, and the packet stays queued in the
+ * kernel; the handler should then stop reading its sockets until
+ * [recv_wait] calls back.
+ *)
+let recv_stall_r = ref None
+
+let set_recv_stall f = recv_stall_r := f
+
+let recv_stall () = 
+  match !recv_stall_r with
+  | None -> false
+  | Some stall -> stall ()
+
+(* Call [f] once [pool] can take a packet again.
+ *)
+let recv_wait pool f = 
+  Queue.add f pool.waiting
+
+let satisfy_waiting pool = 
+  if not (Queue.is_empty pool.waiting) && check_pre_alloc pool then (
+    log (fun () -> sprintf "satisfy_waiting: %d receivers" (Queue.length pool.waiting));
+    while not (Queue.is_empty pool.waiting) do
+      (Queue.take pool.waiting) ()
+    done
+  )
+
 let satisfy_pending_pool_opt = function
   | None -> ()
-  | Some pool -> satisfy_pending_pool pool
+  | Some pool -> 
+      satisfy_pending_pool pool;
+      satisfy_waiting pool
 	
+(**************************************************************)
+(* Quotas.  An allocation that would take its owner over its
+ * quota waits in the quota's own queue, so that it does not hold
+ * up the other owners in the queue of the pool.  Once it fits,
+ * the space is reserved, and it moves on to the pool.
+ *)
+
+let create_quota name limit = 
+  let q = {
+    q_name = name;
+    q_limit = limit;
+    q_used = 0;
+    q_reserved = 0;
+    q_peak = 0;
+    q_deferred = 0;
+    q_pending = Queue.create ()
+  } in
+  quotas := q :: !quotas;
+  q
+
+(* Drop the waiting requests of [q], and stop reporting it.
+ * Iovecs charged to it are still credited back when freed.
+ *)
+let release_quota q = 
+  Queue.clear q.q_pending;
+  quotas := List.filter (fun q' -> q' != q) !quotas
+
+let quota_fits q len = 
+  q.q_limit =|| 0 || q.q_used +|| q.q_reserved +|| len <=|| q.q_limit
+
+(* Move the charge for [t] to [q].
+ *)
+let charge q t = 
+  if q == t.quota || t.len =|| 0 then t else (
+    if t.quota != no_quota then
+      t.quota.q_used <- t.quota.q_used -|| t.len;
+    if q != no_quota then (
+      q.q_used <- q.q_used +|| t.len;
+      if q.q_used >|| q.q_peak then q.q_peak <- q.q_used
+    );
+    {t with quota = q}
+  )
+
+let alloc_quota q pool len = 
+  if not (quota_fits q len) then (
+    log (fun () -> sprintf "quota %s exceeded (used=%d req=%d)" q.q_name q.q_used len);
+    raise Out_of_iovec_memory
+  );
+  charge q (alloc pool len)
+
+let forward_quota q pool len cont_fun = 
+  q.q_reserved <- q.q_reserved +|| len;
+  alloc_async pool len (fun t -> 
+    q.q_reserved <- q.q_reserved -|| len;
+    cont_fun (charge q t)
+  )
+
+let alloc_async_quota q pool len cont_fun = 
+  if len >|| 0 && (not (Queue.is_empty q.q_pending) || not (quota_fits q len)) then (
+    log (fun () -> sprintf "quota %s: deferring request for %d bytes" q.q_name len);
+    q.q_deferred <- succ q.q_deferred;
+    Queue.add (pool, len, cont_fun) q.q_pending
+  ) else (
+    forward_quota q pool len cont_fun
+  )
+
+let satisfy_quota q = 
+  let fits () = 
+    not (Queue.is_empty q.q_pending) &&
+    (let (_,len,_) = Queue.peek q.q_pending in quota_fits q len)
+  in
+  while fits () do
+    let (pool,len,cont_fun) = Queue.take q.q_pending in
+    forward_quota q pool len cont_fun
+  done
+
 let satisfy_pending () = 
+  List.iter satisfy_quota !quotas;
   satisfy_pending_pool_opt s.recv_pool;
   satisfy_pending_pool_opt s.send_pool
     
@@ -554,16 +1121,32 @@ let string_of_t_full s ofs t =
   copy_cbuf_ext_to_string t.base.cbuf t.ofs s ofs t.len 
     
     
+let int16_of_sub t ofs = 
+  assert (ofs +|| 2 <=|| t.len);
+  cbuf_int16 t.base.cbuf (t.ofs +|| ofs)
+
+let int32_of_sub t ofs = 
+  assert (ofs +|| 4 <=|| t.len);
+  cbuf_int32 t.base.cbuf (t.ofs +|| ofs)
+
+let subeq t ofs s = 
+  assert (ofs +|| String.length s <=|| t.len);
+  cbuf_subeq t.base.cbuf (t.ofs +|| ofs) s
+
 (* Create an iovec that points to a sub-string in [iov].
  *)
 let sub t ofs len = 
   assert (num_refs t >|| 0);
   assert (ofs +|| len <=|| t.len);
   t.base.count <- succ t.base.count;
+  t.base.live <- t.base.live +|| len;
+  if t.quota != no_quota then
+    t.quota.q_used <- t.quota.q_used +|| len;
   { 
     base = t.base;
     ofs = t.ofs +|| ofs;
     len = len;
+    quota = t.quota
   } 
   
 (* Increment the refount, do not really copy. 
@@ -571,8 +1154,102 @@ let sub t ofs len =
 let copy t = 
   assert (num_refs t >|| 0); 
   t.base.count <- succ t.base.count ;
+  t.base.live <- t.base.live +|| t.len ;
+  if t.quota != no_quota then
+    t.quota.q_used <- t.quota.q_used +|| t.len ;
   t
     
+(**************************************************************)
+(* Compaction.  An iovec kept for long, waiting for stability,
+ * may pin a chunk that is otherwise almost unused.  When a pool
+ * runs low on chunks, such iovecs are copied into slab objects,
+ * or else into a chunk of their own, kept for long-lived data,
+ * so that the old chunks can be freed.
+ *)
+
+let compact_epoch () = s.compact_epoch
+
+(* Retire the current long-lived chunk, and take a new one if
+ * there is a free chunk.
+ *)
+let lived_refresh pool = 
+  begin match pool.lived with
+  | None -> ()
+  | Some chunk ->
+      pool.allocated <- pool.allocated +|| (s.chunk_size -|| pool.lived_pos);
+      pool.lived <- None;
+      chunk.count <- pred chunk.count;
+      if chunk.count =|| 0 then
+	free_chunk_and_refresh chunk
+  end;
+  if not (Queue.is_empty pool.free_chunks) then (
+    let chunk = pop_chunk pool in
+    assert(chunk.count =|| 0);
+    chunk.count <- 1;
+    pool.lived <- Some chunk;
+    pool.lived_pos <- 0
+  )
+
+(* Is [t] in a regular chunk that is less than a quarter used,
+ * and which is neither the current nor the long-lived one.
+ *)
+let sparse t = 
+  let base = t.base in
+  let pool = base.pool in
+  base.id >=|| 0
+  && base.live *|| 4 <|| s.chunk_size
+  && t.len *|| 4 <=|| s.chunk_size
+  && base.slot == No_slot
+  && (match pool.chunk with Some c -> c != base | None -> true)
+  && (match pool.lived with Some c -> c != base | None -> true)
+
+(* Take [len] bytes of the long-lived chunk, or None if there is
+ * no room.
+ *)
+let lived_alloc pool len = 
+  let room () = match pool.lived with
+    | Some _ -> s.chunk_size -|| pool.lived_pos >=|| len
+    | None -> false
+  in
+  if not (room ()) then 
+    lived_refresh pool;
+  if not (room ()) then None else (
+    let t = chunk_sub (some_of pool.lived) pool.lived_pos len in
+    pool.lived_pos <- pool.lived_pos +|| len;
+    pool.allocated <- pool.allocated +|| len;
+    Some t
+  )
+
+(* Copy [t] into a slab object of its size, or into the
+ * long-lived chunk if it is too large for the slabs, and free
+ * it.  Returns [t] itself if it is not sparse, or if there is no
+ * room.
+ *)
+let compact t = 
+  if not (compacting () && sparse t) then t else (
+    let pool = t.base.pool in
+    let cls = slab_class pool t.len in
+    let t' = 
+      if cls >=|| 0 then (
+	try Some (slab_alloc pool pool.slabs.(cls) t.len)
+	with Out_of_iovec_memory -> None
+      ) else (
+	lived_alloc pool t.len
+      )
+    in
+    match t' with
+    | None -> t
+    | Some t' ->
+	let t' = charge t.quota t' in
+	copy_cbuf_ext_to_cbuf_ext t.base.cbuf t.ofs t'.base.cbuf t'.ofs t.len;
+	s.compacted <- succ s.compacted;
+	s.compacted_bytes <- s.compacted_bytes +|| t.len;
+	free t;
+	t'
+  )
+
+(**************************************************************)
+
 (* Compute the total length of an iovec array.
  *)
 let iovl_len iovl = Array.fold_left (fun pos iov -> 
@@ -618,23 +1295,31 @@ let marshal_to_current_chunk pool obj flags =
         iov
     | None -> failwith "sanity: marshal_into_current_chunk called with a null chunk"
         
-(* There is no more space in the iovec system. Allocate a fresh iovec for this
- * purpose.
+(* Copy a substring into a fresh iovec, allocated outside of the
+ * pools.
  *)
-let marshal_to_fresh_iov pool obj flags = 
-  let mlstr = Marshal.to_string obj flags in
-  let mllen = String.length mlstr in  
-  log (fun () -> sprintf "marshal_to_fresh_iov mllen=%d" mllen);
-  let cbuf = mm_alloc mllen in
-  copy_string_to_cbuf_ext mlstr 0 cbuf 0 mllen;
+let fresh_of_string str ofs len = 
+  let cbuf = mm_alloc len in
+  copy_string_to_cbuf_ext str ofs cbuf 0 len;
   let iregular_chunk = {
     cbuf = cbuf;
-    total_len = mllen;
+    total_len = len;
     id = (-1);     (* -1 denotes that this isn't a regular chunk *)
     count=1; 
+    live=len;
     pool=s.extra_pool;
+    slot=No_slot
   } in
-  {base= iregular_chunk; ofs=0; len=mllen}
+  {base= iregular_chunk; ofs=0; len=len; quota=no_quota}
+
+(* There is no more space in the iovec system. Allocate a fresh iovec for this
+ * purpose.
+ *)
+let marshal_to_fresh_iov pool obj flags = 
+  let mlstr = Marshal.to_string obj flags in
+  let mllen = String.length mlstr in  
+  log (fun () -> sprintf "marshal_to_fresh_iov mllen=%d" mllen);
+  fresh_of_string mlstr 0 mllen
   
 (* Marshal ML object into an iovec *)
 let marshal pool obj flags =
@@ -668,5 +1353,10 @@ let unmarshal t =
   assert (num_refs t >|| 0);
   mm_unmarshal t.base.cbuf t.ofs t.len
     
+let unmarshal_sub t ofs len =  
+  assert (num_refs t >|| 0);
+  assert (ofs +|| len <=|| t.len);
+  mm_unmarshal t.base.cbuf (t.ofs +|| ofs) len
+    
 (**************************************************************)
 
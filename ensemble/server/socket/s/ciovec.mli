@@ -31,14 +31,17 @@ type base = {
   total_len : int;     (* The total length of the C-buffer *)
   id : int;            (* The identity of this chunk *)
   mutable count : int; (* A reference count *)
-  pool : pool          (* Which pool does this chunk belong to *)
+  mutable live : int;  (* The total length of the references to it *)
+  pool : pool;         (* Which pool does this chunk belong to *)
+  slot : slot          (* For a slab object, where it lives *)
 }
     
 (* An iovector is an extent out of a C-buffer *)
 and t = { 
   base : base ;  
   ofs : int ;
-  len : int
+  len : int ;
+  quota : quota        (* Who is charged for it *)
 }
 
 and pool = {
@@ -49,9 +52,73 @@ and pool = {
   mutable chunk : base option;      (* The current chunk  *)
   mutable pos : int ;
   mutable allocated : int;          (* The total allocated space *)
-  mutable pending : (len * (t -> unit)) Queue.t (* A list of pending allocation requests *)
+  mutable pending : (len * (t -> unit)) Queue.t; (* A list of pending allocation requests *)
+  waiting : (unit -> unit) Queue.t; (* Receivers waiting for memory, see recv_wait *)
+  mutable slabs : slab array;      (* Size classes, empty if slabs are not used *)
+  mutable lived : base option;      (* The chunk compacted iovecs are copied into *)
+  mutable lived_pos : int;
+  mutable regions : cbuf list;      (* The regions holding the chunks, if any *)
+  mutable taken : float array;      (* When each chunk was last taken, by id *)
+  mutable grows : int;              (* Times the pool was grown *)
+  mutable fallbacks : int           (* Packets received into the ML heap *)
+}
+
+(* A slab is a set of chunks carved into objects of a single
+ * size, each with a refcount of its own.
+ *)
+and slab = {
+  obj_size : int;
+  mutable partial : slab_chunk list; (* Chunks with free objects *)
+  mutable nchunks : int;             (* Chunks held by the slab *)
+  mutable live : int;                (* Objects in use *)
+  mutable allocs : int               (* Total allocations *)
+}
+
+and slab_chunk = {
+  sc_base : base;                    (* The underlying chunk *)
+  sc_slab : slab;
+  mutable sc_objs : base array;      (* Its objects *)
+  sc_free : int array;               (* Stack of free objects *)
+  mutable sc_nfree : int
+}
+
+and slot = 
+  | No_slot
+  | Slot of slab_chunk * int
+
+(* A quota limits the memory referenced by the iovecs of one
+ * owner, such as a client of the daemon.  Every reference is
+ * charged, so an iovec and its copy count twice.
+ *)
+and quota = {
+  q_name : string;
+  q_limit : int;                     (* In bytes, 0 for no limit *)
+  mutable q_used : int;              (* Referenced by live iovecs *)
+  mutable q_reserved : int;          (* Requested from a pool, not yet allocated *)
+  mutable q_peak : int;
+  mutable q_deferred : int;          (* Allocations that had to wait *)
+  q_pending : (pool * len * (t -> unit)) Queue.t (* Waiting for the quota *)
 }
     
+(* A snapshot of a pool, see pool_stats.  Chunks in use are
+ * counted by how much of them live iovecs reference, in
+ * quarters.  A chunk is pinned when iovecs hold it, but the pool
+ * no longer allocates from it.
+ *)
+type pool_stats = {
+  ps_name : string;
+  ps_size : int;                     (* Bytes the pool may hand out *)
+  ps_chunks : int;
+  ps_free_chunks : int;
+  ps_allocated : int;                (* Bytes in chunks taken, or wasted in them *)
+  ps_pending : int;                  (* Asynchronous allocations waiting *)
+  ps_waiting : int;                  (* Stalled receivers waiting *)
+  ps_grows : int;
+  ps_fallbacks : int;                (* Packets received into the ML heap *)
+  ps_occupancy : int array;          (* [<25%] [<50%] [<75%] [>=75%] *)
+  ps_oldest_pinned : float           (* Age in seconds, 0 if none *)
+}
+
 type alloc_state = {
   mutable initialized : bool;
   mutable verbose : bool;
@@ -60,6 +127,13 @@ type alloc_state = {
   mutable incr_step : int;               (* By how many chunks to increase a pool 
                                             when it dries up *)
   mutable maximum : int ;                (* The maximum allowed size of memory *)
+  mutable slabs : bool;                  (* Allocate from size classes *)
+  mutable slab_spare : slab_chunk option; (* An empty slab chunk kept aside *)
+  mutable region : int;                  (* Flags for mapping pools in regions, or 0 *)
+  mutable compact : bool;                (* Compact retained iovecs *)
+  mutable compact_epoch : int;           (* Times a pool ran low on chunks *)
+  mutable compacted : int;               (* Iovecs copied by compaction *)
+  mutable compacted_bytes : int;
   mutable send_pool : pool option;       (* A pool for sent-messages *)
   mutable recv_pool : pool option;       (* A pool for receiving messages *)
   mutable extra_pool : pool              (* A pool for all extra memory. *)
@@ -68,6 +142,29 @@ type alloc_state = {
 
 (**************************************************************)
 
+(* Enable compaction of retained iovecs, see [compact].  Must be
+ * called before init.
+ *)
+val use_compaction : bool -> unit
+
+(* [use_region hugepages mlock] maps the chunks of each pool in
+ * one region, instead of allocating them one by one.  With
+ * [hugepages], huge pages are used where available; with
+ * [mlock], the region is locked in memory.  If neither is set,
+ * chunks are allocated with malloc as usual.  Must be called
+ * before init.
+ *)
+val use_region : bool -> bool -> unit
+
+(* Allocate iovecs of up to a quarter of a chunk from slabs of
+ * fixed-size objects, instead of from the current chunk.  An
+ * iovec that is kept for long then holds only its own object,
+ * not a whole chunk.  Received packets still go into chunks, so
+ * this also enables compaction, which copies retained ones into
+ * slab objects.  Must be called before init.
+ *)
+val use_slabs : bool -> unit
+
 (* initialize the memory-manager. 
  * [init verbose chunk_size max_mem_size send_pool_pcnt min_alloc_size incr_step]
  *)
@@ -85,7 +182,22 @@ val shutdown : unit -> unit
  *)
 val string_of_t : t -> string 
 val string_of_t_full : string -> len -> t -> unit
+
+(* Read a 16- or 32-bit integer in network order at an offset, without
+ * copying the iovec.
+ *)
+val int16_of_sub : t -> ofs -> int
+val int32_of_sub : t -> ofs -> int
+
+(* Whether the bytes at an offset are those of a string.
+ *)
+val subeq : t -> ofs -> string -> bool
 val t_of_string : pool -> string -> ofs -> len -> t
+
+(* As t_of_string, but the iovec is allocated outside of the
+ * pools, for use when they are out of memory.
+ *)
+val fresh_of_string : string -> ofs -> len -> t
   
 val len : t -> int
   
@@ -98,6 +210,28 @@ val alloc_async : pool -> len -> (t -> unit) -> unit
 val alloc : pool -> len -> t
   
 val satisfy_pending : unit -> unit
+
+(* Backpressure on receives.  With [set_recv_stall (Some stall)],
+ * a receive that finds no iovec memory calls [stall ()].  If it
+ * returns false, the packet is read into the ML heap as usual,
+ * dropping its iovec data.  Otherwise nothing is read, and the
+ * caller should stop reading its sockets until the function
+ * given to [recv_wait pool] is called, from satisfy_pending.
+ *)
+val set_recv_stall : (unit -> bool) option -> unit
+val recv_wait : pool -> (unit -> unit) -> unit
+
+(* Quotas on the memory of a single owner.  [create_quota name
+ * limit] with [limit] in bytes, 0 for no limit.  [alloc_quota]
+ * raises Out_of_iovec_memory if the quota would be exceeded.
+ * With [alloc_async_quota], the request waits until the quota
+ * allows it, and then for the pool.
+ *)
+val no_quota : quota
+val create_quota : string -> int -> quota
+val release_quota : quota -> unit
+val alloc_quota : quota -> pool -> len -> t
+val alloc_async_quota : quota -> pool -> len -> (t -> unit) -> unit
   
 val sub : t -> ofs -> len -> t
   
@@ -110,6 +244,17 @@ val free : t -> unit
  *)
 val copy : t -> t 
   
+(* With compaction enabled, if [t] keeps a chunk that is
+ * otherwise mostly unused, copy it into a slab object, or into a
+ * chunk kept for long-lived data if slabs are not used or it is
+ * too large for them, free it, and return the copy.  Otherwise
+ * return [t] itself.  [compact_epoch] changes whenever a pool
+ * runs low on free chunks; holders of retained iovecs compact
+ * them when it does.
+ *)
+val compact : t -> t
+val compact_epoch : unit -> int
+
 (* Flatten an iovec array into a single iovec.  Copying only
  * occurs if the array has more than 1 non-empty iovec.
  *)
@@ -128,6 +273,10 @@ val marshal : pool -> 'a -> Marshal.extern_flags list -> t
  * is a problem, and checks for out-of-bounds problems. 
  *)
 val unmarshal : t -> 'a
+
+(* As above, from a substring of the iovec.
+ *)
+val unmarshal_sub : t -> ofs -> len -> 'a
   
 (**************************************************************)
 (* Increase pool size, it does not have sufficient memory *)
@@ -138,12 +287,33 @@ val grow_pool : pool -> unit
 (* statistics *)
 val get_stats : unit -> string
 
+(* Structured statistics of the send and recv pools, as of now.
+ *)
+val pool_stats : unit -> pool_stats list
+val string_of_pool_stats : pool_stats -> string
+
+(* Count a packet received into the ML heap for lack of memory.
+ *)
+val note_fallback : pool -> unit
+
 (**************************************************************)
 (* Internal to the Socket library
 *)  
 val check_pre_alloc : pool -> bool 
+val recv_stall : unit -> bool
 (* This operation always allocates from the Recv pool. *)
 val advance_and_sub_alloc : pool -> len (*total_len*) -> ofs -> len -> t
 
+(* For receiving several packets into the current chunk at once.
+ * [prealloc_slots] is the number of max_msg_size slots left in it,
+ * and [prealloc_room] the number of bytes.
+ * [sub_alloc pool ofs len] takes an iovec at offset [ofs] from the
+ * current position, and [advance pool len] moves past the space used.
+ *)
+val prealloc_slots : pool -> int
+val prealloc_room : pool -> int
+val sub_alloc : pool -> ofs -> len -> t
+val advance : pool -> len -> unit
+
 val s : alloc_state
 (**************************************************************)
@@ -46,5 +46,71 @@ let md5_update_iov ctx iov =
   md5_update_iov ctx iov
 
 (**************************************************************)
+(* The maximal packet size is kept both here and on the C side.
+ *)
+external c_set_max_msg_size : int -> unit 
+  = "skt_set_max_msg_size" "noalloc"
 
+let set_max_msg_size size = 
+  Socksupp.set_max_msg_size size ;
+  c_set_max_msg_size size
 
+(**************************************************************)
+(* Statistics for the multi-destination UDP send path. The C
+ * side fills an array with [calls; dests; syscalls; fallbacks]
+ * followed by a histogram of destinations per system call.
+ *)
+external udp_mu_send_stats : int array -> unit
+  = "skt_udp_mu_send_stats" "noalloc"
+
+let batch_buckets = [|"1";"2-3";"4-7";"8-15";"16-31";"32-63";">=64"|]
+
+let udp_mu_send_stats () =
+  let a = Array.create (4 + Array.length batch_buckets) 0 in
+  udp_mu_send_stats a ;
+  let calls = a.(0) and dests = a.(1) and syscalls = a.(2) in
+  let hist = 
+    Array.mapi (fun i b -> Printf.sprintf "%s:%d" b a.(4+i)) batch_buckets in
+  Printf.sprintf "calls=%d dests=%d syscalls=%d dests/syscall=%.1f fallbacks=%d batches=[%s]"
+    calls dests syscalls 
+    (if syscalls = 0 then 0.0 else (float dests) /. (float syscalls))
+    a.(3)
+    (String.concat " " (Array.to_list hist))
+
+(* Statistics for the UDP receive path. The C side fills an
+ * array with [enabled; packets; delay_sum; delay_max; drops;
+ * discards] followed by a histogram of queueing delays, all
+ * delays in microseconds. Drops are counted by the kernel,
+ * discards are packets read but thrown away on our side.
+ *)
+external udp_rx_stats : int array -> unit
+  = "skt_udp_rx_stats" "noalloc"
+
+let delay_buckets = 16
+
+let udp_rx_counters () =
+  let a = Array.create (6 + delay_buckets) 0 in
+  udp_rx_stats a ;
+  a
+
+let udp_rx_drops () =
+  let a = udp_rx_counters () in
+  a.(4) + a.(5)
+
+let udp_rx_stats () =
+  let a = udp_rx_counters () in
+  if a.(0) = 0 then "disabled" else (
+    let packets = a.(1) in
+    let hist = 
+      Array.init delay_buckets (fun i ->
+	let lo = if i = 0 then 0 else 1 lsl i in
+	Printf.sprintf "%d:%d" lo a.(6+i))
+    in
+    Printf.sprintf "packets=%d delay_avg=%.1fus delay_max=%dus drops=%d discards=%d delays=[%s]"
+      packets
+      (if packets = 0 then 0.0 else (float a.(2)) /. (float packets))
+      a.(3) a.(4) a.(5)
+      (String.concat " " (Array.to_list hist))
+  )
+
+(**************************************************************)
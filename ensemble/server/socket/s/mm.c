@@ -7,27 +7,137 @@
 #include "skt.h"
 /**************************************************************/
 
-static value mm_Val_cbuf (char *buf)
+/* A cbuf is an abstract block holding a pointer, and what to do
+ * with it when it is freed: the malloc'd buffers are freed, the
+ * parts of a region are not, and a region is unmapped as a
+ * whole.  For a region, the length and the flags it was mapped
+ * with are kept as well.
+ */
+#define MM_MALLOC      (0)
+#define MM_REGION_PART (1)
+#define MM_REGION      (2)
+
+#define mm_Cbuf_kind(cbuf_v)  (Field(cbuf_v,1))
+#define mm_Cbuf_len(cbuf_v)   (Field(cbuf_v,2))
+#define mm_Cbuf_flags(cbuf_v) (Field(cbuf_v,3))
+
+/* Flags for mm_region_alloc. The first two are requested by ML,
+ * all of them are returned by mm_region_flags.
+ */
+#define MM_HUGETLB   (1)	/* mapped with explicit huge pages */
+#define MM_MLOCK     (2)	/* locked in memory */
+#define MM_THP       (4)	/* advised for transparent huge pages */
+
+#define MM_HUGE_PAGE_SIZE (2*1024*1024)
+
+static value mm_Val_cbuf_kind (char *buf, int kind, long len, int flags)
 {
     CAMLparam0();
     CAMLlocal1(cbuf_v);
     
-    cbuf_v = alloc_small(1,Abstract_tag);
+    cbuf_v = alloc_small(4,Abstract_tag);
     Field(cbuf_v,0) = (value) buf;
+    mm_Cbuf_kind(cbuf_v) = (value) kind;
+    mm_Cbuf_len(cbuf_v) = (value) len;
+    mm_Cbuf_flags(cbuf_v) = (value) flags;
     
     CAMLreturn(cbuf_v);
 }
 
+static value mm_Val_cbuf (char *buf)
+{
+    return mm_Val_cbuf_kind(buf, MM_MALLOC, 0, 0);
+}
+
 value mm_cbuf_free(value cbuf_v)
 {
     char *buf = mm_Cbuf_val(cbuf_v);
-    if (buf != NULL) free(buf);
+
+    if (buf != NULL) {
+	switch (mm_Cbuf_kind(cbuf_v)) {
+	case MM_MALLOC:
+	    free(buf);
+	    break;
+	case MM_REGION:
+#ifdef HAS_MMAP
+	    munmap(buf, (size_t) mm_Cbuf_len(cbuf_v));
+#else
+	    free(buf);
+#endif
+	    break;
+	default:
+	    break;
+	}
+    }
 
     // For extra sanitation
     mm_Cbuf_val(cbuf_v) = NULL;
     return Val_unit;
 }
 
+/* Allocate a region of [len] bytes for the chunks of a pool.
+ * With MM_HUGETLB, explicit huge pages are tried first, then
+ * ordinary memory advised for transparent huge pages.  With
+ * MM_MLOCK, the region is locked in memory.  Each of these is
+ * done where possible, and mm_region_flags tells which were.
+ */
+value mm_region_alloc(value len_v, value flags_v)
+{
+    long len = Long_val(len_v);
+    int flags = Int_val(flags_v);
+    int done = 0;
+    char *buf = NULL;
+    
+    SKTTRACE(("mm_region_alloc(%ld,%d) {", len, flags));
+#ifdef HAS_MMAP
+#ifdef MAP_HUGETLB
+    if (flags & MM_HUGETLB) {
+	long hlen = (len + MM_HUGE_PAGE_SIZE - 1) & ~((long)MM_HUGE_PAGE_SIZE - 1);
+	buf = mmap(NULL, hlen, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (buf == MAP_FAILED) {
+	    buf = NULL;
+	} else {
+	    len = hlen;
+	    done |= MM_HUGETLB;
+	}
+    }
+#endif
+    if (buf == NULL) {
+	buf = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED)
+	    raise_out_of_memory ();
+#ifdef MADV_HUGEPAGE
+	if ((flags & MM_HUGETLB) && madvise(buf, len, MADV_HUGEPAGE) == 0)
+	    done |= MM_THP;
+#endif
+    }
+    if ((flags & MM_MLOCK) && mlock(buf, len) == 0)
+	done |= MM_MLOCK;
+#else
+    buf = (char*) malloc(len);
+    if (buf == NULL)
+	raise_out_of_memory ();
+#endif
+    SKTTRACE(("}\n"));
+    return mm_Val_cbuf_kind(buf, MM_REGION, len, done);
+}
+
+/* A cbuf for the part of a region starting at [ofs]. It is not
+ * freed by itself, only with the region.
+ */
+value mm_region_sub(value region_v, value ofs_v)
+{
+    return mm_Val_cbuf_kind(mm_Cbuf_val(region_v) + Long_val(ofs_v),
+			    MM_REGION_PART, 0, 0);
+}
+
+value mm_region_flags(value region_v)
+{
+    return Val_int(mm_Cbuf_flags(region_v));
+}
+
 value mm_cbuf_alloc(value len_v)
 {
     int len;
@@ -94,6 +204,36 @@ value mm_copy_cbuf_ext_to_string(value src_cbuf_v, value src_ofs_v,
     return Val_unit;
 }
 
+/* Read a 16-bit integer in network order directly from a C
+ * buffer, as Buf.int16_of_substring does for strings.
+ */
+value mm_cbuf_int16(value cbuf_v, value ofs_v)
+{
+    unsigned char *p = (unsigned char*) mm_Cbuf_val(cbuf_v) + Int_val(ofs_v);
+    
+    return Val_int((p[0] << 8) | p[1]);
+}
+
+/* As above, a 32-bit integer, as Buf.read_int32.
+ */
+value mm_cbuf_int32(value cbuf_v, value ofs_v)
+{
+    unsigned char *p = (unsigned char*) mm_Cbuf_val(cbuf_v) + Int_val(ofs_v);
+    unsigned long i;
+    
+    i = ((unsigned long)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    return Val_long((long)i);
+}
+
+/* Compare the bytes of a C buffer at an offset with a string.
+ */
+value mm_cbuf_subeq(value cbuf_v, value ofs_v, value s_v)
+{
+    char *p = mm_Cbuf_val(cbuf_v) + Int_val(ofs_v);
+    
+    return Val_bool(memcmp(p, String_val(s_v), string_length(s_v)) == 0);
+}
+
 value mm_copy_string_to_cbuf_ext(value src_v, value src_ofs_v, 
                                  value dst_cbuf_v, value dst_ofs_v, value len_v)
 {
@@ -45,6 +45,15 @@ external select : select_info -> timeval -> int
 external poll : select_info -> int 
   = "skt_poll" "noalloc"
 
+(* Winsock has no persistent socket sets.
+ *)
+type epoll = unit
+
+let has_epoll () = false
+let epoll_create () = failwith "epoll_create: not supported on win32"
+let epoll_modify _ _ _ _ = failwith "epoll_modify: not supported on win32"
+let epoll_wait _ _ _ = failwith "epoll_wait: not supported on win32"
+
 (**************************************************************)
 
 external substring_eq : string -> ofs -> string -> ofs -> len -> bool 
@@ -186,6 +195,10 @@ let udp_mu_recv_packet pool sock ml_prealloc_buf=
         Ciovec.empty
     in
     len_s.ml_hdr_len, iov
+  ) else if Ciovec.recv_stall () then (
+    (* Backpressure, leave the packet in the kernel.
+     *)
+    0, Ciovec.empty
   ) else (
     (* Unoptimized path. 
      * 
@@ -201,9 +214,48 @@ let udp_mu_recv_packet pool sock ml_prealloc_buf=
 (*    print_string 
        "warning: Ensemble has run out of iovec memory, and is using the ML-heap\n";
     flush stdout;*)
-    udp_mu_recv_packet_into_str sock ml_prealloc_buf, Ciovec.empty
+    let ml_len = udp_mu_recv_packet_into_str sock ml_prealloc_buf in
+    if ml_len >|| 0 then Ciovec.note_fallback pool ;
+    ml_len, Ciovec.empty
   )
 
+(* Winsock has no batched receive, hand out one packet at a time.
+ *)
+(* There is no separate C path on win32, the ML header is copied
+ * into an iovec outside of the pool, which may be out of memory.
+ *)
+let udp_mu_recv_packet_iov pool sock ml_prealloc_buf = 
+  let mllen,iov = udp_mu_recv_packet pool sock ml_prealloc_buf in
+  if mllen =|| 0 then 
+    Ciovec.empty, iov
+  else
+    Ciovec.fresh_of_string ml_prealloc_buf 0 mllen, iov
+
+let udp_mu_recv_packets pool sock ml_prealloc_buf mllens iovs = 
+  let mllen,iov = udp_mu_recv_packet pool sock ml_prealloc_buf in
+  mllens.(0) <- mllen ;
+  iovs.(0) <- iov ;
+  1
+
+(* There is no segmentation offload on NT.
+ *)
+let udp_mu_recv_gro = udp_mu_recv_packets
+let udp_gro_pending _ = false
+let has_udp_gso () = false
+let udp_mu_sendsv_gso _ _ _ _ _ _ = false
+
+(* Nor io_uring.
+ *)
+type uring = unit
+let has_uring () = false
+let uring_create _ = failwith "uring_create"
+let uring_recv _ _ _ _ = failwith "uring_recv"
+let uring_recv_packet _ _ _ = failwith "uring_recv_packet"
+let uring_poll _ _ _ _ = failwith "uring_poll"
+let uring_cancel _ _ = failwith "uring_cancel"
+let uring_sendsv _ _ _ _ _ _ _ = failwith "uring_sendsv"
+let uring_wait _ _ _ = failwith "uring_wait"
+
 (**************************************************************)
 (* Operations for sending messages through TCP.
  * 1) Exceptions are thrown
@@ -256,6 +308,11 @@ external setsockopt_bsdcompat : socket -> bool -> unit
   = "skt_setsockopt_bsdcompat"
 external setsockopt_reuse : socket -> bool -> unit
   = "skt_setsockopt_reuse"
+let setsockopt_gro _ _ = false
+let getsockopt_gro _ = false
+let setsockopt_reuseport _ _ = false
+let getsockopt_drops _ = -1
+let setsockopt_rx_stats _ _ = false
 (**************************************************************)
 external win_version : unit -> string = "win_version"
 
@@ -294,12 +294,15 @@ value skt_udp_mu_sendsv(
     
     sock = info->sock ;
     naddr = info->naddr ;
+    skt_send_stats.calls++ ;
+    skt_send_stats.dests += naddr ;
     
     for (i=0;i<naddr;i++) {
 	/* Send the message.  Assume we don't block or get interrupted.  
 	 */
 	ret = WSASendTo(sock, send_iova, nvecs+2, &len, 0,
 			&info->sa[i], info->addrlen, 0, NULL);
+	skt_send_stats_batch(1);
 /*	{
 	    int j;
 	    struct sockaddr_in *addr = (struct sockaddr_in*) &info->sa[i];
@@ -328,7 +331,7 @@ value skt_udp_mu_recv_packet_into_str(value sock_v, value buf_v)
     
     SKTTRACE(("skt_udp_mu_recv_packet_into_str("));
 
-    len = recvfrom(sock, buf, MAX_MSG_SIZE, 0, NULL, 0);
+    len = recvfrom(sock, buf, skt_max_msg_size, 0, NULL, 0);
     if (-1 == len) {
 	skt_udp_error("skt_udp_recv_packet_into_str");
 	goto dump_packet;
@@ -342,7 +345,7 @@ value skt_udp_mu_recv_packet_into_str(value sock_v, value buf_v)
 
     // A bogus packet, or a packet with a non-empty iovec.
     if (usr_len > 0 ||
-        ml_len > (int)(MAX_MSG_SIZE-HEADER_PEEK) ||
+        ml_len > (int)(skt_max_msg_size-HEADER_PEEK) ||
         0 == ml_len)
 	goto dump_packet;
 
@@ -381,11 +384,11 @@ void skt_udp_mu_recv_packet(
 	int from_len = sizeof(struct sockaddr_in);
 	memset((char*)&from, 0, sizeof(struct sockaddr_in));
         
-	len = recvfrom(sock, buf, MAX_MSG_SIZE, 0, (struct sockaddr*)&from, &from_len);
+	len = recvfrom(sock, buf, skt_max_msg_size, 0, (struct sockaddr*)&from, &from_len);
 	SKTTRACE(("from=(%d,%s)", ntohs(from.sin_port), inet_ntoa(from.sin_addr)));
         }  */
     
-    len = recvfrom(sock, buf, MAX_MSG_SIZE, 0, NULL, 0);
+    len = recvfrom(sock, buf, skt_max_msg_size, 0, NULL, 0);
     if (-1 == len) {
 	skt_udp_error("skt_udp_recv_packet");
 	goto dump_packet;
@@ -398,7 +401,7 @@ void skt_udp_mu_recv_packet(
     usr_len = ntohl (*(uint32*) &(buf[SIZE_INT32]));
     
     // A bogus packet, dump it.
-    if (ml_len + usr_len > (int)(MAX_MSG_SIZE-HEADER_PEEK) ||
+    if (ml_len + usr_len > (int)(skt_max_msg_size-HEADER_PEEK) ||
         (ml_len ==0 && usr_len ==0))
 	goto dump_packet;
     
@@ -130,12 +130,85 @@ INLINE static skt_sendto_info_t *skt_Sendto_info_val(value info_v)
 
 value skt_Val_create_sendto_info( value sock_v, value sina_v);
 
+/* Counters for the multi-destination send path. Updated by
+ * skt_udp_mu_sendsv, read from ML with skt_udp_mu_send_stats.
+ *
+ * The batch histogram counts system calls by the number of
+ * destinations they carried: [1] [2-3] [4-7] ... [>=64].
+ */
+#define SKT_BATCH_BUCKETS (7)
+
+typedef struct skt_send_stats_t {
+    int calls ;           /* calls to skt_udp_mu_sendsv */
+    int dests ;           /* destinations sent to */
+    int syscalls ;        /* system calls issued */
+    int fallbacks ;       /* destinations resent one-by-one after a short batch */
+    int batch[SKT_BATCH_BUCKETS] ;
+} skt_send_stats_t ;
+
+extern skt_send_stats_t skt_send_stats ;
+
+INLINE static void skt_send_stats_batch(int n)
+{
+    int b = 0;
+
+    skt_send_stats.syscalls++ ;
+    while (n > 1 && b < SKT_BATCH_BUCKETS-1) {
+	n >>= 1;
+	b++;
+    }
+    skt_send_stats.batch[b]++ ;
+}
+
+/* Counters for the UDP receive path, kept for sockets with
+ * kernel receive timestamps and drop counts enabled (see
+ * skt_setsockopt_rx_stats). Read from ML with skt_udp_rx_stats.
+ *
+ * The delay histogram counts packets by the time they waited
+ * in the socket queue, in microseconds: [<2] [2-3] [4-7] ...
+ * [>=32768].
+ */
+#define SKT_DELAY_BUCKETS (16)
+
+typedef struct skt_rx_stats_t {
+    int enabled ;         /* set once a socket has them enabled */
+    long packets ;        /* packets with a kernel timestamp */
+    long delay_sum ;      /* their total delay, in microseconds */
+    long delay_max ;
+    long drops ;          /* packets dropped by the kernel */
+    long discards ;       /* packets dropped here, see recv_gro */
+    long delay[SKT_DELAY_BUCKETS] ;
+} skt_rx_stats_t ;
+
+extern skt_rx_stats_t skt_rx_stats ;
+
+INLINE static void skt_rx_stats_delay(long us, int n)
+{
+    int b = 0;
+    long d = us;
+
+    if (d < 0) d = 0;
+    skt_rx_stats.packets += n ;
+    skt_rx_stats.delay_sum += n * d ;
+    if (d > skt_rx_stats.delay_max)
+	skt_rx_stats.delay_max = d ;
+    while (d > 1 && b < SKT_DELAY_BUCKETS-1) {
+	d >>= 1;
+	b++;
+    }
+    skt_rx_stats.delay[b] += n ;
+}
+
 
 /**************************************************************/
-/* BUG:
- * This MUST be the same as Buf.max_msg_len
+/* The maximal size of a packet. This MUST be the same as
+ * Socksupp.max_msg_size, and is set from there with
+ * skt_set_max_msg_size. MAX_MSG_SIZE is the default.
  */
 #define MAX_MSG_SIZE     (8*1024)
+#define MAX_MSG_SIZE_LIMIT (65507)
+
+extern int skt_max_msg_size ;
 
 /**************************************************************/
 
@@ -205,6 +278,26 @@ static INLINE void skt_add_ml_hdr(mm_iovec_t iov_a[], int pos,
     Iov_buf(iov_a[pos]) = (char*) &Byte(prefix_v,Int_val(ofs_v)) ;
 }
 
+/* Check the length header of a received packet. Returns 1 and
+ * the lengths of the ML and user parts if the packet is well
+ * formed, 0 if it should be dumped.
+ */
+static INLINE int skt_udp_check_packet(char *buf, int len, int *ml_len, int *usr_len)
+{
+    if (len <= 0 || len < HEADER_PEEK)
+	return 0;
+
+    *ml_len = ntohl (*(uint32*) &(buf[0]));
+    *usr_len = ntohl (*(uint32*) &(buf[SIZE_INT32]));
+
+    // A bogus packet, dump it.
+    if (*ml_len + *usr_len > (int)(skt_max_msg_size-HEADER_PEEK) ||
+        (*ml_len ==0 && *usr_len ==0))
+	return 0;
+
+    return 1;
+}
+
 /**************************************************************/
 #endif
 
@@ -117,4 +117,57 @@ value skt_Val_create_sendto_info(
 
 /**************************************************************/
 
+int skt_max_msg_size = MAX_MSG_SIZE ;
+
+value skt_set_max_msg_size(value size_v)
+{
+    int size = Int_val(size_v);
+    
+    assert(size > 0 && size <= MAX_MSG_SIZE_LIMIT);
+    skt_max_msg_size = size;
+    return Val_unit;
+}
+
+/**************************************************************/
+
+skt_send_stats_t skt_send_stats ;
+
+/* Copy the send counters into a preallocated ML int array of
+ * length (4 + SKT_BATCH_BUCKETS).
+ */
+value skt_udp_mu_send_stats(value stats_v)
+{
+    int i;
+
+    Field(stats_v, 0) = Val_int(skt_send_stats.calls);
+    Field(stats_v, 1) = Val_int(skt_send_stats.dests);
+    Field(stats_v, 2) = Val_int(skt_send_stats.syscalls);
+    Field(stats_v, 3) = Val_int(skt_send_stats.fallbacks);
+    for (i=0; i<SKT_BATCH_BUCKETS; i++)
+	Field(stats_v, 4+i) = Val_int(skt_send_stats.batch[i]);
+    return Val_unit;
+}
+
+skt_rx_stats_t skt_rx_stats ;
+
+/* Copy the receive counters into a preallocated ML int array of
+ * length (6 + SKT_DELAY_BUCKETS).
+ */
+value skt_udp_rx_stats(value stats_v)
+{
+    int i;
+
+    Field(stats_v, 0) = Val_bool(skt_rx_stats.enabled);
+    Field(stats_v, 1) = Val_long(skt_rx_stats.packets);
+    Field(stats_v, 2) = Val_long(skt_rx_stats.delay_sum);
+    Field(stats_v, 3) = Val_long(skt_rx_stats.delay_max);
+    Field(stats_v, 4) = Val_long(skt_rx_stats.drops);
+    Field(stats_v, 5) = Val_long(skt_rx_stats.discards);
+    for (i=0; i<SKT_DELAY_BUCKETS; i++)
+	Field(stats_v, 6+i) = Val_long(skt_rx_stats.delay[i]);
+    return Val_unit;
+}
+
+/**************************************************************/
+
 
@@ -32,6 +32,8 @@ type os_t_v = Socksupp.os_t_v =
 exception Out_of_iovec_memory = Socksupp.Out_of_iovec_memory
 
 let max_msg_size = Socksupp.max_msg_size
+let max_msg_size_limit = Socksupp.max_msg_size_limit
+let set_max_msg_size = Common_impl.set_max_msg_size
 let is_unix = Socksupp.is_unix
 (**************************************************************)
 
@@ -91,6 +93,22 @@ type select_info = Comm_impl.select_info
 let select_info = Comm_impl.select_info
 let select  = Comm_impl.select 
 let poll  = Comm_impl.poll 
+
+type epoll = Comm_impl.epoll
+let has_epoll = Comm_impl.has_epoll
+let epoll_create = Comm_impl.epoll_create
+let epoll_modify = Comm_impl.epoll_modify
+let epoll_wait = Comm_impl.epoll_wait
+
+type uring = Comm_impl.uring
+let has_uring = Comm_impl.has_uring
+let uring_create = Comm_impl.uring_create
+let uring_recv = Comm_impl.uring_recv
+let uring_recv_packet = Comm_impl.uring_recv_packet
+let uring_poll = Comm_impl.uring_poll
+let uring_cancel = Comm_impl.uring_cancel
+let uring_sendsv = Comm_impl.uring_sendsv
+let uring_wait = Comm_impl.uring_wait
   
 let substring_eq  = Comm_impl.substring_eq
   
@@ -101,8 +119,17 @@ let sendto_info  = Comm_impl.sendto_info
   
 let udp_send = Comm_impl.udp_send
 let udp_mu_sendsv = Comm_impl.udp_mu_sendsv
+let udp_mu_send_stats = Common_impl.udp_mu_send_stats
+let udp_rx_stats = Common_impl.udp_rx_stats
+let udp_rx_drops = Common_impl.udp_rx_drops
+let has_udp_gso = Comm_impl.has_udp_gso
+let udp_mu_sendsv_gso = Comm_impl.udp_mu_sendsv_gso
 
 let udp_mu_recv_packet  = Comm_impl.udp_mu_recv_packet 
+let udp_mu_recv_packets = Comm_impl.udp_mu_recv_packets
+let udp_mu_recv_packet_iov = Comm_impl.udp_mu_recv_packet_iov
+let udp_mu_recv_gro = Comm_impl.udp_mu_recv_gro
+let udp_gro_pending = Comm_impl.udp_gro_pending
   
 let tcp_send  = Comm_impl.tcp_send
 let tcp_sendv  = Comm_impl.tcp_sendv
@@ -124,6 +151,11 @@ let setsockopt_recvbuf = Comm_impl.setsockopt_recvbuf
 let setsockopt_nonblock = Comm_impl.setsockopt_nonblock 
 let setsockopt_bsdcompat = Comm_impl.setsockopt_bsdcompat 
 let setsockopt_reuse = Comm_impl.setsockopt_reuse 
+let setsockopt_gro = Comm_impl.setsockopt_gro
+let getsockopt_gro = Comm_impl.getsockopt_gro
+let setsockopt_reuseport = Comm_impl.setsockopt_reuseport
+let getsockopt_drops = Comm_impl.getsockopt_drops
+let setsockopt_rx_stats = Comm_impl.setsockopt_rx_stats
   
 let os_type_and_version = Comm_impl.os_type_and_version
 
@@ -61,6 +61,19 @@ let select_info a b c =
   let max = succ (max am (max bm cm)) in
   (a,b,c,max)
 
+(* Persistent socket sets, see select.c.
+ *)
+type epoll = int
+
+external has_epoll : unit -> bool 
+  = "skt_has_epoll" "noalloc"
+external epoll_create : unit -> epoll 
+  = "skt_epoll_create"
+external epoll_modify : epoll -> socket -> int -> int -> unit 
+  = "skt_epoll_ctl"
+external epoll_wait : epoll -> int array -> timeval -> int 
+  = "skt_epoll_wait" "noalloc"
+
 (**************************************************************)
 
 external substring_eq : string -> ofs -> string -> ofs -> len -> bool 
@@ -153,6 +166,10 @@ let udp_mu_recv_packet pool sock ml_prealloc_buf=
         Ciovec.empty
     in
     len_s.ml_hdr_len, iov
+  ) else if Ciovec.recv_stall () then (
+    (* Backpressure, leave the packet in the kernel.
+     *)
+    0, Ciovec.empty
   ) else (
     (* Unoptimized path. 
      * 
@@ -163,9 +180,242 @@ let udp_mu_recv_packet pool sock ml_prealloc_buf=
 (*    print_string 
        "warning: Ensemble has run out of iovec memory, and is using the ML-heap\n";
     flush stdout;*)
-    udp_mu_recv_packet_into_str sock ml_prealloc_buf, Ciovec.empty
+    let ml_len = udp_mu_recv_packet_into_str sock ml_prealloc_buf in
+    if ml_len >|| 0 then Ciovec.note_fallback pool ;
+    ml_len, Ciovec.empty
   )    
 
+external udp_mu_recv_packet_nocopy : socket -> ret_len -> Ciovec.cbuf -> int -> unit
+  = "skt_udp_mu_recv_packet_nocopy" "noalloc"
+
+(* As above, but the ML header is left in the chunk, just before
+ * the bulk data.  Both are taken from the chunk before advancing
+ * past them.
+ *)
+let udp_mu_recv_packet_iov pool sock ml_prealloc_buf = 
+  if Ciovec.check_pre_alloc pool then (
+    let chunk = some_of pool.Ciovec.chunk in 
+    udp_mu_recv_packet_nocopy sock len_s chunk.Ciovec.cbuf pool.Ciovec.pos ;
+    let ml_len = len_s.ml_hdr_len in
+    let usr_len = len_s.iov_len in
+    if ml_len >|| 0 then (
+      let hdr = Ciovec.sub_alloc pool 8 ml_len in
+      let data = 
+	if usr_len >|| 0 then Ciovec.sub_alloc pool (8 +|| ml_len) usr_len
+	else Ciovec.empty
+      in
+      Ciovec.advance pool (8 +|| ml_len +|| usr_len) ;
+      hdr, data
+    ) else if usr_len >|| 0 then (
+      Ciovec.empty,
+      Ciovec.advance_and_sub_alloc pool (8 +|| usr_len) 8 usr_len
+    ) else (
+      Ciovec.empty, Ciovec.empty
+    )
+  ) else if Ciovec.recv_stall () then (
+    Ciovec.empty, Ciovec.empty
+  ) else (
+    (* Out of iovec space, see udp_mu_recv_packet.  The header
+     * is copied outside of the pool, which has just failed.
+     *)
+    let ml_len = udp_mu_recv_packet_into_str sock ml_prealloc_buf in
+    if ml_len >|| 0 then (
+      Ciovec.note_fallback pool ;
+      Ciovec.fresh_of_string ml_prealloc_buf 0 ml_len, Ciovec.empty
+    ) else 
+      Ciovec.empty, Ciovec.empty
+  )    
+
+external udp_mu_recv_packets : 
+  socket -> int -> int array -> string -> Ciovec.cbuf -> int -> int
+  = "skt_udp_mu_recv_packets_bytecode" "skt_udp_mu_recv_packets_native" "noalloc"
+
+(* Scratch space for the lengths returned by the C side, two
+ * entries per packet.
+ *)
+let lens_s = ref [||]
+
+(* Receive a batch of packets into consecutive max_msg_size slots
+ * of the current chunk. The slots of packets without iovec data
+ * are skipped over when advancing, and are wasted until the
+ * chunk is freed. Out of iovec space, [single] reads one packet.
+ *)
+let recv_packets_with recv single pool sock ml_prealloc_buf mllens iovs = 
+  let n = Array.length mllens in
+  if n >|| 1 && Ciovec.check_pre_alloc pool then (
+    let n = min n (Ciovec.prealloc_slots pool) in
+    if Array.length !lens_s <|| 2 *|| n then 
+      lens_s := Array.create (2 *|| n) 0 ;
+    let lens = !lens_s in
+    let chunk = some_of pool.Ciovec.chunk in
+    let got = 
+      recv sock n lens ml_prealloc_buf 
+	chunk.Ciovec.cbuf pool.Ciovec.pos 
+    in
+    let used = ref 0 in
+    for i = 0 to pred got do
+      let slot = i *|| max_msg_size () in
+      let ml_len = lens.(2 *|| i) in
+      let usr_len = lens.(2 *|| i +|| 1) in
+      mllens.(i) <- ml_len ;
+      iovs.(i) <- 
+	if usr_len >|| 0 then (
+	  used := slot +|| 8 +|| ml_len +|| usr_len ;
+	  Ciovec.sub_alloc pool (slot +|| 8 +|| ml_len) usr_len
+	) else 
+	  Ciovec.empty
+    done ;
+    if !used >|| 0 then 
+      Ciovec.advance pool !used ;
+    got
+  ) else (
+    let mllen,iov = single pool sock ml_prealloc_buf in
+    mllens.(0) <- mllen ;
+    iovs.(0) <- iov ;
+    1
+  )
+
+let udp_mu_recv_packets = 
+  recv_packets_with udp_mu_recv_packets udp_mu_recv_packet
+
+external udp_mu_recv_gro : 
+  socket -> int -> int array -> string -> Ciovec.cbuf -> int -> int -> int
+  = "skt_udp_mu_recv_gro_bytecode" "skt_udp_mu_recv_gro_native" "noalloc"
+
+external udp_mu_recv_gro_into_str : socket -> string -> int
+  = "skt_udp_mu_recv_gro_into_str" "noalloc"
+
+external udp_gro_pending : socket -> bool
+  = "skt_udp_gro_pending" "noalloc"
+
+(* The same, for a socket with UDP_GRO set. A single read may
+ * return several packets. Where the chunk has room for the whole
+ * read, the C side reads into it and returns where each packet's
+ * bulk data lies; otherwise it spreads the packets into the
+ * slots, keeping those that do not fit for the next calls. Out
+ * of iovec space, the packets of a coalesced read are taken one
+ * at a time into the ML buffer, as in udp_mu_recv_packet. Under
+ * backpressure nothing is taken, and the kept packets wait.
+ *)
+let udp_mu_recv_gro_single pool sock ml_prealloc_buf =
+  let ml_len = udp_mu_recv_gro_into_str sock ml_prealloc_buf in
+  if ml_len >|| 0 then Ciovec.note_fallback pool ;
+  ml_len, Ciovec.empty
+
+(* Three entries per packet: the lengths, and the offset of the
+ * bulk data.
+ *)
+let gro_lens_s = ref [||]
+
+let udp_mu_recv_gro_packets pool sock ml_prealloc_buf mllens iovs =
+  let n = Array.length mllens in
+  if n >|| 1 && Ciovec.check_pre_alloc pool then (
+    if Array.length !gro_lens_s <|| 3 *|| n then 
+      gro_lens_s := Array.create (3 *|| n) 0 ;
+    let lens = !gro_lens_s in
+    let chunk = some_of pool.Ciovec.chunk in
+    let got = 
+      udp_mu_recv_gro sock n lens ml_prealloc_buf 
+	chunk.Ciovec.cbuf pool.Ciovec.pos (Ciovec.prealloc_room pool)
+    in
+    let used = ref 0 in
+    for i = 0 to pred got do
+      let ml_len = lens.(3 *|| i) in
+      let usr_len = lens.(3 *|| i +|| 1) in
+      let ofs = lens.(3 *|| i +|| 2) in
+      mllens.(i) <- ml_len ;
+      iovs.(i) <- 
+	if usr_len >|| 0 then (
+	  used := max !used (ofs +|| usr_len) ;
+	  Ciovec.sub_alloc pool ofs usr_len
+	) else 
+	  Ciovec.empty
+    done ;
+    if !used >|| 0 then 
+      Ciovec.advance pool !used ;
+    got
+  ) else (
+    let mllen,iov = udp_mu_recv_gro_single pool sock ml_prealloc_buf in
+    mllens.(0) <- mllen ;
+    iovs.(0) <- iov ;
+    1
+  )
+
+let udp_mu_recv_gro pool sock ml_prealloc_buf mllens iovs =
+  if Ciovec.check_pre_alloc pool || not (Ciovec.recv_stall ()) then 
+    udp_mu_recv_gro_packets pool sock ml_prealloc_buf mllens iovs
+  else 0
+
+(**************************************************************)
+
+external has_udp_gso : unit -> bool
+  = "skt_has_udp_gso" "noalloc"
+
+external udp_mu_sendsv_gso : 
+  sendto_info -> buf -> int array -> Ciovec.t array array -> int -> len -> bool
+  = "skt_udp_mu_sendsv_gso_bytecode" "skt_udp_mu_sendsv_gso_native" "noalloc"
+
+(**************************************************************)
+(* Asynchronous operations with io_uring. See uring.c.
+ *)
+
+type uring
+
+external has_uring : unit -> bool
+  = "skt_has_uring" "noalloc"
+external uring_create : int -> uring
+  = "skt_uring_create"
+external uring_recv_post : uring -> socket -> Ciovec.t -> int -> bool
+  = "skt_uring_recv" "noalloc"
+external uring_poll : uring -> socket -> int -> int -> bool
+  = "skt_uring_poll" "noalloc"
+external uring_cancel : uring -> int -> bool
+  = "skt_uring_cancel" "noalloc"
+external uring_sendsv : uring -> sendto_info -> buf -> ofs -> len -> Ciovec.t array -> int -> int
+  = "skt_uring_sendsv_bytecode" "skt_uring_sendsv_native" "noalloc"
+external uring_wait : uring -> int array -> timeval -> int
+  = "skt_uring_wait" "noalloc"
+external uring_recv_parse : Ciovec.t -> int -> string -> ret_len -> unit
+  = "skt_uring_recv_parse" "noalloc"
+
+(* Reserve a max_msg_size slot at the end of the current chunk,
+ * and post a receive into it.  Returns the slot, or an empty
+ * iovec if there is no iovec memory or no space in the ring.
+ *)
+let uring_recv ring pool sock token =
+  if Ciovec.check_pre_alloc pool then (
+    let len = max_msg_size () in
+    let slot = Ciovec.advance_and_sub_alloc pool len 0 len in
+    if uring_recv_post ring sock slot token then 
+      slot
+    else (
+      Ciovec.free slot ;
+      Ciovec.empty
+    )
+  ) else
+    Ciovec.empty
+
+(* A receive into [slot] completed with [res].  As
+ * udp_mu_recv_packet, the ML header is copied into the
+ * preallocated buffer, and the bulk data is returned.  The slot
+ * is released.
+ *)
+let uring_recv_packet slot res ml_prealloc_buf =
+  let ret = 
+    if res >|| 0 then (
+      uring_recv_parse slot res ml_prealloc_buf len_s ;
+      let ml_len = len_s.ml_hdr_len in
+      let usr_len = len_s.iov_len in
+      if usr_len >|| 0 then
+	ml_len, Ciovec.sub slot (8 +|| ml_len) usr_len
+      else 
+	ml_len, Ciovec.empty
+    ) else 
+      0, Ciovec.empty
+  in
+  Ciovec.free slot ;
+  ret
+
 (**************************************************************)
 (* Receive messages into preallocated buffers. Exceptions are
  * thrown. 
@@ -222,6 +472,16 @@ external setsockopt_leave : socket -> Unix.inet_addr -> unit
   = "skt_setsockopt_leave" 
 external setsockopt_bsdcompat : socket -> bool -> unit
   = "skt_setsockopt_bsdcompat"
+external setsockopt_gro : socket -> bool -> bool
+  = "skt_setsockopt_gro"
+external getsockopt_gro : socket -> bool
+  = "skt_getsockopt_gro"
+external setsockopt_reuseport : socket -> bool -> bool
+  = "skt_setsockopt_reuseport"
+external getsockopt_drops : socket -> int
+  = "skt_getsockopt_drops"
+external setsockopt_rx_stats : socket -> bool -> bool
+  = "skt_setsockopt_rx_stats"
 
 (**************************************************************)
 
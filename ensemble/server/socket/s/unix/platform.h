@@ -31,6 +31,64 @@
 #include <unistd.h>
 #define h_errno errno
 
+/* Batched datagram calls (sendmmsg/recvmmsg) exist on Linux
+ * 2.6.33/3.0 and later. glibc declares them only with _GNU_SOURCE,
+ * which the files using them define before including skt.h.
+ */
+#if defined(__linux__) && defined(_GNU_SOURCE)
+#define HAS_MMSG
+#endif
+
+/* UDP segmentation offload (UDP_SEGMENT) and its receive side
+ * (UDP_GRO) exist on Linux 4.18/5.0 and later. Older C libraries
+ * do not define the option numbers. Whether the running kernel
+ * supports them is found out at run-time.
+ */
+#ifdef __linux__
+#include <netinet/udp.h>
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#define HAS_UDP_GSO
+#endif
+
+/* SO_REUSEPORT lets several sockets bind the same port, with
+ * the kernel spreading incoming packets among them (Linux 3.9).
+ * SO_MEMINFO reads the accounting of a socket, including its
+ * count of dropped packets (Linux 4.6).
+ */
+#ifdef __linux__
+#ifndef SO_REUSEPORT
+#define SO_REUSEPORT 15
+#endif
+#ifndef SO_MEMINFO
+#define SO_MEMINFO 55
+#endif
+#define SKT_MEMINFO_DROPS 8	/* SK_MEMINFO_DROPS in linux/sock_diag.h */
+#define SKT_MEMINFO_VARS 16	/* larger than SK_MEMINFO_VARS */
+#endif
+
+/* Kernel receive timestamps (SO_TIMESTAMPNS) and the count of
+ * packets dropped on a socket (SO_RXQ_OVFL), passed as ancillary
+ * data with each packet.
+ */
+#if defined(SO_TIMESTAMPNS) && defined(SO_RXQ_OVFL)
+#include <time.h>
+#define HAS_RX_STATS
+#endif
+
+/* Pool memory can be mapped in one region, with huge pages
+ * where available, and locked in memory.
+ */
+#include <sys/mman.h>
+#define HAS_MMAP
+
 union sock_addr_union {
   struct sockaddr s_gen;
   struct sockaddr_un s_unix;
@@ -118,3 +118,152 @@ value skt_poll(
     return Val_int(retcode) ;
 }
 
+/**************************************************************/
+/* Persistent event sets.
+ *
+ * On Linux, an epoll set is kept in the kernel, and sockets are
+ * added and removed one at a time as they come and go, instead of
+ * rebuilding an fd_set per call. There is no FD_SETSIZE limit.
+ *
+ * The events of a socket are a bit mask: SKT_EPOLL_RECV for
+ * reading, SKT_EPOLL_XMIT for writing.
+ */
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <limits.h>
+#define HAS_EPOLL 1
+#else
+#define HAS_EPOLL 0
+#endif
+
+#define SKT_EPOLL_RECV (1)
+#define SKT_EPOLL_XMIT (2)
+#define N_EPOLL_EVENTS (256)
+
+value skt_has_epoll(value unit_v)
+{
+    return Val_bool(HAS_EPOLL);
+}
+
+#if HAS_EPOLL
+static struct epoll_event epoll_events[N_EPOLL_EVENTS];
+
+value skt_epoll_create(value unit_v)
+{
+    int epfd;
+    
+    epfd = epoll_create(N_EPOLL_EVENTS);
+    if (-1 == epfd) serror("epoll_create");
+    return Val_int(epfd);
+}
+
+/* Change the events watched for [sock] from [old] to [new]. The
+ * socket is added to the set if [old] is empty, and removed from
+ * it if [new] is.
+ */
+value skt_epoll_ctl(
+    value epfd_v,
+    value sock_v,
+    value old_v,
+    value new_v
+    )
+{
+    struct epoll_event ev;
+    int old = Int_val(old_v);
+    int new = Int_val(new_v);
+    int op, ret;
+    
+    memset(&ev, 0, sizeof(ev));
+    if (new & SKT_EPOLL_RECV) ev.events |= EPOLLIN;
+    if (new & SKT_EPOLL_XMIT) ev.events |= EPOLLOUT;
+    ev.data.fd = Socket_val(sock_v);
+    
+    if (0 == old) op = EPOLL_CTL_ADD;
+    else if (0 == new) op = EPOLL_CTL_DEL;
+    else op = EPOLL_CTL_MOD;
+    
+    SKTTRACE(("skt_epoll_ctl(sock=%d old=%d new=%d)\n", ev.data.fd, old, new));
+    ret = epoll_ctl(Int_val(epfd_v), op, ev.data.fd, &ev);
+    
+    /* A closed socket has already left the set.
+     */
+    if (-1 == ret
+	&& !(op == EPOLL_CTL_DEL && (errno == EBADF || errno == ENOENT)))
+	serror("epoll_ctl");
+    return Val_unit;
+}
+
+/* Wait for the sockets in the set. For each ready socket,
+ * ((fd << 2) | events) is written into the preallocated [ready_v]
+ * array, and the number of ready sockets is returned. As with
+ * select, an error condition makes a socket ready for both reading
+ * and writing. The timeout is an Ensemble timeval, negative for
+ * blocking forever.
+ */
+value skt_epoll_wait(
+    value epfd_v,
+    value ready_v,
+    value timeout_v
+    )
+{
+    int i, n, max, ms, ev, events;
+    long sec10 = Long_val(Field(timeout_v,0));
+    long usec = Long_val(Field(timeout_v,1));
+    
+    max = Wosize_val(ready_v);
+    if (max > N_EPOLL_EVENTS) max = N_EPOLL_EVENTS;
+    
+    /* Round partial milliseconds up, so that we do not spin
+     * until a timer expires. Timeouts too long for an int, about
+     * 24 days, are cut down to INT_MAX milliseconds; the caller
+     * just waits again.
+     */
+    if (sec10 < 0 || usec < 0)
+	ms = -1;
+    else {
+	long long lms = (long long) sec10 * 10000 + (usec + 999) / 1000;
+	ms = lms > INT_MAX ? INT_MAX : (int) lms;
+    }
+    
+ again:
+    n = epoll_wait(Int_val(epfd_v), epoll_events, max, ms);
+    if (-1 == n) {
+	if (h_errno == EINTR)
+	    goto again ;
+	serror("epoll_wait");
+    }
+    
+    for (i=0; i<n; i++) {
+	ev = epoll_events[i].events;
+	events = 0;
+	if (ev & (EPOLLIN | EPOLLERR | EPOLLHUP)) events |= SKT_EPOLL_RECV;
+	if (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)) events |= SKT_EPOLL_XMIT;
+	Field(ready_v, i) = Val_int((epoll_events[i].data.fd << 2) | events);
+    }
+    
+    return Val_int(n);
+}
+
+#else
+
+value skt_epoll_create(value unit_v)
+{
+    failwith("epoll is not supported on this platform");
+    return Val_unit;
+}
+
+value skt_epoll_ctl(value epfd_v, value sock_v, value old_v, value new_v)
+{
+    failwith("epoll is not supported on this platform");
+    return Val_unit;
+}
+
+value skt_epoll_wait(value epfd_v, value ready_v, value timeout_v)
+{
+    failwith("epoll is not supported on this platform");
+    return Val_unit;
+}
+
+#endif
+
+/**************************************************************/
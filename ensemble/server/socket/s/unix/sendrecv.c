@@ -3,6 +3,9 @@
 /* Author: Ohad Rodeh  9/2001 */
 /* This is a complete rewrite of previous code by Mark Hayden */
 /**************************************************************/
+#ifdef __linux__
+#define _GNU_SOURCE		/* for sendmmsg/recvmmsg */
+#endif
 #include "skt.h"
 /**************************************************************/
 #define N_IOVS (100)
@@ -44,6 +47,15 @@ static struct msghdr send_msghdr = {
     0
 } ;
 
+#ifdef HAS_MMSG
+/* The maximal number of destinations handed to a single
+ * sendmmsg call.  Larger destination sets are sent in several
+ * batches.
+ */
+#define N_MMSG (64)
+static struct mmsghdr send_mmsg[N_MMSG];
+#endif
+
 /**************************************************************/
 /* TCP section
  */
@@ -273,6 +285,63 @@ value skt_udp_send(
 }
 
 
+/* Send the prepared [send_msghdr] to destinations [lo,hi) of [info],
+ * one sendmsg per destination.
+ */
+static void skt_udp_mu_send_each(skt_sendto_info_t *info, int lo, int hi)
+{
+    int i, ret;
+    
+    for (i=lo;i<hi;i++) {
+	/* Send the message.  Assume we don't block or get interrupted.  
+	 */
+	send_msghdr.msg_name = (char*) &info->sa[i] ;
+	ret = sendmsg(info->sock, &send_msghdr, MSG_DONTWAIT) ;
+	skt_send_stats_batch(1);
+	if (-1 == ret) skt_udp_error("skt_udp_mu_sendsv");
+    }
+}
+
+#ifdef HAS_MMSG
+/* Send the prepared [send_msghdr] to all the destinations of
+ * [info], up to N_MMSG of them per sendmmsg call. All the
+ * messages share the same gather array.
+ *
+ * sendmmsg stops at the first destination that fails. The
+ * rest of that batch is sent one-by-one, so that a single
+ * unreachable member does not starve the others. If the first
+ * destination failed, sendmmsg returns -1 and the error is
+ * reported here, so that destination is not tried again.
+ */
+static void skt_udp_mu_send_batch(skt_sendto_info_t *info)
+{
+    int i, j, n, ret;
+    int naddr = info->naddr ;
+    
+    for (i=0; i<naddr; i+=n) {
+	n = naddr - i;
+	if (n > N_MMSG) n = N_MMSG;
+	
+	for (j=0; j<n; j++) {
+	    send_mmsg[j].msg_hdr = send_msghdr;
+	    send_mmsg[j].msg_hdr.msg_name = (char*) &info->sa[i+j];
+	}
+	ret = sendmmsg(info->sock, send_mmsg, n, MSG_DONTWAIT);
+	skt_send_stats_batch(n);
+	SKTTRACE((" <batch=%d sent=%d>", n, ret));
+	
+	if (ret < n) {
+	    if (-1 == ret) {
+		skt_udp_error("skt_udp_mu_sendsv(sendmmsg)");
+		ret = 1;
+	    }
+	    skt_send_stats.fallbacks += n - ret;
+	    skt_udp_mu_send_each(info, i+ret, i+n);
+	}
+    }
+}
+#endif
+
 value skt_udp_mu_sendsv(
     value info_v,
     value prefix_v,
@@ -281,8 +350,6 @@ value skt_udp_mu_sendsv(
     value iova_v
     )
 {
-    int naddr=0, i, ret=0, len=0;
-    ocaml_skt_t sock=0 ;
     skt_sendto_info_t *info ;
     int nvecs = Wosize_val(iova_v) ;
     
@@ -294,32 +361,245 @@ value skt_udp_mu_sendsv(
     skt_add_ml_hdr(send_iova, 1, prefix_v, ofs_v, len_v);
     skt_gather(send_iova, 2, iova_v) ;
     
-    sock = info->sock ;
-    naddr = info->naddr ;
+    skt_send_stats.calls++ ;
+    skt_send_stats.dests += info->naddr ;
     
-    for (i=0;i<naddr;i++) {
-	/* Send the message.  Assume we don't block or get interrupted.  
-	 */
-	send_msghdr.msg_name = (char*) &info->sa[i] ;
-	ret = sendmsg(sock, &send_msghdr, MSG_DONTWAIT) ;
-/*	{
-	    int j;
-	    struct sockaddr_in *addr = (struct sockaddr_in*) &info->sa[i];
-	    
-	    for(j=0; j<nvecs+2; j++) {
-		SKTTRACE((" <iov[%d].len=%d> ", j, Iov_len(send_iova[j])));
-	    }
-	    SKTTRACE(("\n sock=%d  iovlen=%d sent_len=%d", sock, nvecs+2, len));
-	    SKTTRACE(("\n port=%d ip=%s", ntohs(addr->sin_port),
-		      inet_ntoa(addr->sin_addr)));
-                      }*/
-	if (-1 == ret) skt_udp_error("skt_udp_mu_sendsv");
-    }
+#ifdef HAS_MMSG
+    /* A single destination gains nothing from batching.
+     */
+    if (info->naddr > 1)
+	skt_udp_mu_send_batch(info);
+    else
+#endif
+	skt_udp_mu_send_each(info, 0, info->naddr);
     
     SKTTRACE((")\n"));
     return Val_unit;
 }
 
+/**************************************************************/
+/* UDP segmentation offload.
+ *
+ * A run of [n] packets for the same destinations is handed to the
+ * kernel as one buffer per destination, and is split into
+ * datagrams of [seg] bytes by the kernel or the NIC. All the
+ * packets but the last must be exactly [seg] bytes long,
+ * including their length header, so that each datagram on the
+ * wire is the same as if it had been sent with skt_udp_mu_sendsv.
+ *
+ * The ML header of packet k is at offset [ofs_lens.(2k)] in
+ * [prefix_v] and is [ofs_lens.(2k+1)] bytes long, its bulk data
+ * is [iovls.(k)].
+ *
+ * Returns false, without sending anything, if the run cannot be
+ * sent this way. The caller then sends the packets one at a time.
+ */
+#define N_GSO_SEGS (64)
+#define N_GSO_IOVS (1024)
+
+#ifdef HAS_UDP_GSO
+static mm_iovec_t gso_iova[N_GSO_IOVS];
+static char gso_peek_buf[N_GSO_SEGS][HEADER_PEEK];
+#endif
+
+/* platform.h defines UDP_SEGMENT for older headers, so probe
+ * the running kernel (Linux 4.18) once, on a scratch socket.
+ */
+value skt_has_udp_gso(void)
+{
+#ifdef HAS_UDP_GSO
+    static int has_gso = -1;
+    int sock, seg = 1024;
+
+    if (has_gso < 0) {
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	has_gso = (sock >= 0 &&
+		   0 == setsockopt(sock, SOL_UDP, UDP_SEGMENT, (void*)&seg, sizeof(seg)));
+	if (sock >= 0)
+	    close(sock);
+    }
+    return Val_bool(has_gso);
+#else
+    return Val_false;
+#endif
+}
+
+value skt_udp_mu_sendsv_gso_native(
+    value info_v,
+    value prefix_v,
+    value ofs_lens_v,
+    value iovls_v,
+    value n_v,
+    value seg_v
+    )
+{
+#ifdef HAS_UDP_GSO
+    skt_sendto_info_t *info ;
+    struct msghdr msg ;
+    struct cmsghdr *cm ;
+    char control[CMSG_SPACE(sizeof(uint16_t))] ;
+    value iova_v ;
+    int n = Int_val(n_v) ;
+    int i, k, ret, ml_len, pos=0 ;
+
+    SKTTRACE(("skt_udp_mu_sendsv_gso(n=%d seg=%d", n, Int_val(seg_v)));
+    if (n > N_GSO_SEGS)
+	return Val_false;
+
+    for (k=0; k<n; k++) {
+	iova_v = Field(iovls_v, k) ;
+	if (pos + Wosize_val(iova_v) + 2 > N_GSO_IOVS)
+	    return Val_false;
+	ml_len = Int_val(Field(ofs_lens_v, 2*k+1)) ;
+	skt_prepare_send_header(gso_iova+pos, gso_peek_buf[k], ml_len, skt_iovl_len(iova_v));
+	skt_add_ml_hdr(gso_iova, pos+1, prefix_v, Field(ofs_lens_v, 2*k), Field(ofs_lens_v, 2*k+1));
+	skt_gather(gso_iova, pos+2, iova_v);
+	pos += Wosize_val(iova_v) + 2 ;
+    }
+
+    info = skt_Sendto_info_val(info_v);
+    memset(&msg, 0, sizeof(msg)) ;
+    msg.msg_namelen = info->addrlen ;
+    msg.msg_iov = gso_iova ;
+    msg.msg_iovlen = pos ;
+    msg.msg_control = control ;
+    msg.msg_controllen = sizeof(control) ;
+    cm = CMSG_FIRSTHDR(&msg) ;
+    cm->cmsg_level = SOL_UDP ;
+    cm->cmsg_type = UDP_SEGMENT ;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t)) ;
+    *((uint16_t*) CMSG_DATA(cm)) = (uint16_t) Int_val(seg_v) ;
+
+    for (i=0; i<info->naddr; i++) {
+	msg.msg_name = (char*) &info->sa[i] ;
+	ret = sendmsg(info->sock, &msg, MSG_DONTWAIT) ;
+	skt_send_stats_batch(1);
+	if (-1 == ret) {
+	    /* The kernel or the device does not support this
+	     * segment size; nothing has been sent yet.
+	     */
+	    if (0 == i &&
+		(EINVAL == errno || EIO == errno ||
+		 ENOPROTOOPT == errno || EOPNOTSUPP == errno)) {
+		SKTTRACE((" unsupported)\n"));
+		return Val_false;
+	    }
+	    skt_udp_error("skt_udp_mu_sendsv_gso");
+	}
+    }
+
+    skt_send_stats.calls += n ;
+    skt_send_stats.dests += n * info->naddr ;
+    SKTTRACE((")\n"));
+    return Val_true;
+#else
+    return Val_false;
+#endif
+}
+
+value skt_udp_mu_sendsv_gso_bytecode(value *argv, int argn)
+{
+    return skt_udp_mu_sendsv_gso_native(argv[0], argv[1], argv[2],
+					argv[3], argv[4], argv[5]);
+}
+
+/**************************************************************/
+/* Receive counters.  With SO_TIMESTAMPNS and SO_RXQ_OVFL set on
+ * a socket, each packet carries the time the kernel received it
+ * and the number of packets dropped on the socket so far.  The
+ * receive functions below pass a control buffer for these when
+ * some socket has them enabled, and add them to skt_rx_stats.
+ */
+#ifdef HAS_RX_STATS
+#define RX_CONTROL_SIZE \
+    (CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32)))
+
+/* The last drop count seen on each socket, as the kernel reports
+ * a running total.
+ */
+#define RX_OVFL_FDS (1024)
+static uint32 rx_ovfl_last[RX_OVFL_FDS];
+
+static char rx_control[RX_CONTROL_SIZE];
+#endif
+
+value skt_setsockopt_rx_stats(	/* ML */
+        value sock_v,
+	value bool_v
+) {
+#ifdef HAS_RX_STATS
+    int sock = Socket_val(sock_v);
+    int flag = Bool_val(bool_v);
+
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &flag, sizeof(flag)) < 0 ||
+	setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &flag, sizeof(flag)) < 0)
+	return Val_false;
+    if (sock < RX_OVFL_FDS)
+	rx_ovfl_last[sock] = 0;
+    if (flag)
+	skt_rx_stats.enabled = 1;
+    return Val_true;
+#else
+    return Val_false;
+#endif
+}
+
+#ifdef HAS_RX_STATS
+/* Account for the ancillary data of a read that returned [n]
+ * packets, at time [now].
+ */
+static void skt_rx_account(int sock, struct msghdr *msg, struct timespec *now, int n)
+{
+    struct cmsghdr *cm;
+    struct timespec ts;
+    uint32 ovfl;
+
+    if (msg->msg_controllen == 0)
+	return;
+    for (cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR(msg, cm)) {
+	if (SOL_SOCKET != cm->cmsg_level)
+	    continue;
+	if (SCM_TIMESTAMPNS == cm->cmsg_type) {
+	    memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+	    skt_rx_stats_delay((now->tv_sec - ts.tv_sec) * 1000000L +
+			       (now->tv_nsec - ts.tv_nsec) / 1000, n);
+	} else if (SO_RXQ_OVFL == cm->cmsg_type) {
+	    memcpy(&ovfl, CMSG_DATA(cm), sizeof(ovfl));
+	    if (sock >= 0 && sock < RX_OVFL_FDS) {
+		skt_rx_stats.drops += (uint32)(ovfl - rx_ovfl_last[sock]);
+		rx_ovfl_last[sock] = ovfl;
+	    }
+	}
+    }
+}
+
+/* As recvfrom(sock, buf, len, 0, NULL, 0), keeping the counters.
+ */
+static int skt_rx_recv(int sock, char *buf, int len)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct timespec now;
+    int ret;
+
+    memset(&msg, 0, sizeof(msg));
+    Iov_buf(iov) = buf;
+    Iov_len(iov) = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = rx_control;
+    msg.msg_controllen = sizeof(rx_control);
+    ret = recvmsg(sock, &msg, 0);
+    if (ret >= 0) {
+	clock_gettime(CLOCK_REALTIME, &now);
+	skt_rx_account(sock, &msg, &now, 1);
+    }
+    return ret;
+}
+#endif
+
+/**************************************************************/
+
 /* Receive a UDP packet into a preallocated string
  */
 value skt_udp_mu_recv_packet_into_str(value sock_v, value buf_v)
@@ -330,7 +610,12 @@ value skt_udp_mu_recv_packet_into_str(value sock_v, value buf_v)
     
     SKTTRACE(("skt_udp_mu_recv_packet_into_str("));
 
-    len = recvfrom(sock, buf, MAX_MSG_SIZE, 0, NULL, 0);
+#ifdef HAS_RX_STATS
+    if (skt_rx_stats.enabled)
+	len = skt_rx_recv(sock, buf, skt_max_msg_size);
+    else
+#endif
+    len = recvfrom(sock, buf, skt_max_msg_size, 0, NULL, 0);
     if (-1 == len) {
 	skt_udp_error("skt_udp_recv_packet_into_str");
 	goto dump_packet;
@@ -344,7 +629,7 @@ value skt_udp_mu_recv_packet_into_str(value sock_v, value buf_v)
 
     // A bogus packet, or a packet with a non-empty iovec.
     if (usr_len > 0 ||
-        ml_len > (int)(MAX_MSG_SIZE-HEADER_PEEK) ||
+        ml_len > (int)(skt_max_msg_size-HEADER_PEEK) ||
         0 == ml_len)
 	goto dump_packet;
 
@@ -361,12 +646,13 @@ value skt_udp_mu_recv_packet_into_str(value sock_v, value buf_v)
     goto ret;
 }
 
-/* Receive a udp packet into a preallocated buffer.
+/* Receive a udp packet into the chunk at [ofs]. If [ml_buf] is
+ * not NULL, the ML header is copied into it.
  */
-void skt_udp_mu_recv_packet(
+static INLINE void skt_udp_mu_recv_packet_help(
     value sock_v,
     value ret_len_v,
-    value ml_buf_v,
+    char *ml_buf,
     value cbuf_v,
     value ofs_v
     )
@@ -383,30 +669,27 @@ void skt_udp_mu_recv_packet(
 	int from_len = sizeof(struct sockaddr_in);
 	memset((char*)&from, 0, sizeof(struct sockaddr_in));
         
-	len = recvfrom(sock, buf, MAX_MSG_SIZE, 0, (struct sockaddr*)&from, &from_len);
+	len = recvfrom(sock, buf, skt_max_msg_size, 0, (struct sockaddr*)&from, &from_len);
 	SKTTRACE(("from=(%d,%s)", ntohs(from.sin_port), inet_ntoa(from.sin_addr)));
         }  */
     
-    len = recvfrom(sock, buf, MAX_MSG_SIZE, 0, NULL, 0);
+#ifdef HAS_RX_STATS
+    if (skt_rx_stats.enabled)
+	len = skt_rx_recv(sock, buf, skt_max_msg_size);
+    else
+#endif
+    len = recvfrom(sock, buf, skt_max_msg_size, 0, NULL, 0);
     if (-1 == len) {
 	skt_udp_error("skt_udp_recv_packet");
 	goto dump_packet;
     }
 
-    if (0 == len || len < header_peek)
-	goto dump_packet;
-
-    ml_len = ntohl (*(uint32*) &(buf[0]));
-    usr_len = ntohl (*(uint32*) &(buf[SIZE_INT32]));
-    
-    // A bogus packet, dump it.
-    if (ml_len + usr_len > (int)(MAX_MSG_SIZE-HEADER_PEEK) ||
-        (ml_len ==0 && usr_len ==0))
+    if (!skt_udp_check_packet(buf, len, &ml_len, &usr_len))
 	goto dump_packet;
     
     // Copy the ML data into the preallocated ML buffer
-    if (ml_len > 0) 
-        memcpy(String_val(ml_buf_v), (char*)buf + HEADER_PEEK, ml_len);
+    if (ml_buf != NULL && ml_len > 0) 
+        memcpy(ml_buf, (char*)buf + HEADER_PEEK, ml_len);
 
     // Write the return length values
     Field(ret_len_v, 0) = Val_int(ml_len);
@@ -425,6 +708,372 @@ void skt_udp_mu_recv_packet(
     goto ret;
 }
 
+/* Receive a udp packet into a preallocated buffer.
+ */
+void skt_udp_mu_recv_packet(
+    value sock_v,
+    value ret_len_v,
+    value ml_buf_v,
+    value cbuf_v,
+    value ofs_v
+    )
+{
+    skt_udp_mu_recv_packet_help(sock_v, ret_len_v, String_val(ml_buf_v), cbuf_v, ofs_v);
+}
+
+/* Receive a udp packet, leaving the ML header in the chunk
+ * right after the length header, followed by the user data.
+ */
+void skt_udp_mu_recv_packet_nocopy(
+    value sock_v,
+    value ret_len_v,
+    value cbuf_v,
+    value ofs_v
+    )
+{
+    skt_udp_mu_recv_packet_help(sock_v, ret_len_v, NULL, cbuf_v, ofs_v);
+}
+
+/* Receive up to [n] udp packets with a single system call.
+ *
+ * Packet k is read into the chunk at offset (ofs + k*skt_max_msg_size),
+ * and its ML header is copied into the preallocated ML buffer at
+ * offset (k*skt_max_msg_size). The ML and user lengths of packet k are
+ * written into fields 2k and 2k+1 of [ret_lens_v], both are zero
+ * for a dumped packet.
+ *
+ * Returns the number of packets read, zero if none were waiting.
+ * Without recvmmsg, the socket is drained with one recvfrom per
+ * packet instead; it is non-blocking, so this stops when it is
+ * empty.
+ */
+#define N_RECV_MMSG (64)
+#ifdef HAS_MMSG
+static struct mmsghdr recv_mmsg[N_RECV_MMSG];
+static struct iovec recv_mmsg_iov[N_RECV_MMSG];
+#ifdef HAS_RX_STATS
+static char recv_mmsg_control[N_RECV_MMSG][RX_CONTROL_SIZE];
+#endif
+#endif
+
+value skt_udp_mu_recv_packets_native(
+    value sock_v,
+    value n_v,
+    value ret_lens_v,
+    value ml_buf_v,
+    value cbuf_v,
+    value ofs_v
+    )
+{
+    ocaml_skt_t sock = Socket_val(sock_v);
+    char *base = mm_Cbuf_val(cbuf_v) + Int_val(ofs_v);
+    char *buf;
+    int n = Int_val(n_v);
+    int i, len, got=0, usr_len=0, ml_len=0;
+    
+    SKTTRACE(("skt_udp_mu_recv_packets(n=%d", n));
+    if (n > N_RECV_MMSG) n = N_RECV_MMSG;
+    
+#ifdef HAS_MMSG
+    for (i=0; i<n; i++) {
+	Iov_buf(recv_mmsg_iov[i]) = base + i * skt_max_msg_size;
+	Iov_len(recv_mmsg_iov[i]) = skt_max_msg_size;
+	memset(&recv_mmsg[i].msg_hdr, 0, sizeof(struct msghdr));
+	recv_mmsg[i].msg_hdr.msg_iov = &recv_mmsg_iov[i];
+	recv_mmsg[i].msg_hdr.msg_iovlen = 1;
+#ifdef HAS_RX_STATS
+	if (skt_rx_stats.enabled) {
+	    recv_mmsg[i].msg_hdr.msg_control = recv_mmsg_control[i];
+	    recv_mmsg[i].msg_hdr.msg_controllen = RX_CONTROL_SIZE;
+	}
+#endif
+    }
+    got = recvmmsg(sock, recv_mmsg, n, MSG_DONTWAIT, NULL);
+    if (-1 == got) {
+	skt_udp_error("skt_udp_recv_packets");
+	got = 0;
+    }
+#ifdef HAS_RX_STATS
+    if (skt_rx_stats.enabled && got > 0) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	for (i=0; i<got; i++)
+	    skt_rx_account(sock, &recv_mmsg[i].msg_hdr, &now, 1);
+    }
+#endif
+#endif
+    
+    for (i=0; i<n; i++) {
+	buf = base + i * skt_max_msg_size;
+#ifdef HAS_MMSG
+	if (i >= got) break;
+	len = recv_mmsg[i].msg_len;
+#else
+#ifdef HAS_RX_STATS
+	if (skt_rx_stats.enabled)
+	    len = skt_rx_recv(sock, buf, skt_max_msg_size);
+	else
+#endif
+	len = recvfrom(sock, buf, skt_max_msg_size, 0, NULL, 0);
+	if (-1 == len) {
+	    skt_udp_error("skt_udp_recv_packets");
+	    break;
+	}
+	got++;
+#endif
+	if (skt_udp_check_packet(buf, len, &ml_len, &usr_len)) {
+	    if (ml_len > 0)
+		memcpy(String_val(ml_buf_v) + i * skt_max_msg_size,
+		       buf + HEADER_PEEK, ml_len);
+	} else {
+	    SKTTRACE(("<dump_packet>"));
+	    ml_len = 0;
+	    usr_len = 0;
+	}
+	Field(ret_lens_v, 2*i) = Val_int(ml_len);
+	Field(ret_lens_v, 2*i+1) = Val_int(usr_len);
+    }
+    
+    SKTTRACE((" got=%d)\n", got));
+    return Val_int(got);
+}
+
+value skt_udp_mu_recv_packets_bytecode(value *argv, int argn)
+{
+    return skt_udp_mu_recv_packets_native(argv[0], argv[1], argv[2],
+					  argv[3], argv[4], argv[5]);
+}
+
+/* As skt_udp_mu_recv_packets, for a socket with UDP_GRO set.
+ *
+ * A single read may return up to GRO_CNT_MAX packets from the same
+ * sender, all [seg] bytes long except the last. When the chunk has
+ * room for a whole read and [n] is large enough to take all its
+ * packets, the read goes straight into the chunk, and each packet's
+ * bulk data is returned where it lies. Otherwise the read goes into
+ * a static buffer, from which the packets are copied into the usual
+ * max_msg_size slots. Packets that do not fit in the slots are
+ * kept, and are returned by the following calls on the same socket
+ * before anything more is read from it; the caller should call
+ * again while skt_udp_gro_pending is true. Kept packets are lost
+ * only if another socket is read first, and are then counted with
+ * the discards in skt_rx_stats.
+ *
+ * [ret_lens_v] takes three entries per packet: the ML length, the
+ * user length, and the offset of the user data from [ofs_v].
+ */
+#ifdef HAS_UDP_GSO
+#define GRO_BUF_SIZE (65536)
+#define GRO_CNT_MAX (64)
+static char gro_buf[GRO_BUF_SIZE];
+
+static struct {
+    char *buf ;			/* where the read went */
+    ocaml_skt_t sock ;		/* the socket the buffer was read from */
+    int len ;			/* the length of the read */
+    int seg ;			/* the segment size */
+    int next ;			/* the next packet to return */
+    int count ;			/* the number of packets in the read */
+} gro_pend = { gro_buf, -1, 0, 0, 0, 0 } ;
+
+/* Whether packets read from [sock] are kept.
+ */
+static int skt_gro_kept(ocaml_skt_t sock)
+{
+    return gro_pend.sock == sock && gro_pend.next < gro_pend.count ;
+}
+
+/* Make sure there are packets from [sock], reading from it into
+ * [buf] if there are none left. Returns the number of packets left.
+ */
+static int skt_gro_fill(ocaml_skt_t sock, char *buf)
+{
+#ifdef HAS_RX_STATS
+    char control[CMSG_SPACE(sizeof(int)) + RX_CONTROL_SIZE] ;
+    struct timespec now ;
+#else
+    char control[CMSG_SPACE(sizeof(int))] ;
+#endif
+    struct msghdr msg ;
+    struct cmsghdr *cm ;
+    struct iovec iov ;
+    int len, seg ;
+
+    if (gro_pend.next < gro_pend.count) {
+	if (gro_pend.sock == sock)
+	    return gro_pend.count - gro_pend.next ;
+	SKTTRACE(("<discarded %d>", gro_pend.count - gro_pend.next));
+	skt_rx_stats.discards += gro_pend.count - gro_pend.next ;
+    }
+    gro_pend.next = 0 ;
+    gro_pend.count = 0 ;
+
+    memset(&msg, 0, sizeof(msg)) ;
+    Iov_buf(iov) = buf;
+    Iov_len(iov) = GRO_BUF_SIZE;
+    msg.msg_iov = &iov ;
+    msg.msg_iovlen = 1 ;
+    msg.msg_control = control ;
+    msg.msg_controllen = sizeof(control) ;
+
+    len = recvmsg(sock, &msg, MSG_DONTWAIT);
+    if (-1 == len) {
+	skt_udp_error("skt_udp_recv_gro");
+	return 0;
+    }
+
+    seg = len;
+    for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+	if (SOL_UDP == cm->cmsg_level && UDP_GRO == cm->cmsg_type)
+	    seg = *((int*) CMSG_DATA(cm)) ;
+    if (seg <= 0 || seg > skt_max_msg_size)
+	seg = len;
+
+    gro_pend.buf = buf ;
+    gro_pend.sock = sock ;
+    gro_pend.len = len ;
+    gro_pend.seg = seg ;
+    gro_pend.count = (len + seg - 1) / seg ;
+    if (0 == gro_pend.count) gro_pend.count = 1 ;
+#ifdef HAS_RX_STATS
+    if (skt_rx_stats.enabled) {
+	clock_gettime(CLOCK_REALTIME, &now);
+	skt_rx_account(sock, &msg, &now, gro_pend.count);
+    }
+#endif
+    return gro_pend.count ;
+}
+
+/* Take the next packet from the buffer, and check its length
+ * header. Returns NULL, and counts a discard, for a bogus or
+ * truncated packet.
+ */
+static char *skt_gro_next(int *ml_len, int *usr_len)
+{
+    int i = gro_pend.next++ ;
+    char *seg_buf = gro_pend.buf + i * gro_pend.seg ;
+    int plen = gro_pend.len - i * gro_pend.seg ;
+
+    if (plen > gro_pend.seg) plen = gro_pend.seg ;
+    if (skt_udp_check_packet(seg_buf, plen, ml_len, usr_len) &&
+	HEADER_PEEK + *ml_len + *usr_len <= plen)
+	return seg_buf ;
+    SKTTRACE(("<dump_packet>"));
+    skt_rx_stats.discards++ ;
+    *ml_len = 0 ;
+    *usr_len = 0 ;
+    return NULL ;
+}
+#endif
+
+value skt_udp_gro_pending(value sock_v)
+{
+#ifdef HAS_UDP_GSO
+    return Val_bool(skt_gro_kept(Socket_val(sock_v)));
+#else
+    return Val_false;
+#endif
+}
+
+value skt_udp_mu_recv_gro_native(
+    value sock_v,
+    value n_v,
+    value ret_lens_v,
+    value ml_buf_v,
+    value cbuf_v,
+    value ofs_v,
+    value room_v
+    )
+{
+#ifdef HAS_UDP_GSO
+    ocaml_skt_t sock = Socket_val(sock_v);
+    char *base = mm_Cbuf_val(cbuf_v) + Int_val(ofs_v);
+    char *seg_buf;
+    int n = Int_val(n_v);
+    int room = Int_val(room_v);
+    int i, got, direct, ofs=0, usr_len=0, ml_len=0;
+
+    SKTTRACE(("skt_udp_mu_recv_gro(n=%d", n));
+    direct = !skt_gro_kept(sock) && n >= GRO_CNT_MAX && room >= GRO_BUF_SIZE;
+    if (direct) {
+	got = skt_gro_fill(sock, base);
+    } else {
+	got = skt_gro_fill(sock, gro_buf);
+	if (n > room / skt_max_msg_size) n = room / skt_max_msg_size;
+    }
+    if (got > n) got = n;
+
+    for (i=0; i<got; i++) {
+	seg_buf = skt_gro_next(&ml_len, &usr_len);
+	if (seg_buf != NULL) {
+	    if (direct) {
+		ofs = seg_buf - base + HEADER_PEEK + ml_len;
+	    } else {
+		ofs = i * skt_max_msg_size;
+		memcpy(base + ofs, seg_buf + HEADER_PEEK + ml_len, usr_len);
+	    }
+	    if (ml_len > 0)
+		memcpy(String_val(ml_buf_v) + i * skt_max_msg_size,
+		       seg_buf + HEADER_PEEK, ml_len);
+	}
+	Field(ret_lens_v, 3*i) = Val_int(ml_len);
+	Field(ret_lens_v, 3*i+1) = Val_int(usr_len);
+	Field(ret_lens_v, 3*i+2) = Val_int(ofs);
+    }
+
+    /* Packets left in the chunk cannot be kept, as the caller
+     * reuses the space past those returned.
+     */
+    if (direct && gro_pend.next < gro_pend.count) {
+	SKTTRACE(("<discarded %d>", gro_pend.count - gro_pend.next));
+	skt_rx_stats.discards += gro_pend.count - gro_pend.next ;
+	gro_pend.next = gro_pend.count ;
+    }
+    
+    SKTTRACE((" got=%d direct=%d)\n", got, direct));
+    return Val_int(got);
+#else
+    return Val_int(0);
+#endif
+}
+
+/* As skt_udp_mu_recv_packet_into_str, for a socket with UDP_GRO
+ * set. Takes a single packet, keeping the rest of a coalesced
+ * read for the following calls. Packets with bulk data are
+ * dumped, and counted as discards.
+ */
+value skt_udp_mu_recv_gro_into_str(value sock_v, value buf_v)
+{
+#ifdef HAS_UDP_GSO
+    ocaml_skt_t sock = Socket_val(sock_v);
+    int usr_len=0, ml_len=0;
+    char *seg_buf;
+
+    SKTTRACE(("skt_udp_mu_recv_gro_into_str("));
+    if (0 == skt_gro_fill(sock, gro_buf))
+	return Val_int(0);
+    seg_buf = skt_gro_next(&ml_len, &usr_len);
+    if (NULL == seg_buf)
+	return Val_int(0);
+    if (usr_len > 0 || 0 == ml_len) {
+	SKTTRACE(("<dump_packet>)\n"));
+	skt_rx_stats.discards++ ;
+	return Val_int(0);
+    }
+    memcpy(String_val(buf_v), seg_buf + HEADER_PEEK, ml_len);
+    SKTTRACE((" ml_len=%d)\n", ml_len));
+    return Val_int(ml_len);
+#else
+    return Val_int(0);
+#endif
+}
+
+value skt_udp_mu_recv_gro_bytecode(value *argv, int argn)
+{
+    return skt_udp_mu_recv_gro_native(argv[0], argv[1], argv[2],
+				      argv[3], argv[4], argv[5], argv[6]);
+}
+
 /**************************************************************/
 
 
@@ -38,4 +38,84 @@ value skt_setsockopt_bsdcompat(	/* ML */
     return Val_unit ;
 }
 
+/* Ask the kernel to coalesce received UDP packets (UDP_GRO).
+ * Returns false if this is not supported, instead of raising an
+ * exception, since the caller just goes on without it.
+ */
+value skt_setsockopt_gro(	/* ML */
+        value sock_v,
+	value bool_v
+) {
+#ifdef HAS_UDP_GSO
+    int sock ;
+    int ret ;
+    int flag ;
+    sock = Socket_val(sock_v) ;
+    flag = Bool_val(bool_v) ;
+    ret = setsockopt(sock, SOL_UDP, UDP_GRO, &flag, sizeof(flag)) ;
+    return Val_bool(ret == 0) ;
+#else
+    return Val_false ;
+#endif
+}
+
+/* Whether UDP_GRO is set on the socket.
+ */
+value skt_getsockopt_gro(	/* ML */
+        value sock_v
+) {
+#ifdef HAS_UDP_GSO
+    int sock ;
+    int ret ;
+    int flag = 0 ;
+    socklen_t len = sizeof(flag) ;
+    sock = Socket_val(sock_v) ;
+    ret = getsockopt(sock, SOL_UDP, UDP_GRO, &flag, &len) ;
+    return Val_bool(ret == 0 && flag) ;
+#else
+    return Val_false ;
+#endif
+}
 
+/* Allow several sockets to bind the same port (SO_REUSEPORT).
+ * Returns false if this is not supported.
+ */
+value skt_setsockopt_reuseport(	/* ML */
+        value sock_v,
+	value bool_v
+) {
+#ifdef SO_REUSEPORT
+    int sock ;
+    int ret ;
+    int flag ;
+    sock = Socket_val(sock_v) ;
+    flag = Bool_val(bool_v) ;
+    ret = setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag)) ;
+    return Val_bool(ret == 0) ;
+#else
+    return Val_false ;
+#endif
+}
+
+/* The number of packets the kernel dropped on the socket,
+ * because its receive queue was full.  Returns -1 if this is
+ * not supported.
+ */
+value skt_getsockopt_drops(	/* ML */
+        value sock_v
+) {
+#ifdef SO_MEMINFO
+    int sock ;
+    int ret ;
+    uint32_t meminfo[SKT_MEMINFO_VARS] ;
+    socklen_t len = sizeof(meminfo) ;
+    sock = Socket_val(sock_v) ;
+    memset(meminfo, 0, sizeof(meminfo)) ;
+    ret = getsockopt(sock, SOL_SOCKET, SO_MEMINFO, meminfo, &len) ;
+    if (ret < 0 || len <= SKT_MEMINFO_DROPS * sizeof(uint32_t))
+	return Val_int(-1) ;
+    return Val_int(meminfo[SKT_MEMINFO_DROPS]) ;
+#else
+    return Val_int(-1) ;
+#endif
+}
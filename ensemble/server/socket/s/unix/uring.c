@@ -0,0 +1,536 @@
+/**************************************************************/
+/* URING.C: asynchronous socket operations with io_uring. */
+/**************************************************************/
+/* Notes:
+ * 1. The ring is set up with the raw system calls, there is no
+ *    dependency on liburing. Linux 5.11 or later is required,
+ *    for waiting with a timeout (IORING_FEAT_EXT_ARG).
+ * 2. Operations are queued, and handed to the kernel all at once
+ *    by skt_uring_wait, which also waits for completions. Each
+ *    operation carries a token chosen by ML, and its completion
+ *    is returned as a (token, result) pair.
+ * 3. A receive reads one packet into an iovec reserved by ML.
+ *    The iovec must be kept until the receive completes.
+ * 4. A send copies the length and ML headers and the
+ *    destinations, so that the ML buffer and the sendto_info may
+ *    be reused at once. The iovecs must be kept until the send
+ *    completes. A send to several destinations completes once,
+ *    after all of them.
+ * 5. Every request, including each destination of a send and
+ *    each cancellation, takes an entry of the submission queue
+ *    and later one of the completion queue. Requests are refused
+ *    when either would overflow, see skt_uring_space.
+ */
+/**************************************************************/
+#include "skt.h"
+/**************************************************************/
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <poll.h>
+#include <linux/io_uring.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(IORING_FEAT_EXT_ARG)
+#define HAS_URING 1
+#else
+#define HAS_URING 0
+#endif
+
+/* The low bits of the user data of a request tell what it is:
+ * receives and polls carry (token << 2), sends a pointer to their
+ * state with the low bit set, cancellations SKT_URING_CANCEL.
+ */
+#define SKT_URING_SEND (1)
+#define SKT_URING_CANCEL (2)
+
+#define SKT_URING_RECV (1)
+#define SKT_URING_XMIT (2)
+
+#if HAS_URING
+
+typedef struct skt_uring_t {
+    int fd ;
+    unsigned sq_entries ;
+    unsigned *sq_head ;
+    unsigned *sq_tail ;
+    unsigned *sq_mask ;
+    unsigned *sq_array ;
+    struct io_uring_sqe *sqes ;
+    unsigned *cq_head ;
+    unsigned *cq_tail ;
+    unsigned *cq_mask ;
+    struct io_uring_cqe *cqes ;
+    unsigned cq_entries ;
+    unsigned tail ;		/* tail of the queued requests */
+    unsigned inflight ;		/* requests whose completion is not reaped */
+} skt_uring_t ;
+
+/* The state of a send, kept until all its destinations have
+ * completed.
+ */
+typedef struct skt_uring_send_t {
+    int token ;
+    int refs ;
+    int res ;
+    char peek_buf[HEADER_PEEK] ;
+    mm_iovec_t iov[0] ;		/* followed by the messages, the
+				 * destinations and the ML header */
+} skt_uring_send_t ;
+
+#define Uring_val(ring_v) ((skt_uring_t*) Field(ring_v,0))
+
+static int skt_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    memset(p, 0, sizeof(*p));
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+value skt_has_uring(value unit_v)
+{
+    static int has = -1 ;
+    struct io_uring_params p ;
+    int fd ;
+
+    if (-1 == has) {
+	fd = skt_uring_setup(1, &p);
+	has = (fd >= 0 && (p.features & IORING_FEAT_EXT_ARG)) ;
+	if (fd >= 0) close(fd);
+    }
+    return Val_bool(has);
+}
+
+/* Unmap and close what skt_uring_create has set up so far.
+ */
+static void skt_uring_free(skt_uring_t *r, char *sq, size_t sq_size,
+			   char *cq, size_t cq_size, size_t sqes_size)
+{
+    if (NULL != r->sqes && MAP_FAILED != (void*) r->sqes)
+	munmap(r->sqes, sqes_size);
+    if (NULL != cq && MAP_FAILED != cq && cq != sq)
+	munmap(cq, cq_size);
+    if (NULL != sq && MAP_FAILED != sq)
+	munmap(sq, sq_size);
+    if (r->fd >= 0)
+	close(r->fd);
+    free(r);
+}
+
+value skt_uring_create(value entries_v)
+{
+    struct io_uring_params p ;
+    skt_uring_t *r ;
+    char *sq = NULL, *cq = NULL ;
+    size_t sq_size = 0, cq_size = 0, sqes_size = 0 ;
+    value ring_v ;
+
+    r = (skt_uring_t*) malloc(sizeof(skt_uring_t));
+    if (NULL == r) failwith("uring_create: out of memory");
+    memset(r, 0, sizeof(skt_uring_t));
+
+    r->fd = skt_uring_setup(Int_val(entries_v), &p);
+    if (r->fd < 0) goto fail;
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	if (cq_size > sq_size) sq_size = cq_size;
+	cq_size = sq_size;
+    }
+
+    sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	      r->fd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == sq) goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	cq = sq;
+    } else {
+	cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		  r->fd, IORING_OFF_CQ_RING);
+	if (MAP_FAILED == cq) goto fail;
+    }
+    r->sqes = mmap(NULL, sqes_size,
+		   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		   r->fd, IORING_OFF_SQES);
+    if (MAP_FAILED == (void*) r->sqes) goto fail;
+
+    r->sq_entries = p.sq_entries ;
+    r->cq_entries = p.cq_entries ;
+    r->sq_head = (unsigned*) (sq + p.sq_off.head);
+    r->sq_tail = (unsigned*) (sq + p.sq_off.tail);
+    r->sq_mask = (unsigned*) (sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*) (sq + p.sq_off.array);
+    r->cq_head = (unsigned*) (cq + p.cq_off.head);
+    r->cq_tail = (unsigned*) (cq + p.cq_off.tail);
+    r->cq_mask = (unsigned*) (cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+    r->tail = *r->sq_tail ;
+
+    /* The ring lives as long as the alarm, that is, as long as the
+     * process.
+     */
+    ring_v = alloc_small(1, Abstract_tag);
+    Field(ring_v, 0) = (value) r ;
+    return ring_v ;
+
+ fail:
+    /* serror reads errno, which the cleanup may change.
+     */
+    {
+	int err = errno ;
+	skt_uring_free(r, sq, sq_size, cq, cq_size, sqes_size);
+	errno = err ;
+    }
+    serror("io_uring_setup");
+    return Val_unit ;
+}
+
+/* The number of requests that can be queued: free entries in the
+ * submission queue, and room for their completions.
+ */
+static INLINE unsigned skt_uring_space(skt_uring_t *r)
+{
+    unsigned sq = r->sq_entries - (r->tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE));
+    unsigned cq = r->cq_entries - r->inflight ;
+
+    return (sq < cq) ? sq : cq ;
+}
+
+/* Queue a request. The caller checks that there is space.
+ */
+static INLINE struct io_uring_sqe *skt_uring_sqe(skt_uring_t *r)
+{
+    unsigned idx = r->tail & *r->sq_mask ;
+    struct io_uring_sqe *sqe = &r->sqes[idx] ;
+
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx ;
+    r->tail++ ;
+    r->inflight++ ;
+    return sqe ;
+}
+
+value skt_uring_recv(
+    value ring_v,
+    value sock_v,
+    value iov_v,
+    value token_v
+    )
+{
+    skt_uring_t *r = Uring_val(ring_v);
+    struct io_uring_sqe *sqe ;
+
+    if (0 == skt_uring_space(r))
+	return Val_false;
+    sqe = skt_uring_sqe(r);
+    sqe->opcode = IORING_OP_RECV ;
+    sqe->fd = Socket_val(sock_v) ;
+    sqe->addr = (unsigned long) mm_Cptr_of_iovec(iov_v) ;
+    sqe->len = mm_Len_of_iovec(iov_v) ;
+    sqe->user_data = ((__u64) Int_val(token_v)) << 2 ;
+    return Val_true;
+}
+
+/* Wait for a socket to become ready for reading (SKT_URING_RECV)
+ * or writing (SKT_URING_XMIT), once.
+ */
+value skt_uring_poll(
+    value ring_v,
+    value sock_v,
+    value events_v,
+    value token_v
+    )
+{
+    skt_uring_t *r = Uring_val(ring_v);
+    struct io_uring_sqe *sqe ;
+
+    if (0 == skt_uring_space(r))
+	return Val_false;
+    sqe = skt_uring_sqe(r);
+    sqe->opcode = IORING_OP_POLL_ADD ;
+    sqe->fd = Socket_val(sock_v) ;
+    sqe->poll32_events =
+	(Int_val(events_v) & SKT_URING_RECV) ? POLLIN : POLLOUT ;
+    sqe->user_data = ((__u64) Int_val(token_v)) << 2 ;
+    return Val_true;
+}
+
+/* Cancel a receive or a poll. It completes with -ECANCELED,
+ * unless it has completed already.
+ */
+value skt_uring_cancel(
+    value ring_v,
+    value token_v
+    )
+{
+    skt_uring_t *r = Uring_val(ring_v);
+    struct io_uring_sqe *sqe ;
+
+    if (0 == skt_uring_space(r))
+	return Val_false;
+    sqe = skt_uring_sqe(r);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL ;
+    sqe->fd = -1 ;
+    sqe->addr = ((__u64) Int_val(token_v)) << 2 ;
+    sqe->user_data = SKT_URING_CANCEL ;
+    return Val_true;
+}
+
+/* Queue a send to all the destinations of [info], in Ensemble
+ * format as skt_udp_mu_sendsv. Returns the number of destinations,
+ * or -1 if there is no space, in which case nothing is queued.
+ */
+value skt_uring_sendsv_native(
+    value ring_v,
+    value info_v,
+    value prefix_v,
+    value ofs_v,
+    value len_v,
+    value iova_v,
+    value token_v
+    )
+{
+    skt_uring_t *r = Uring_val(ring_v);
+    skt_sendto_info_t *info = skt_Sendto_info_val(info_v);
+    skt_uring_send_t *s ;
+    struct io_uring_sqe *sqe ;
+    struct msghdr *msgs ;
+    struct sockaddr *sa ;
+    char *ml ;
+    int naddr = info->naddr ;
+    int niov = Wosize_val(iova_v) + 2 ;
+    int ml_len = Int_val(len_v) ;
+    int i ;
+
+    SKTTRACE(("skt_uring_sendsv(naddr=%d", naddr));
+    if (0 == naddr)
+	return Val_int(0);
+    if (skt_uring_space(r) < (unsigned) naddr)
+	return Val_int(-1);
+
+    s = (skt_uring_send_t*) malloc(sizeof(skt_uring_send_t)
+				   + niov * sizeof(mm_iovec_t)
+				   + naddr * sizeof(struct msghdr)
+				   + naddr * sizeof(struct sockaddr)
+				   + ml_len);
+    if (NULL == s)
+	return Val_int(-1);
+    msgs = (struct msghdr*) (s->iov + niov) ;
+    sa = (struct sockaddr*) (msgs + naddr) ;
+    ml = (char*) (sa + naddr) ;
+
+    s->token = Int_val(token_v) ;
+    s->refs = naddr ;
+    s->res = 0 ;
+    memcpy(ml, &Byte(prefix_v, Int_val(ofs_v)), ml_len);
+    memcpy(sa, info->sa, naddr * sizeof(struct sockaddr));
+    skt_prepare_send_header(s->iov, s->peek_buf, ml_len, skt_iovl_len(iova_v));
+    Iov_len(s->iov[1]) = ml_len ;
+    Iov_buf(s->iov[1]) = ml ;
+    skt_gather(s->iov, 2, iova_v);
+
+    for (i=0; i<naddr; i++) {
+	memset(&msgs[i], 0, sizeof(struct msghdr));
+	msgs[i].msg_name = (char*) &sa[i] ;
+	msgs[i].msg_namelen = info->addrlen ;
+	msgs[i].msg_iov = s->iov ;
+	msgs[i].msg_iovlen = niov ;
+
+	sqe = skt_uring_sqe(r);
+	sqe->opcode = IORING_OP_SENDMSG ;
+	sqe->fd = info->sock ;
+	sqe->addr = (unsigned long) &msgs[i] ;
+	sqe->len = 1 ;
+	sqe->user_data = ((__u64) (unsigned long) s) | SKT_URING_SEND ;
+    }
+
+    skt_send_stats.calls++ ;
+    skt_send_stats.dests += naddr ;
+    SKTTRACE((")\n"));
+    return Val_int(naddr);
+}
+
+value skt_uring_sendsv_bytecode(value *argv, int argn)
+{
+    return skt_uring_sendsv_native(argv[0], argv[1], argv[2], argv[3],
+				   argv[4], argv[5], argv[6]);
+}
+
+/* Hand the queued requests to the kernel, and wait for at most
+ * [timeout] for completions. The timeout is an Ensemble timeval,
+ * negative for blocking forever. For each completion, the token
+ * and the result are written into the preallocated [ready_v]
+ * array, and the number of completions is returned.
+ */
+value skt_uring_wait(
+    value ring_v,
+    value ready_v,
+    value timeout_v
+    )
+{
+    skt_uring_t *r = Uring_val(ring_v);
+    struct io_uring_getevents_arg arg ;
+    struct __kernel_timespec ts ;
+    struct io_uring_cqe *cqe ;
+    skt_uring_send_t *s ;
+    long sec10 = Long_val(Field(timeout_v,0));
+    long usec = Long_val(Field(timeout_v,1));
+    unsigned head, tail, to_submit, wait ;
+    int n=0, max, ret, token, res ;
+    __u64 data ;
+
+    max = Wosize_val(ready_v) / 2 ;
+
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8 ;
+    if (sec10 < 0 || usec < 0) {
+	wait = 1 ;
+    } else if (0 == sec10 && 0 == usec) {
+	wait = 0 ;
+    } else {
+	wait = 1 ;
+	ts.tv_sec = sec10 * 10 + usec / 1000000 ;
+	ts.tv_nsec = (usec % 1000000) * 1000 ;
+	arg.ts = (__u64) (unsigned long) &ts ;
+    }
+
+    /* Do not wait if there are completions already.
+     */
+    if (*r->cq_head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+	wait = 0 ;
+
+    __atomic_store_n(r->sq_tail, r->tail, __ATOMIC_RELEASE);
+    to_submit = r->tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+
+    if (to_submit > 0 || wait) {
+	SKTTRACE(("skt_uring_wait(submit=%d wait=%d)\n", to_submit, wait));
+	ret = syscall(__NR_io_uring_enter, r->fd, to_submit, wait,
+		      IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+		      &arg, sizeof(arg));
+	if (-1 == ret
+	    && h_errno != EINTR && h_errno != ETIME
+	    && h_errno != EBUSY && h_errno != EAGAIN)
+	    serror("io_uring_enter");
+    }
+
+    head = *r->cq_head ;
+    tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail && n < max) {
+	cqe = &r->cqes[head & *r->cq_mask] ;
+	data = cqe->user_data ;
+	res = cqe->res ;
+	head++ ;
+	r->inflight-- ;
+
+	if (data & SKT_URING_SEND) {
+	    s = (skt_uring_send_t*) (unsigned long) (data & ~((__u64) SKT_URING_SEND)) ;
+	    if (res < 0) {
+		s->res = res ;
+		errno = -res ;
+		skt_udp_error("skt_uring_sendsv");
+	    }
+	    if (--s->refs > 0)
+		continue;
+	    token = s->token ;
+	    res = s->res ;
+	    free(s);
+	} else if (SKT_URING_CANCEL == data) {
+	    continue;
+	} else {
+	    token = (int) (data >> 2) ;
+	}
+
+	Field(ready_v, 2*n) = Val_int(token);
+	Field(ready_v, 2*n+1) = Val_int(res);
+	n++ ;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+
+    return Val_int(n);
+}
+
+#else
+
+value skt_has_uring(value unit_v)
+{
+    return Val_false;
+}
+
+value skt_uring_create(value entries_v)
+{
+    failwith("io_uring is not supported on this platform");
+    return Val_unit;
+}
+
+value skt_uring_recv(value ring_v, value sock_v, value iov_v, value token_v)
+{
+    failwith("io_uring is not supported on this platform");
+    return Val_unit;
+}
+
+value skt_uring_poll(value ring_v, value sock_v, value events_v, value token_v)
+{
+    failwith("io_uring is not supported on this platform");
+    return Val_unit;
+}
+
+value skt_uring_cancel(value ring_v, value token_v)
+{
+    failwith("io_uring is not supported on this platform");
+    return Val_unit;
+}
+
+value skt_uring_sendsv_native(value ring_v, value info_v, value prefix_v, value ofs_v,
+			      value len_v, value iova_v, value token_v)
+{
+    failwith("io_uring is not supported on this platform");
+    return Val_unit;
+}
+
+value skt_uring_sendsv_bytecode(value *argv, int argn)
+{
+    failwith("io_uring is not supported on this platform");
+    return Val_unit;
+}
+
+value skt_uring_wait(value ring_v, value ready_v, value timeout_v)
+{
+    failwith("io_uring is not supported on this platform");
+    return Val_unit;
+}
+
+#endif
+
+/* Parse a packet received into [iov_v] by skt_uring_recv, [len_v]
+ * bytes long. The ML header is copied into [ml_buf_v], and the
+ * lengths are written into [ret_len_v], both zero for a dumped
+ * packet.
+ */
+value skt_uring_recv_parse(
+    value iov_v,
+    value len_v,
+    value ml_buf_v,
+    value ret_len_v
+    )
+{
+    char *buf = mm_Cptr_of_iovec(iov_v);
+    int len = Int_val(len_v);
+    int ml_len=0, usr_len=0;
+
+    if (skt_udp_check_packet(buf, len, &ml_len, &usr_len)
+	&& HEADER_PEEK + ml_len + usr_len <= len) {
+	if (ml_len > 0)
+	    memcpy(String_val(ml_buf_v), buf + HEADER_PEEK, ml_len);
+    } else {
+	SKTTRACE(("skt_uring_recv_parse: <dump_packet>\n"));
+	ml_len = 0;
+	usr_len = 0;
+    }
+    Field(ret_len_v, 0) = Val_int(ml_len);
+    Field(ret_len_v, 1) = Val_int(usr_len);
+    return Val_unit;
+}
+
+/**************************************************************/
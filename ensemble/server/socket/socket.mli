@@ -6,7 +6,14 @@
 (*         Winsock2 support                   11/2001 *)
 (*         Rewrite                            12/2003 *)
 (**************************************************************)
-val max_msg_size : int
+(* The maximal size of a UDP packet, 8K by default.  It can be
+ * raised up to [max_msg_size_limit] for loopback and
+ * jumbo-frame networks, before any socket or iovec memory is
+ * used.  All processes in a group must use the same size.
+ *)
+val max_msg_size : unit -> int
+val max_msg_size_limit : int
+val set_max_msg_size : int -> unit
 
 type socket = Unix.file_descr
 type buf = string
@@ -42,6 +49,43 @@ module Iov : sig
 
   type pool
 
+  (* A limit on the memory held by one owner, see create_quota.
+   *)
+  type quota
+
+  (* A snapshot of a pool, see pool_stats.  Byte counts for
+   * its size and what is allocated, its chunks, allocations and
+   * receivers waiting for memory, times the pool grew and
+   * packets received into the ML heap, chunks in use by
+   * quarters of occupancy, and the age in seconds of the oldest
+   * chunk pinned by iovecs.
+   *)
+  type pool_stats = {
+    ps_name : string;
+    ps_size : int;
+    ps_chunks : int;
+    ps_free_chunks : int;
+    ps_allocated : int;
+    ps_pending : int;
+    ps_waiting : int;
+    ps_grows : int;
+    ps_fallbacks : int;
+    ps_occupancy : int array;
+    ps_oldest_pinned : float
+  }
+
+  (* Allocate iovecs from slabs of fixed-size objects, so that a
+   * retained iovec does not pin a whole chunk.  Retained received
+   * iovecs are compacted into slabs.  Must be called before init.
+   *)
+  val use_slabs : bool -> unit
+
+  (* [use_region hugepages mlock] maps the chunks of each pool in
+   * one region, backed by huge pages and/or locked in memory.
+   * Must be called before init.
+   *)
+  val use_region : bool -> bool -> unit
+
   (* initialize the memory-manager. 
    * [init verbose chunk_size max_mem_size send_pool_pcnt min_alloc_size incr_step]
    *)
@@ -60,6 +104,16 @@ module Iov : sig
    *)
   val string_of_t : t -> string 
   val string_of_t_full : string -> len -> t -> unit
+
+  (* Read a 16- or 32-bit integer in network order at an offset,
+   * without copying the iovec.
+   *)
+  val int16_of_sub : t -> ofs -> int
+  val int32_of_sub : t -> ofs -> int
+
+  (* Whether the bytes at an offset are those of a string.
+   *)
+  val subeq : t -> ofs -> string -> bool
   val t_of_string : pool -> string -> ofs -> len -> t
     
   val len : t -> int
@@ -72,6 +126,27 @@ module Iov : sig
 
   val satisfy_pending : unit -> unit
 
+  (* Backpressure on receives.  [set_recv_stall (Some stall)]: a
+   * receive that finds no iovec memory calls [stall ()], and if
+   * it returns true, reads nothing.  The caller should then stop
+   * reading until the function given to [recv_wait] is called.
+   *)
+  val set_recv_stall : (unit -> bool) option -> unit
+  val recv_wait : pool -> (unit -> unit) -> unit
+
+  (* Quotas.  [create_quota name limit] limits the iovecs charged
+   * to it to [limit] bytes, 0 for no limit.  Allocations through
+   * a quota are charged to it, and so are their subs and copies.
+   * [alloc_quota] raises Out_of_iovec_memory when over the quota,
+   * [alloc_async_quota] waits until it is not.  Quotas are
+   * reported by get_stats until released.
+   *)
+  val no_quota : quota
+  val create_quota : string -> int -> quota
+  val release_quota : quota -> unit
+  val alloc_quota : quota -> pool -> len -> t
+  val alloc_async_quota : quota -> pool -> len -> (t -> unit) -> unit
+
   val sub : t -> ofs -> len -> t
     
   (* Decrement the refount, and free the cbuf if the count
@@ -83,6 +158,15 @@ module Iov : sig
    *)
   val copy : t -> t 
 
+  (* Compaction of retained iovecs.  If [t] keeps a chunk that is
+   * otherwise mostly unused, [compact t] copies it elsewhere and
+   * frees it.  [compact_epoch] changes when a pool runs low on
+   * chunks.  Must be enabled with use_compaction or use_slabs.
+   *)
+  val use_compaction : bool -> unit
+  val compact : t -> t
+  val compact_epoch : unit -> int
+
   (* Flatten an iovec array into a single iovec.  Copying only
    * occurs if the array has more than 1 non-empty iovec.
    *)
@@ -101,9 +185,12 @@ module Iov : sig
    * is a problem, and checks for out-of-bounds problems. 
    *)
   val unmarshal : t -> 'a
+  val unmarshal_sub : t -> ofs -> len -> 'a
 
   (* statistics *)
   val get_stats : unit -> string
+  val pool_stats : unit -> pool_stats list
+  val string_of_pool_stats : pool_stats -> string
 
 end
   
@@ -127,6 +214,23 @@ val select_info : sock_info -> sock_info -> sock_info -> select_info
 val select : select_info -> timeval -> int
 val poll : select_info -> int
 
+(* Persistent socket sets.  Where supported (epoll on Linux),
+ * the set is kept by the kernel, and sockets are added and
+ * removed one at a time.  The events watched for a socket are
+ * a bit mask: 1 for reading, 2 for writing.
+ * 
+ * [epoll_modify ep sock old new] changes the events of [sock]
+ * from [old] to [new], where 0 means not in the set.
+ * [epoll_wait ep ready timeout] writes [(fd lsl 2) lor events]
+ * for each ready socket into [ready], and returns their
+ * number.  A negative timeout blocks.
+ *)
+type epoll
+val has_epoll : unit -> bool
+val epoll_create : unit -> epoll
+val epoll_modify : epoll -> socket -> int -> int -> unit
+val epoll_wait : epoll -> int array -> timeval -> int
+
 (**************************************************************)
 
 (* Check if portions of two strings are equal.
@@ -152,6 +256,38 @@ val sendto_info : socket -> Unix.sockaddr array -> sendto_info
 val udp_send : sendto_info -> buf -> ofs -> len -> unit
 val udp_mu_sendsv : sendto_info -> buf -> ofs -> len -> Iov.t array -> unit
 
+(* Statistics on udp_mu_sendsv: the number of calls,
+ * destinations, and system calls issued.  Where the platform
+ * supports it, a message is handed to the kernel for several
+ * destinations in one system call; the histogram shows how
+ * many destinations each call carried.
+ *)
+val udp_mu_send_stats : unit -> string
+
+(* Statistics on received UDP packets, for sockets on which
+ * setsockopt_rx_stats has been set: how long packets waited in
+ * the socket queues, from their kernel receive timestamps, and
+ * how many packets the kernel dropped because a queue was full.
+ * udp_rx_drops is the total number of drops, including packets
+ * that were read but thrown away (see udp_mu_recv_gro).
+ *)
+val udp_rx_stats : unit -> string
+val udp_rx_drops : unit -> int
+
+(* UDP segmentation offload, where supported (Linux).
+ * [udp_mu_sendsv_gso info buf ofs_lens iovls n seg] sends [n]
+ * packets to each destination with one system call.  The ML
+ * header of packet [k] is at offset [ofs_lens.(2k)] in [buf] and
+ * has length [ofs_lens.(2k+1)], its bulk data is [iovls.(k)].
+ * All the packets but the last must be exactly [seg] bytes long,
+ * including the 8 byte length header.  The datagrams on the wire
+ * are the same as with udp_mu_sendsv.  Returns false, without
+ * sending anything, if this is not possible; the caller should
+ * then send the packets one by one.
+ *)
+val has_udp_gso : unit -> bool
+val udp_mu_sendsv_gso : sendto_info -> buf -> int array -> Iov.t array array -> int -> len -> bool
+
 (* Recv a packet in Ensemble format.  
  * [udp_mu_recv_packet sock prealloc_buf] returns [mllen, iovec]
  * 
@@ -161,6 +297,72 @@ val udp_mu_sendsv : sendto_info -> buf -> ofs -> len -> Iov.t array -> unit
  *)
 val udp_mu_recv_packet : Iov.pool -> socket -> string -> len * Iov.t
 
+(* Recv a batch of packets with a single system call where
+ * supported.  
+ * [udp_mu_recv_packets pool sock prealloc_buf mllens iovs]
+ * receives at most [Array.length mllens] packets and returns
+ * how many were received.  The ML header of the i-th packet is
+ * copied into [prealloc_buf] at offset [i * max_msg_size], its
+ * length is stored in [mllens.(i)], and its bulk data in
+ * [iovs.(i)].  A zero ML length marks a dropped packet.
+ * [prealloc_buf] must be [Array.length mllens] slots long.
+ *)
+val udp_mu_recv_packets : Iov.pool -> socket -> string -> int array -> Iov.t array -> int
+
+(* Recv a packet without copying its ML header out of the
+ * iovec memory.  
+ * [udp_mu_recv_packet_iov pool sock scratch_buf] returns 
+ * [hdr, iovec], where [hdr] holds the ML header and [iovec] the
+ * bulk data.  An empty [hdr] marks a dropped packet.  The
+ * scratch buffer is used only if iovec memory runs out.
+ *)
+val udp_mu_recv_packet_iov : Iov.pool -> socket -> string -> Iov.t * Iov.t
+
+(* As udp_mu_recv_packets, for a socket on which setsockopt_gro
+ * succeeded.  A single read may return several packets.  Those
+ * that do not fit in the slots are kept, and are returned by the
+ * next calls on the socket; call again while udp_gro_pending is
+ * true.  Kept packets are discarded if another GRO socket is
+ * read first.  Other receive functions must not be used on such
+ * a socket, since they would truncate coalesced packets.
+ *)
+val udp_mu_recv_gro : Iov.pool -> socket -> string -> int array -> Iov.t array -> int
+val udp_gro_pending : socket -> bool
+
+(* Asynchronous socket operations with io_uring, where supported
+ * (Linux 5.11 and later).  Operations are queued on the ring,
+ * each with an integer token, and are handed to the kernel by
+ * [uring_wait ring ready timeout], which then waits for at most
+ * [timeout] for completions.  For each completion, the token and
+ * the result (a length, or a negative error) are written into
+ * [ready], and their number is returned.  The queueing functions
+ * return false (-1 for uring_sendsv) if the ring is full.
+ * 
+ * [uring_recv ring pool sock token] reserves a max_msg_size
+ * iovec in [pool] and posts a receive into it.  The iovec is
+ * returned, empty if it could not be posted.  When the receive
+ * completes, [uring_recv_packet iov res prealloc_buf] releases
+ * it, and returns [mllen, iovec] as udp_mu_recv_packet.
+ * 
+ * [uring_poll ring sock events token] waits once for [sock] to
+ * be ready for the events, 1 for reading, 2 for writing.
+ * [uring_cancel ring token] cancels a receive or a poll.
+ * 
+ * [uring_sendsv ring info buf ofs len iovl token] queues a send
+ * as udp_mu_sendsv, and returns the number of destinations.  The
+ * buffer may be reused at once, the iovecs must be kept until
+ * the send completes.
+ *)
+type uring
+val has_uring : unit -> bool
+val uring_create : int -> uring
+val uring_recv : uring -> Iov.pool -> socket -> int -> Iov.t
+val uring_recv_packet : Iov.t -> int -> string -> len * Iov.t
+val uring_poll : uring -> socket -> int -> int -> bool
+val uring_cancel : uring -> int -> bool
+val uring_sendsv : uring -> sendto_info -> buf -> ofs -> len -> Iov.t array -> int -> int
+val uring_wait : uring -> int array -> timeval -> int
+
 (* These functions are used in Hsyssupp in receiving 
  * TCP packets. 
  *)
@@ -227,6 +429,30 @@ val setsockopt_bsdcompat : socket -> bool -> unit
 *)
 val setsockopt_reuse : socket -> bool -> unit
 
+(* Ask the kernel to coalesce received UDP packets (UDP_GRO).
+ * Returns false if this is not supported.
+ *)
+val setsockopt_gro : socket -> bool -> bool
+val getsockopt_gro : socket -> bool
+
+(* Allow several sockets to bind the same port, the kernel
+ * spreads the incoming packets among them (SO_REUSEPORT).
+ * Returns false if this is not supported.
+ *)
+val setsockopt_reuseport : socket -> bool -> bool
+
+(* The number of packets the kernel dropped on the socket
+ * because its receive queue was full, or -1 if this is not
+ * supported.
+ *)
+val getsockopt_drops : socket -> int
+
+(* Enable kernel receive timestamps and drop counts on the
+ * socket (SO_TIMESTAMPNS and SO_RXQ_OVFL), for udp_rx_stats.
+ * Returns false if this is not supported.
+ *)
+val setsockopt_rx_stats : socket -> bool -> bool
+
 (**************************************************************)
 (* MD5 support.
  *)
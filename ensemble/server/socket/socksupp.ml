@@ -52,7 +52,20 @@ let some_of = function
   | None -> failwith "sanity"
 
 (**************************************************************)
-let max_msg_size = 8 * 1024
+(* The maximal size of a UDP packet.  It may be raised for
+ * loopback and jumbo-frame networks, but must be the same for
+ * all processes in a group: larger packets are dropped.
+ *)
+let msg_size = ref (8 * 1024)
+let max_msg_size_limit = 65507
+
+let max_msg_size () = !msg_size
+
+let set_max_msg_size size = 
+  if size < 1024 || size > max_msg_size_limit then 
+    failwith (Printf.sprintf "set_max_msg_size: %d is not in [1024..%d]" 
+      size max_msg_size_limit) ;
+  msg_size := size
 (**************************************************************)
 exception Out_of_iovec_memory
 (**************************************************************)
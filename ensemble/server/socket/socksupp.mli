@@ -31,7 +31,9 @@ type os_t_v =
 
 val print_line : string -> unit
 val is_unix : bool 
-val max_msg_size : int
+val max_msg_size : unit -> int
+val max_msg_size_limit : int
+val set_max_msg_size : int -> unit
 val some_of : 'a option -> 'a
 
 exception Out_of_iovec_memory
@@ -31,6 +31,8 @@ type os_t_v = Socksupp.os_t_v =
 exception Out_of_iovec_memory = Socksupp.Out_of_iovec_memory
 
 let max_msg_size = Socksupp.max_msg_size
+let max_msg_size_limit = Socksupp.max_msg_size_limit
+let set_max_msg_size = Socksupp.set_max_msg_size
 let is_unix = Socksupp.is_unix
 
 (**************************************************************)
@@ -56,8 +58,28 @@ module Iov = struct
 
   type pool = int
 
+  type quota = unit
+
+  type pool_stats = {
+    ps_name : string;
+    ps_size : int;
+    ps_chunks : int;
+    ps_free_chunks : int;
+    ps_allocated : int;
+    ps_pending : int;
+    ps_waiting : int;
+    ps_grows : int;
+    ps_fallbacks : int;
+    ps_occupancy : int array;
+    ps_oldest_pinned : float
+  }
+
   type iovec = string
 
+  let use_slabs _ = ()
+  let use_region _ _ = ()
+  let use_compaction _ = ()
+
   let init verbose chunk_size max_mem_size send_pool_size min_alloc_size incr_step = 
     set_verbose verbose
 
@@ -71,6 +93,14 @@ module Iov = struct
 
   let string_of_t x = x
   let string_of_t_full s ofs iov = String.blit iov 0 s ofs (String.length iov)
+  let int16_of_sub t ofs = 
+    (Char.code t.[ofs] lsl 8) + (Char.code t.[ofs + 1])
+  let int32_of_sub t ofs = 
+    (int16_of_sub t ofs lsl 16) + (int16_of_sub t (ofs + 2))
+  let subeq t ofs s =
+    let rec loop i = 
+      i >= String.length s || (t.[ofs + i] = s.[i] && loop (succ i))
+    in loop 0
   let t_of_string pool x ofs len = String.sub x ofs len
     
   let len iov = String.length iov
@@ -85,11 +115,24 @@ module Iov = struct
 
   let satisfy_pending () = ()
 
+  let set_recv_stall _ = ()
+
+  let recv_wait pool f = f ()
+
+  let no_quota = ()
+  let create_quota _ _ = ()
+  let release_quota _ = ()
+  let alloc_quota _ pool size = String.create size
+  let alloc_async_quota _ pool size cont_fun = cont_fun (String.create size)
+
   let sub t ofs len = String.sub t ofs len
     
   let free _ = ()
     
   let copy t = t
+
+  let compact t = t
+  let compact_epoch () = 0
     
   (* Compute the total length of an iovec array.
    *)
@@ -125,8 +168,11 @@ module Iov = struct
   let marshal pool obj flags = Marshal.to_string obj flags
 
   let unmarshal iov = Marshal.from_string iov 0
+  let unmarshal_sub iov ofs _ = Marshal.from_string iov ofs
 
   let get_stats () = "ML-heap"
+  let pool_stats () = []
+  let string_of_pool_stats _ = "ML-heap"
 end
 
 let flatten = Iov.flatten
@@ -211,6 +257,11 @@ let setsockopt_sendbuf _ _ = failwith "setsockopt_sendbuf"
 let setsockopt_recvbuf _ _ = failwith "setsockopt_recvbuf"
 let setsockopt_bsdcompat _ _ = failwith "setsockopt_bsdcompat"
 let setsockopt_reuse sock onoff = Unix.setsockopt sock Unix.SO_REUSEADDR onoff
+let setsockopt_gro _ _ = false
+let getsockopt_gro _ = false
+let setsockopt_reuseport _ _ = false
+let getsockopt_drops _ = -1
+let setsockopt_rx_stats _ _ = false
 external int_of_file_descr : Unix.file_descr -> int = "%identity"
 let int_of_socket = int_of_file_descr
 let socket dom typ proto = 
@@ -328,12 +379,27 @@ let prepare_header ml_len usr_len =
   write_int32 s 4 usr_len;
   s
 
-let udp_mu_sendsv info buf ofs len iovl = 
+let send_calls = ref 0
+let send_dests = ref 0
+
+let udp_mu_send_stats () =
+  sprintf "calls=%d dests=%d syscalls=%d (no batching)" 
+    !send_calls !send_dests !send_dests
+
+let udp_rx_stats () = "disabled"
+let udp_rx_drops () = 0
+
+let udp_mu_sendsv ((_,a) as info) buf ofs len iovl = 
 (*  log (fun () -> sprintf "sendtosv %s\n" (string_of_info info));*)
+  incr send_calls ;
+  send_dests := !send_dests + Array.length a ;
   let hdr = prepare_header len (iovecl_len iovl) in
   let iovl = Array.append [|hdr; String.sub buf ofs len|] iovl in
   let str = flatten iovl in
   udp_send info str 0 (String.length str)
+
+let has_udp_gso () = false
+let udp_mu_sendsv_gso _ _ _ _ _ _ = false
   
 
 (* Send/Recv functions for TCP.
@@ -372,12 +438,12 @@ let udp_mu_recv_packet pool sock mlbuf=
      *)
     let len = 
       if is_unix then 
-	Unix.recv sock mlbuf 0 max_msg_size [] 
+	Unix.recv sock mlbuf 0 (max_msg_size ()) [] 
       else
-	let len,_ = Unix.recvfrom sock mlbuf 0 max_msg_size [] in 
+	let len,_ = Unix.recvfrom sock mlbuf 0 (max_msg_size ()) [] in 
 	len
     in
-    if len = max_msg_size then (
+    if len = max_msg_size () then (
       eprintf "USOCKET:udp_recv_packet:warning:got packet that is maximum size (probably truncated), dropping (len=%d)\n" len ;
       flush stderr ;
       0,empty
@@ -404,6 +470,19 @@ let udp_mu_recv_packet pool sock mlbuf=
       | Unix.EMSGSIZE -> 0,empty
       | _ -> raise exn
 
+let udp_mu_recv_packet_iov pool sock mlbuf = 
+  let mllen,iov = udp_mu_recv_packet pool sock mlbuf in
+  if mllen = 0 then empty,iov else (String.sub mlbuf 0 mllen),iov
+
+let udp_mu_recv_packets pool sock mlbuf mllens iovs = 
+  let mllen,iov = udp_mu_recv_packet pool sock mlbuf in
+  mllens.(0) <- mllen ;
+  iovs.(0) <- iov ;
+  1
+
+let udp_mu_recv_gro = udp_mu_recv_packets
+let udp_gro_pending _ = false
+
 (**************************************************************)
 
 let rec substring_eq_help s1 o1 s2 o2 l i =
@@ -477,6 +556,22 @@ let select (a,b,c) timeout =
 let time_zero = {sec10=0;usec=0}
 let poll si = select si time_zero
 
+type epoll = unit
+let has_epoll () = false
+let epoll_create () = failwith "epoll_create"
+let epoll_modify _ _ _ _ = failwith "epoll_modify"
+let epoll_wait _ _ _ = failwith "epoll_wait"
+
+type uring = unit
+let has_uring () = false
+let uring_create _ = failwith "uring_create"
+let uring_recv _ _ _ _ = failwith "uring_recv"
+let uring_recv_packet _ _ _ = failwith "uring_recv_packet"
+let uring_poll _ _ _ _ = failwith "uring_poll"
+let uring_cancel _ _ = failwith "uring_cancel"
+let uring_sendsv _ _ _ _ _ _ _ = failwith "uring_sendsv"
+let uring_wait _ _ _ = failwith "uring_wait"
+
 (**************************************************************)
 
 (* These are not supported at all.
@@ -0,0 +1,275 @@
+(**************************************************************)
+(* EPOLL.ML *)
+(**************************************************************)
+(* Notes:
+ * 1. Like REAL, but the sockets are kept in a persistent epoll
+ *    set.  Sockets are added to and removed from the set as they
+ *    come and go, instead of rebuilding a select set on every
+ *    change, and only the handlers of ready sockets are called.
+ * 2. Where epoll is not supported, falls back to REAL.
+ *)
+(**************************************************************)
+open Util
+open Trans
+(**************************************************************)
+let name = Trace.file "EPOLL"
+let failwith = Trace.make_failwith name
+let log = Trace.log name
+(**************************************************************)
+
+(* Event bits, as in Socket.epoll_modify.
+ *)
+let ev_recv = 1
+let ev_xmit = 2
+
+(* Per-socket state, indexed by file descriptor.
+ *)
+type table = {
+  mutable events : int array ;
+  mutable recv : (unit -> unit) array ;
+  mutable xmit : (unit -> unit) array
+}
+
+let table_grow t fd =
+  let len = Array.length t.events in
+  if fd >= len then (
+    let len' = max (succ fd) (2 * len) in
+    let grow a x =
+      let a' = Array.create len' x in
+      Array.blit a 0 a' 0 len ;
+      a'
+    in
+    t.events <- grow t.events 0 ;
+    t.recv <- grow t.recv ident ;
+    t.xmit <- grow t.xmit ident
+  )
+
+(**************************************************************)
+
+module Priq = Priq.Make ( Time.Ord )
+
+let alarm ((unique,sched,async,handlers) as gorp) =
+  let deliver = 
+    if Arge.timestamp_check "recv" then (
+      let stamp = Timestamp.register"UDP:recv" in
+      let ts_add () = Timestamp.add stamp in
+      let deliver h buf ofs len iovl =
+	ts_add () ;
+    	Route.deliver h buf ofs len iovl
+      in deliver
+    ) else Route.deliver
+  in
+  let multiread = Arge.get Arge.multiread in
+  let deliver = 
+    if multiread then (
+      fun handlers buf ofs len iovl ->
+	Sched.enqueue_5arg sched name deliver handlers buf ofs len iovl
+    ) else deliver
+  in
+  let deliver_iov =
+    if multiread then (
+      fun handlers hdr iovl ->
+	Sched.enqueue_3arg sched name Real.deliver_iov handlers hdr iovl
+    ) else Real.deliver_iov
+  in
+
+  let ep = Hsys.epoll_create () in
+  let table = {
+    events = Array.create 64 0 ;
+    recv = Array.create 64 ident ;
+    xmit = Array.create 64 ident
+  } in
+
+  (* Change the events of a socket, and tell the kernel.
+   *)
+  let modify sock f =
+    let fd = Hsys.int_of_socket sock in
+    table_grow table fd ;
+    let events = table.events.(fd) in
+    let events' = f events in
+    Hsys.epoll_modify ep sock events events' ;
+    table.events.(fd) <- events'
+  in
+
+  let recv_pool = Iovec.get_recv_pool () in
+  let batch = Arge.get Arge.recv_batch in
+  let nocopy = Arge.get Arge.recv_nocopy in
+  let prealloc_bufs = 
+    if batch > 1 then
+      Buf.create (Buf.len_of_int (batch * Hsys.max_msg_size ()))
+    else Buf.create (Buf.len_of_int (Hsys.max_msg_size ()))
+  in
+  let recv_handler sock = function
+    | Hsys.Handler0 f -> f
+    | Hsys.Handler1 ->
+	if Hsys.getsockopt_gro sock then
+	  Real.recv_gro handlers deliver recv_pool sock
+	else if nocopy then
+	  Real.recv_nocopy handlers deliver_iov recv_pool sock
+	else if batch > 1 then
+	  Real.recv_batch handlers deliver recv_pool prealloc_bufs batch sock
+	else
+	  Real.recv_single handlers deliver recv_pool sock
+  in
+
+  let socks_recv = 
+    Resource.create "EPOLL:socks_recv"
+    (fun fd (sock,h) ->
+      modify sock (fun ev -> ev lor ev_recv) ;
+      table.recv.(fd) <- recv_handler sock h)
+    (fun fd (sock,_) ->
+      table.recv.(fd) <- ident ;
+      modify sock (fun ev -> ev land (lnot ev_recv)))
+    ignore
+    (fun socks ->
+      log (fun () -> sprintf "socks_recv=%s" (Resource.to_string socks)))
+  in
+
+  let socks_xmit = 
+    Resource.create "EPOLL:socks_xmit"
+    (fun fd (sock,f) ->
+      modify sock (fun ev -> ev lor ev_xmit) ;
+      table.xmit.(fd) <- f)
+    (fun fd (sock,_) ->
+      table.xmit.(fd) <- ident ;
+      modify sock (fun ev -> ev land (lnot ev_xmit)))
+    ignore
+    (fun socks ->
+      log (fun () -> sprintf "socks_xmit=%s" (Resource.to_string socks)))
+  in
+
+  let onlypolls = ref ident in
+  let polls =
+    Resource.create "EPOLL:polls" 
+    ignore2
+    ignore2
+    (fun polls -> onlypolls := Real.squash_polls (Resource.to_array polls))
+    (fun polls ->
+      log (fun () -> sprintf "polls=%s" (Resource.to_string polls)))
+  in
+
+  Trace.install_root (fun () -> [
+    sprintf "EPOLL:recv:%s" (Resource.info socks_recv) ;
+    sprintf "EPOLL:xmit:%s" (Resource.info socks_xmit) ;
+    sprintf "EPOLL:poll:%s" (Resource.info polls)
+  ]) ;
+
+  (* Wait for at most [timeout], and call the handlers of the
+   * sockets that are ready.  A handler may remove sockets, in
+   * which case their entries have been reset to [ident].
+   *)
+  let ready = Array.create 256 0 in
+  let wait timeout =
+    let nready = Time.mut_epoll_wait ep ready timeout in
+    for i = 0 to pred nready do
+      let r = ready.(i) in
+      let fd = r lsr 2 in
+      if r land ev_recv <> 0 then table.recv.(fd) () ;
+      if r land ev_xmit <> 0 then table.xmit.(fd) ()
+    done ;
+    nready > 0
+  in
+
+  let zero = Time.mut () in
+  Time.mut_set zero Time.zero ;
+  let poll_socks () = wait zero in
+
+  let poll_once () = !onlypolls (poll_socks ()) in
+  let poll, onlypoll =
+    if multiread then (
+      (fun () ->
+	if poll_once () then (
+	  while poll_once () do () done ;
+	  true
+	) else false),
+      (fun () ->
+	if !onlypolls false then (
+	  while !onlypolls false do () done ;
+	  true
+	) else false)
+    ) else (
+      poll_once,
+      (fun () -> !onlypolls false)
+    )
+  in
+
+  let space = Time.mut () in
+
+  let alarms = Priq.create (fun _ -> failwith "priq:sanity") in
+
+  let block () =
+    if Priq.size alarms = 0 then (
+      Time.mut_set space Time.neg_one
+    ) else (
+      Time.mut_gettimeofday space ;
+      let next = Priq.min alarms in
+      if Time.mut_ge space next then (
+      	Time.mut_set space Time.zero
+      ) else (
+      	Time.mut_sub_rev next space
+      )
+    ) ;
+    ignore (wait space) ;
+    if multiread then
+      while poll_socks () do () done
+  in
+
+  let gettime = Time.gettimeofday
+
+  and min () = Priq.min alarms
+
+  and check () =
+    Time.mut_gettimeofday space ;
+    let min = Priq.min alarms in
+    if not (Time.mut_ge space min) then
+      false
+    else
+      Priq.getopt alarms (Time.mut_copy space)
+
+  and alarm callback =
+    let disable = ident in
+    let schedule time =
+      Priq.add alarms time callback
+    in Alarm.c_alarm disable schedule
+
+  and poll kind = 
+    match kind with
+    | Alarm.SocksPolls -> poll
+    | Alarm.OnlyPolls -> onlypoll
+
+  and add_sock_recv d s h = Resource.add socks_recv d (Hsys.int_of_socket s) (s,h)
+  and rmv_sock_recv s = Resource.remove socks_recv (Hsys.int_of_socket s)
+  and add_sock_xmit d s h = Resource.add socks_xmit d (Hsys.int_of_socket s) (s,h)
+  and rmv_sock_xmit s = Resource.remove socks_xmit (Hsys.int_of_socket s)
+  and add_poll name poll = Resource.add polls name name poll
+  and rmv_poll = Resource.remove polls
+
+  in Alarm.create
+    name
+    gettime
+    alarm
+    check
+    min
+    add_sock_recv
+    rmv_sock_recv
+    add_sock_xmit
+    rmv_sock_xmit
+    block
+    add_poll
+    rmv_poll
+    poll
+    gorp
+
+(**************************************************************)
+
+let alarm gorp =
+  if Hsys.has_epoll () then (
+    alarm gorp
+  ) else (
+    eprintf "EPOLL:warning:epoll not supported, using REAL alarm\n" ;
+    Real.alarm gorp
+  )
+
+let _ = Alarm.install "EPOLL" alarm
+
+(**************************************************************)
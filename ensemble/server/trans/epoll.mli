@@ -0,0 +1,5 @@
+(**************************************************************)
+(* EPOLL.MLI *)
+(**************************************************************)
+
+(* empty *)
@@ -72,6 +72,9 @@ let very_first port () =
 		eprintf "On Win32 (other than win2000) this is ok, continuing\n"
   end ;
       
+  if Arge.get Arge.udp_rx_stats then
+    ignore (Hsys.setsockopt_rx_stats sock true) ;
+
   (* Bind it to the port.
    *)
   log (fun () -> sprintf "port=%d" port) ;
@@ -99,9 +99,98 @@ let unroll_loops flags handlers =
 	    Arrayf.get handlers i ()
 	done
 
-let prealloc_buf = Buf.create (Buf.len_of_int Hsys.max_msg_size)
+(* The preallocated ML buffer is created on first use, once the
+ * maximal message size has been set.
+ *)
+let prealloc_buf = ref Buf.empty
+
+let get_prealloc_buf () =
+  let len = Buf.len_of_int (Hsys.max_msg_size ()) in
+  if Buf.length !prealloc_buf <|| len then
+    prealloc_buf := Buf.create len ;
+  !prealloc_buf
+
+(* Read a single packet per readiness notification.
+ *)
+let recv_single route_handlers handler recv_pool sock =
+  let prealloc_buf = get_prealloc_buf () in
+  fun () ->
+    (* the ml-header is read into the pre-allocated buffer. The 
+     * length of the header is returned as [mllen]
+     *)
+    let mllen,iov = Hsys.udp_mu_recv_packet recv_pool sock prealloc_buf in
+    (*let mllen = Buf.len_of_int mllen in*)
+    if mllen <>|| len0 then (
+      let iovl = Iovecl.singleton iov in
+      handler route_handlers prealloc_buf Buf.len0 mllen iovl
+    ) else (
+      Iovec.free iov
+    )
+
+(* Deliver a packet whose ML header is in iovec memory, and free
+ * the header.
+ *)
+let deliver_iov route_handlers hdr iovl =
+  Route.deliver_iov route_handlers hdr iovl ;
+  Iovec.free hdr
+
+(* Read a single packet, leaving the ML header in iovec memory,
+ * where the router parses it.  [handler_iov] frees the header.
+ * The preallocated buffer is used only if iovec memory runs out.
+ *)
+let recv_nocopy route_handlers handler_iov recv_pool sock =
+  let prealloc_buf = get_prealloc_buf () in
+  fun () ->
+    let hdr,iov = Hsys.udp_mu_recv_packet_iov recv_pool sock prealloc_buf in
+    if Iovec.len hdr >|| len0 then (
+      let iovl = Iovecl.singleton iov in
+      handler_iov route_handlers hdr iovl
+    ) else (
+      Iovec.free iov
+    )
 
-let helper route_handlers handler info = 
+(* Read up to [batch] packets per readiness notification, and
+ * deliver them in the order they were received.  The ML headers
+ * are in consecutive max_msg_size slots of [prealloc_bufs].
+ * Reading goes on while [again sock] holds and packets come in.
+ *)
+let recv_batch_with recv again route_handlers handler recv_pool prealloc_bufs batch sock =
+  let mllens = Array.create batch 0 in
+  let iovs = Array.create batch Iovec.empty in
+  let rec loop () =
+    let got = recv recv_pool sock prealloc_bufs mllens iovs in
+    for i = 0 to pred got do
+      let mllen = Buf.len_of_int mllens.(i) in
+      let iov = iovs.(i) in
+      iovs.(i) <- Iovec.empty ;
+      if mllen <>|| len0 then (
+	let iovl = Iovecl.singleton iov in
+	let ofs = Buf.len_of_int (i * Hsys.max_msg_size ()) in
+	handler route_handlers prealloc_bufs ofs mllen iovl
+      ) else (
+	Iovec.free iov
+      )
+    done ;
+    if got > 0 && again sock then loop ()
+  in loop
+
+let recv_batch = recv_batch_with Hsys.udp_mu_recv_packets (fun _ -> false)
+
+(* Sockets with UDP_GRO set may return up to 64 packets per read.
+ * Those beyond the slots of the current chunk are kept on the C
+ * side, and are read before returning, so that they are not
+ * discarded by a read on another socket.
+ *)
+let gro_slots = 64
+
+let recv_gro route_handlers handler recv_pool sock =
+  let prealloc_bufs = 
+    Buf.create (Buf.len_of_int (gro_slots * Hsys.max_msg_size ()))
+  in
+  recv_batch_with Hsys.udp_mu_recv_gro Hsys.udp_gro_pending
+    route_handlers handler recv_pool prealloc_bufs gro_slots sock
+
+let helper route_handlers handler handler_iov info = 
   if Arrayf.is_empty info then 
     None
   else (
@@ -109,22 +198,25 @@ let helper route_handlers handler info =
     let flags = Array.create (Arrayf.length socks) false in
     let error _ = failwith "error[1]" in
     let recv_pool = Iovec.get_recv_pool () in
+    let batch = Arge.get Arge.recv_batch in
+    let nocopy = Arge.get Arge.recv_nocopy in
+    let prealloc_bufs = 
+      if batch > 1 then
+	Buf.create (Buf.len_of_int (batch * Hsys.max_msg_size ()))
+      else get_prealloc_buf ()
+    in
     let handlers =
       Arrayf.map (function
 	| (_,Hsys.Handler0 f) -> f
 	| (sock,Hsys.Handler1) ->
-	    fun () -> 
-	      (* the ml-header is read into the pre-allocated buffer. The 
-	       * length of the header is returned as [mllen]
-	       *)
-	      let mllen,iov = Hsys.udp_mu_recv_packet recv_pool sock prealloc_buf in
-	      (*let mllen = Buf.len_of_int mllen in*)
-	      if mllen <>|| len0 then (
-		let iovl = Iovecl.singleton iov in
-		handler route_handlers prealloc_buf Buf.len0 mllen iovl
-	      ) else (
-		Iovec.free iov
-	      )
+	    if Hsys.getsockopt_gro sock then
+	      recv_gro route_handlers handler recv_pool sock
+	    else if nocopy then
+	      recv_nocopy route_handlers handler_iov recv_pool sock
+	    else if batch > 1 then
+	      recv_batch route_handlers handler recv_pool prealloc_bufs batch sock
+	    else
+	      recv_single route_handlers handler recv_pool sock
       ) (Arrayf.combine socks handlers)
     in
     let socks = Arrayf.to_array socks in
@@ -133,10 +225,10 @@ let helper route_handlers handler info =
     Some(info,handle)
   )
 
-let build_block_poll route_handlers handler recv_info xmit_info polls =
+let build_block_poll route_handlers handler handler_iov recv_info xmit_info polls =
   let (select_info,handle) =
-    let recv = helper route_handlers handler recv_info in
-    let xmit = helper route_handlers handler xmit_info in
+    let recv = helper route_handlers handler handler_iov recv_info in
+    let xmit = helper route_handlers handler handler_iov xmit_info in
     match recv,xmit with
     | None,None ->
 	(Hsys.select_info None None None),ident
@@ -243,11 +335,14 @@ let alarm ((unique,sched,async,handlers) as gorp) =
     if Arge.get Arge.multiread then (
       let deliver handlers buf ofs len iovl =
 	Sched.enqueue_5arg sched name deliver handlers buf ofs len iovl
+      and deliver_iov handlers hdr iovl =
+	Sched.enqueue_3arg sched name deliver_iov handlers hdr iovl
       in
       let (block,poll,onlypoll) = 
 	build_block_poll 
 	  handlers 
 	  deliver
+	  deliver_iov
 	  (Resource.to_array socks_recv)
 	  (Resource.to_array socks_xmit)
 	  (Resource.to_array polls)
@@ -274,6 +369,7 @@ let alarm ((unique,sched,async,handlers) as gorp) =
 	build_block_poll 
 	  handlers
 	  deliver
+	  deliver_iov
 	  (Resource.to_array socks_recv)
 	  (Resource.to_array socks_xmit)
 	  (Resource.to_array polls)
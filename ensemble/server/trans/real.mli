@@ -5,3 +5,38 @@
 
 val export_socks : Hsys.socket Arrayf.t ref
 val install_blocker : (Time.t -> unit) -> unit
+
+(**************************************************************)
+(* For use by other alarms.
+ *)
+
+val squash_polls : (bool -> bool) Arrayf.t -> (bool -> bool)
+
+val recv_single : 
+  Route.handlers -> 
+  (Route.handlers -> Buf.t -> Buf.ofs -> Buf.len -> Iovecl.t -> unit) ->
+  Iovec.pool -> Hsys.socket -> unit -> unit
+
+(* For recv_nocopy, which passes the ML header in iovec memory.
+ * The handler frees it, as deliver_iov does.
+ *)
+val deliver_iov : Route.handlers -> Iovec.t -> Iovecl.t -> unit
+
+val recv_nocopy : 
+  Route.handlers -> 
+  (Route.handlers -> Iovec.t -> Iovecl.t -> unit) ->
+  Iovec.pool -> Hsys.socket -> unit -> unit
+
+val recv_batch :
+  Route.handlers -> 
+  (Route.handlers -> Buf.t -> Buf.ofs -> Buf.len -> Iovecl.t -> unit) ->
+  Iovec.pool -> Buf.t -> int -> Hsys.socket -> unit -> unit
+
+val recv_gro :
+  Route.handlers -> 
+  (Route.handlers -> Buf.t -> Buf.ofs -> Buf.len -> Iovecl.t -> unit) ->
+  Iovec.pool -> Hsys.socket -> unit -> unit
+
+val alarm : Alarm.gorp -> Alarm.t
+
+(**************************************************************)
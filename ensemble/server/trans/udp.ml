@@ -12,10 +12,14 @@ let failwith s = Trace.make_failwith name s
 let log = Trace.log name
 (**************************************************************)
 
-let init_sock host =
+let init_sock reuseport host =
   let sock_buf = Arge.get Arge.sock_buf in
   let sock = Hsys.udp_socket sock_buf in
 
+  (* The port is probed and bound without SO_REUSEPORT, so
+   * that a port in use by another process is skipped rather
+   * than silently shared with it.
+   *)
   let rec loop port =
     try
       Hsys.bind sock host port;
@@ -34,8 +38,65 @@ let init_sock host =
     port := loop !port
   );
   log (fun () -> sprintf "kernel bound port %d (receiving)" !port) ;
+
+  (* Only now let share_sock open more sockets on the port.
+   *)
+  if reuseport && not (Hsys.setsockopt_reuseport sock true) then
+    log (fun () -> "SO_REUSEPORT is not supported") ;
   (sock,!port)
 
+(* Open another socket on the port of a socket opened with
+ * [init_sock true].  Returns None if this fails.  Linux lets
+ * it join the port, as the first socket has SO_REUSEPORT set
+ * by now, even though it was bound without it.
+ *)
+let share_sock host port =
+  let sock = Hsys.udp_socket (Arge.get Arge.sock_buf) in
+  try
+    if not (Hsys.setsockopt_reuseport sock true) then
+      raise Not_found ;
+    Hsys.bind sock host port ;
+    Some sock
+  with e ->
+    log (fun () -> sprintf "sharing port %d:%s" port (Util.error e)) ;
+    Hsys.close sock ;
+    None
+
+let string_of_drops sock =
+  sprintf "%d:%d" (Hsys.int_of_socket sock) (Hsys.getsockopt_drops sock)
+
+(**************************************************************)
+
+(* Statistics for the sendto_info caches.
+ *)
+let info_hits = ref 0
+let info_misses = ref 0
+
+let string_of_info_stats () =
+  let total = !info_hits + !info_misses in
+  sprintf "hits=%d misses=%d hit_rate=%s" !info_hits !info_misses
+    (if total = 0 then "-" else 
+      sprintf "%.2f" (float !info_hits /. float total))
+
+(* Statistics for segmentation offload: runs sent with one
+ * system call per destination, the packets in them, and runs
+ * that had to be sent packet by packet.
+ *)
+let gso_runs = ref 0
+let gso_pkts = ref 0
+let gso_fallbacks = ref 0
+
+let string_of_gso_stats () =
+  sprintf "runs=%d packets=%d fallbacks=%d" !gso_runs !gso_pkts !gso_fallbacks
+
+(**************************************************************)
+
+(* The limits of a run handed to the kernel at once: the number
+ * of segments it accepts, and the maximal UDP payload.
+ *)
+let gso_max_pkts = 64
+let gso_max_bytes = 65507
+
 (**************************************************************)
 
 let domain alarm =
@@ -72,7 +133,156 @@ let domain alarm =
    * to INADDR_ANY so that messages will be accepted on
    * all network interfaces.
    *)
-  let (udp_sock, port) = init_sock (Hsys.inet_any ()) in
+  let nsocks = Arge.get Arge.udp_socks in
+  let (udp_sock, port) = init_sock (nsocks > 1) (Hsys.inet_any ()) in
+
+  (* With udp_socks > 1, more sockets are bound to the same port
+   * with SO_REUSEPORT, so that packets are spread by the kernel
+   * over several receive queues.  All of them receive, but
+   * packets are only sent from udp_sock.  Note that another
+   * process of the same user could share the port as well, so
+   * udp_port should not be set to a port in use.
+   *)
+  let udp_socks =
+    let rec loop i =
+      if i >= nsocks then [] else
+      match share_sock (Hsys.inet_any ()) port with
+      | None -> []
+      | Some sock -> sock :: loop (succ i)
+    in
+    Array.of_list (udp_sock :: loop 1)
+  in
+  if Array.length udp_socks < nsocks then
+    eprintf "UDP:warning:opened only %d of %d sockets on port %d\n"
+      (Array.length udp_socks) nsocks port ;
+
+  (* With UDP_GRO, the kernel may return several packets from
+   * the same sender in one read.  The alarms notice this, and
+   * read the socket accordingly.
+   *)
+  if Arge.get Arge.udp_gro then (
+    Array.iter (fun sock ->
+      if not (Hsys.setsockopt_gro sock true) then
+	log (fun () -> "UDP_GRO is not supported, continuing without it")
+    ) udp_socks
+  ) ;
+
+  (* Kernel receive timestamps and drop counts, to tell losses
+   * in the host apart from those in the network.
+   *)
+  if Arge.get Arge.udp_rx_stats then (
+    Array.iter (fun sock ->
+      if not (Hsys.setsockopt_rx_stats sock true) then
+	log (fun () -> "receive timestamps are not supported, continuing without them")
+    ) udp_socks
+  ) ;
+
+  (* Segmentation offload.  Consecutive packets for the same
+   * destinations are held back while they are all the same size
+   * (the last one may be shorter), and are handed to the kernel
+   * together.  Each keeps its own length header, so the packets
+   * on the wire are unchanged.  The run is sent when a packet
+   * does not fit in it, or when the alarm polls, which happens
+   * before it blocks.  The ML headers are copied, since the
+   * caller reuses its buffer.
+   *)
+  (* With the URING alarm, other sends are queued on its ring,
+   * which releases the iovecs when they complete.  GSO runs are
+   * sent synchronously, and would overtake the queued sends, so
+   * the two do not mix.
+   *)
+  let sendsv =
+    match Uring.sender () with
+    | Some send -> send
+    | None ->
+	fun info hdr ofs len iovl ->
+	  Hsys.udp_mu_sendsv info hdr ofs len iovl ;
+	  Iovecl.free iovl
+  in
+
+  let gso = ref (Arge.get Arge.udp_gso && Hsys.has_udp_gso ()) in
+  if !gso && Uring.sender () <> None then (
+    log (fun () -> "segmentation offload is not used with the URING alarm") ;
+    gso := false
+  ) ;
+  let gso_info = ref None in
+  let gso_seg = ref 0 in
+  let gso_n = ref 0 in
+  let gso_closed = ref false in
+  let gso_hdrs = Buf.create (Buf.len_of_int gso_max_bytes) in
+  let gso_hdrs_pos = ref 0 in
+  let gso_ofs_lens = Array.create (2 * gso_max_pkts) 0 in
+  let gso_iovls = Array.create gso_max_pkts Iovecl.empty in
+
+  let gso_send_each info n =
+    for i = 0 to pred n do
+      Hsys.udp_mu_sendsv info gso_hdrs 
+	(Buf.len_of_int gso_ofs_lens.(2*i))
+	(Buf.len_of_int gso_ofs_lens.(2*i+1))
+	gso_iovls.(i)
+    done
+  in
+
+  let gso_flush () =
+    match !gso_info with
+    | None -> ()
+    | Some info ->
+	let n = !gso_n in
+	if n = 1 then (
+	  gso_send_each info n
+	) else if Hsys.udp_mu_sendsv_gso info gso_hdrs gso_ofs_lens gso_iovls n !gso_seg then (
+	  incr gso_runs ;
+	  gso_pkts := !gso_pkts + n
+	) else (
+	  (* Typically the segments do not fit in the MTU of the
+	   * route, or the kernel is too old.  Do not try again.
+	   *)
+	  log (fun () -> sprintf "segmentation offload failed (seg=%d), disabling it" !gso_seg) ;
+	  incr gso_fallbacks ;
+	  gso := false ;
+	  gso_send_each info n
+	) ;
+	for i = 0 to pred n do
+	  Iovecl.free gso_iovls.(i) ;
+	  gso_iovls.(i) <- Iovecl.empty
+	done ;
+	gso_info := None ;
+	gso_n := 0 ;
+	gso_hdrs_pos := 0 ;
+	gso_closed := false
+  in
+
+  let gso_xmit info hdr ofs len iovl =
+    let ml_len = Buf.int_of_len len in
+    let size = 8 + ml_len + Buf.int_of_len (Iovecl.len iovl) in
+    let fits = 
+      match !gso_info with
+      | None -> false
+      | Some info' ->
+	  info' == info 
+	  && not !gso_closed
+	  && size <= !gso_seg
+	  && !gso_n < gso_max_pkts
+	  && succ !gso_n * !gso_seg <= gso_max_bytes
+    in
+    if not fits then (
+      gso_flush () ;
+      gso_info := Some info ;
+      gso_seg := size
+    ) ;
+    let n = !gso_n in
+    Buf.blit hdr ofs gso_hdrs (Buf.len_of_int !gso_hdrs_pos) len ;
+    gso_ofs_lens.(2*n) <- !gso_hdrs_pos ;
+    gso_ofs_lens.(2*n+1) <- ml_len ;
+    gso_iovls.(n) <- iovl ;
+    gso_hdrs_pos := !gso_hdrs_pos + ml_len ;
+    gso_n := succ n ;
+    if size < !gso_seg then
+      gso_closed := true
+  in
+
+  if !gso then
+    Alarm.add_poll alarm "UDP:gso" (fun b -> gso_flush () ; b) ;
 
   (* Tell the alarm module our unique port number.
    *)
@@ -91,30 +301,161 @@ let domain alarm =
   | _ -> failwith "addr:bad mode"
   in
 
+  (* The sockets we receive on, with the number of times each
+   * was enabled.  They are registered with the alarm once, and
+   * not while receives are stalled.
+   *)
+  let recv_socks = Hashtbl.create 7 in
+  let stalled = ref false in
+
+  let add_sock debug sock =
+    let fd = Hsys.int_of_socket sock in
+    try incr (snd (Hashtbl.find recv_socks fd)) with Not_found ->
+      Hashtbl.add recv_socks fd ((debug,sock),ref 1) ;
+      if not !stalled then
+	Alarm.add_sock_recv alarm debug sock Hsys.Handler1
+  and rmv_sock sock =
+    let fd = Hsys.int_of_socket sock in
+    let (_,count) = Hashtbl.find recv_socks fd in
+    decr count ;
+    if !count = 0 then (
+      Hashtbl.remove recv_socks fd ;
+      if not !stalled then
+	Alarm.rmv_sock_recv alarm sock
+    )
+  in
+
+  (* Backpressure on the receive pool.  Without it, a packet
+   * arriving when the pool is exhausted is read into the ML heap
+   * and its iovec data is dropped, to be recovered by NAKs and
+   * retransmissions.  With it, the sockets are taken out of the
+   * alarm until the pool can take packets again, and packets
+   * wait in the kernel instead.
+   *
+   * Acknowledgements, which let the memory be freed, arrive on
+   * the same sockets.  So a stall is cut short after
+   * mem_stall_max, and until memory is freed, packets are read
+   * as without backpressure.
+   *)
+  let stalls = ref 0 in
+  let stall_overdue = ref 0 in
+  let stall_start = ref Time.zero in
+  let stall_total = ref Time.zero in
+  let stall_max = ref Time.zero in
+  let stall_limit = Time.of_float (float (Arge.get Arge.mem_stall_max) /. 1000.0) in
+  let overdue = ref false in
+  let waiting = ref false in
+
+  (* Alarm.disable does nothing with some alarms, so a timer
+   * left from an earlier stall can still go off.  Each stall
+   * has a generation, and timers from older ones are ignored.
+   *)
+  let stall_gen = ref 0 in
+
+  let resume () =
+    if !stalled then (
+      stalled := false ;
+      let d = Time.sub (Alarm.gettime alarm) !stall_start in
+      stall_total := Time.add !stall_total d ;
+      if Time.gt d !stall_max then stall_max := d ;
+      log (fun () -> sprintf "resuming receives after %s" (Time.to_string d)) ;
+      Hashtbl.iter (fun _ ((debug,sock),_) ->
+	Alarm.add_sock_recv alarm debug sock Hsys.Handler1
+      ) recv_socks
+    )
+  in
+
+  let stall_timer gen =
+    Alarm.alarm alarm (fun _ ->
+      if !stalled && !stall_gen = gen then (
+	incr stall_overdue ;
+	overdue := true ;
+	resume ()
+      )
+    )
+  in
+
+  let stall () =
+    if !stalled then true
+    else if !overdue then false 
+    else (
+      stalled := true ;
+      incr stalls ;
+      incr stall_gen ;
+      let now = Alarm.gettime alarm in
+      stall_start := now ;
+      log (fun () -> "receive pool exhausted, stalling receives") ;
+      Hashtbl.iter (fun _ ((_,sock),_) ->
+	Alarm.rmv_sock_recv alarm sock
+      ) recv_socks ;
+      Alarm.schedule (stall_timer !stall_gen) (Time.add now stall_limit) ;
+      if not !waiting then (
+	waiting := true ;
+	Iovec.recv_wait (Iovec.get_recv_pool ()) (fun () ->
+	  waiting := false ;
+	  overdue := false ;
+	  incr stall_gen ;
+	  resume ()
+	)
+      ) ;
+      true
+    )
+  in
+
+  if Arge.get Arge.mem_backpressure then
+    Iovec.set_recv_stall (Some stall) ;
+
+  let string_of_stall_stats () =
+    sprintf "stalls=%d overdue=%d total=%s max=%s%s" 
+      !stalls !stall_overdue 
+      (Time.to_string !stall_total) (Time.to_string !stall_max)
+      (if !stalled then " (stalled)" else "")
+  in
+
   let enable mode group endpt view =
     let ipmc_sock, disable =
       match mode with
       | Addr.Udp ->
-	  Alarm.add_sock_recv alarm name udp_sock Hsys.Handler1 ;
-	  let disable () = Alarm.rmv_sock_recv alarm udp_sock in
+	  Array.iter (add_sock name) udp_socks ;
+	  let disable () =
+	    Array.iter rmv_sock udp_socks
+	  in
 	  udp_sock, disable
       | Addr.Deering ->
 	  let hash = Group.hash_of_id group in
 	  let deering_sock = Ipmc.join (Hsys.deering_addr hash) (deering_port ()) in
-	  Alarm.add_sock_recv alarm name udp_sock Hsys.Handler1 ;
-	  Alarm.add_sock_recv alarm "DEERING" deering_sock Hsys.Handler1;
+	  Array.iter (add_sock name) udp_socks ;
+	  add_sock "DEERING" deering_sock ;
 
 	  let disable () =
 	    let hash = Group.hash_of_id group in
 	    let deering_sock = Ipmc.leave (Hsys.deering_addr hash) (deering_port()) in
-	    Alarm.rmv_sock_recv alarm udp_sock ;
-	    Alarm.rmv_sock_recv alarm deering_sock
+	    Array.iter rmv_sock udp_socks ;
+	    rmv_sock deering_sock
 	  in
 
 	  deering_sock, disable
       | _ -> failwith "enable:bad mode"
     in
 
+    (* Destination sets are prepared once per view.  Layers
+     * such as Subcast create xmits for many subsets of the
+     * view, which often repeat.
+     *)
+    let infos = Hashtbl.create 7 in
+    let sendto_info sock dests =
+      let key = (Hsys.int_of_socket sock, dests) in
+      try 
+	let info = Hashtbl.find infos key in
+	incr info_hits ;
+	info
+      with Not_found ->
+	incr info_misses ;
+	let info = Hsys.sendto_info sock dests in
+	Hashtbl.add infos key info ;
+	info
+    in
+
     let xmit dest =
       (* Do some preprocessing.
        *)
@@ -138,7 +479,7 @@ let domain alarm =
 	      ) dests
 	    in
 	    let dests = Arrayf.to_array dests in
-	    Hsys.sendto_info sock dests
+	    sendto_info sock dests
 	| Domain.Mcast(dest,loopback) ->
 	    (* Multicast communication means that this must
 	     * be a Deering address.
@@ -146,7 +487,7 @@ let domain alarm =
 	    let hash = Group.hash_of_id dest in
 	    let inet = Hsys.deering_addr hash in 
 	    (*eprintf "UDP:ipmc_sock=%d (Mcast)\n" (Hsys.int_of_socket ipmc_sock) ;*)
-	    Hsys.sendto_info ipmc_sock [|inet,deering_port()|]
+	    sendto_info ipmc_sock [|inet,deering_port()|]
 	| Domain.Gossip(dest) ->
 	    match mode with
 	      (* For gossip messages with Deering, just broadcast
@@ -156,7 +497,7 @@ let domain alarm =
 		let hash = Group.hash_of_id dest in
 		let inet = Hsys.deering_addr hash in
 		(*eprintf "UDP:ipmc_sock=%d (Gossip)\n" (Hsys.int_of_socket ipmc_sock) ;*)
-		Hsys.sendto_info ipmc_sock [|inet,deering_port()|]
+		sendto_info ipmc_sock [|inet,deering_port()|]
 
 	      (* For Udp, we send the message to the various 
 	       * gossip hosts.
@@ -175,14 +516,18 @@ let domain alarm =
                   in
 	        let dests = Array.map (fun host -> (host,gossip_port)) used_gossip_hosts in
 
-		Hsys.sendto_info udp_sock dests
+		sendto_info udp_sock dests
 
 	    | _ -> failwith "bad mode"
       in
 
       let x hdr ofs len iovl = 
-	Hsys.udp_mu_sendsv dests hdr ofs len iovl;
-	Iovecl.free iovl
+	if !gso then (
+	  gso_xmit dests hdr ofs len iovl
+	) else (
+	  gso_flush () ;
+	  sendsv dests hdr ofs len iovl
+	)
       in
       let x =
 	if Arge.timestamp_check "send" then (
@@ -198,6 +543,18 @@ let domain alarm =
     Domain.handle disable xmit
   in
 
+  (* Multicast fan-out over Udp is the most expensive send
+   * path, so keep track of how well it batches.
+   *)
+  Trace.install_root (fun () -> [
+    sprintf "UDP:sendsv:%s" (Hsys.udp_mu_send_stats ()) ;
+    sprintf "UDP:sendto_info:%s" (string_of_info_stats ()) ;
+    sprintf "UDP:gso:%s" (string_of_gso_stats ()) ;
+    sprintf "UDP:drops:%s" (string_of_array string_of_drops udp_socks) ;
+    sprintf "UDP:rx:%s" (Hsys.udp_rx_stats ()) ;
+    sprintf "UDP:backpressure:%s" (string_of_stall_stats ())
+  ]) ;
+
   Domain.create name addr enable
 
 (**************************************************************)
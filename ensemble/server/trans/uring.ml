@@ -0,0 +1,488 @@
+(**************************************************************)
+(* URING.ML *)
+(**************************************************************)
+(* Notes:
+ * 1. Like EPOLL, but the socket operations go through an
+ *    io_uring.  All the operations queued during a scheduling
+ *    round are handed to the kernel with a single system call,
+ *    which also collects the completions.
+ * 2. Sockets carrying Ensemble packets (Handler1) have up to
+ *    [recv_batch] receives posted, each into a max_msg_size slot
+ *    of the recv pool.  Completed receives are delivered, and
+ *    posted again.  Other sockets are polled through the ring,
+ *    and their handlers called when they are ready.  This
+ *    includes sockets with UDP_GRO set, which need larger reads.
+ *    A socket with no receive posted, because the recv pool is
+ *    exhausted, is polled too, and read as by REAL, into the ML
+ *    heap if need be.  So acknowledgements that let the pool be
+ *    freed keep coming in.
+ *
+ *    Each posted receive takes a whole max_msg_size slot of the
+ *    current chunk, and the slot stays taken, whatever the size of
+ *    the packet, until every iovec in the chunk is freed.  So the
+ *    receives posted at any time, over all sockets, are limited to
+ *    what fits in one chunk: chunk_size/max_msg_size, 32 by
+ *    default, and 4 with -max_msg_size 65507.
+ * 3. The UDP domain queues its sends on the ring, see [sender].
+ *    When the ring is full, sends wait in order in ML.
+ * 4. Where io_uring is not supported, falls back to REAL.
+ *)
+(**************************************************************)
+open Util
+open Trans
+(**************************************************************)
+let name = Trace.file "URING"
+let failwith = Trace.make_failwith name
+let log = Trace.log name
+(**************************************************************)
+
+(* The size of the ring.  The C side refuses operations that
+ * would overflow the submission or the completion queue,
+ * counting one entry per destination of a send.
+ *)
+let ring_entries = 1024
+
+(* Event bits, as in Socket.uring_poll.
+ *)
+let ev_recv = 1
+let ev_xmit = 2
+
+(* How the input of a socket is handled.
+ *)
+let recv_none = 0
+let recv_posted = 1
+let recv_polled = 2
+
+(* Outstanding operations, indexed by their token.
+ *)
+type op =
+  | Free
+  | Recv of int * Iovec.t		(* fd, slot *)
+  | Poll of int * int			(* fd, event *)
+  | Send of Iovecl.t
+
+(* Per-socket state, indexed by file descriptor.
+ *)
+type table = {
+  mutable sock : Hsys.socket option array ;
+  mutable kind : int array ;		(* recv_none/posted/polled *)
+  mutable recv : (unit -> unit) array ;	(* handler of a polled socket *)
+  mutable xmit : (unit -> unit) array ;
+  mutable posted : int array ;		(* outstanding receives *)
+  mutable polled : int array		(* outstanding poll events *)
+}
+
+let table_grow t fd =
+  let len = Array.length t.kind in
+  if fd >= len then (
+    let len' = max (succ fd) (2 * len) in
+    let grow a x =
+      let a' = Array.create len' x in
+      Array.blit a 0 a' 0 len ;
+      a'
+    in
+    t.sock <- grow t.sock None ;
+    t.kind <- grow t.kind recv_none ;
+    t.recv <- grow t.recv ident ;
+    t.xmit <- grow t.xmit ident ;
+    t.posted <- grow t.posted 0 ;
+    t.polled <- grow t.polled 0
+  )
+
+(**************************************************************)
+
+let sender_r = ref None
+
+let sender () = !sender_r
+
+(**************************************************************)
+
+module Priq = Priq.Make ( Time.Ord )
+
+let alarm ((unique,sched,async,handlers) as gorp) =
+  let deliver =
+    if Arge.timestamp_check "recv" then (
+      let stamp = Timestamp.register"UDP:recv" in
+      let ts_add () = Timestamp.add stamp in
+      let deliver h buf ofs len iovl =
+	ts_add () ;
+    	Route.deliver h buf ofs len iovl
+      in deliver
+    ) else Route.deliver
+  in
+  let multiread = Arge.get Arge.multiread in
+  let deliver =
+    if multiread then (
+      fun handlers buf ofs len iovl ->
+	Sched.enqueue_5arg sched name deliver handlers buf ofs len iovl
+    ) else deliver
+  in
+
+  let ring = Hsys.uring_create ring_entries in
+  let table = {
+    sock = Array.create 64 None ;
+    kind = Array.create 64 recv_none ;
+    recv = Array.create 64 ident ;
+    xmit = Array.create 64 ident ;
+    posted = Array.create 64 0 ;
+    polled = Array.create 64 0
+  } in
+
+  (* The tokens of outstanding operations.  Free tokens are kept
+   * on a stack.  [inflight] counts the operations, for tracing.
+   *)
+  let ops = ref (Array.create 256 Free) in
+  let free = ref (Array.init 256 (fun i -> 255 - i)) in
+  let nfree = ref 256 in
+  let inflight = ref 0 in
+
+  let op_add op =
+    if !nfree = 0 then (
+      let len = Array.length !ops in
+      let ops' = Array.create (2 * len) Free in
+      Array.blit !ops 0 ops' 0 len ;
+      ops := ops' ;
+      free := Array.init (2 * len) (fun i -> 2 * len - 1 - i) ;
+      nfree := len
+    ) ;
+    decr nfree ;
+    let token = !free.(!nfree) in
+    !ops.(token) <- op ;
+    incr inflight ;
+    token
+  in
+
+  let op_release token =
+    !ops.(token) <- Free ;
+    !free.(!nfree) <- token ;
+    incr nfree ;
+    decr inflight
+  in
+
+  (* Cancel the outstanding receives and polls of a socket.
+   *)
+  let cancel fd events =
+    let ops = !ops in
+    for token = 0 to pred (Array.length ops) do
+      match ops.(token) with
+      | Recv(fd',_) when fd' = fd && events land ev_recv <> 0 ->
+	  ignore (Hsys.uring_cancel ring token)
+      | Poll(fd',ev) when fd' = fd && events land ev <> 0 ->
+	  ignore (Hsys.uring_cancel ring token)
+      | _ -> ()
+    done ;
+    table.polled.(fd) <- table.polled.(fd) land (lnot events)
+  in
+
+  (* Post receives and polls for the registered sockets, up to
+   * what they should have outstanding.
+   *)
+  let recv_pool = Iovec.get_recv_pool () in
+  let depth = max 1 (Arge.get Arge.recv_batch) in
+  let posted_max = max 1 (Arge.get Arge.chunk_size / Hsys.max_msg_size ()) in
+  let posted = ref 0 in
+  let fds = ref [] in
+
+  let post_recv fd sock =
+    !posted < posted_max && (
+      let token = op_add Free in
+      let slot = Hsys.uring_recv ring recv_pool sock token in
+      if Iovec.len slot =|| len0 then (
+	op_release token ;
+	false
+      ) else (
+	!ops.(token) <- Recv(fd,slot) ;
+	table.posted.(fd) <- succ table.posted.(fd) ;
+	incr posted ;
+	true
+      )
+    )
+  in
+
+  let post_poll fd sock ev =
+    let token = op_add (Poll(fd,ev)) in
+    if Hsys.uring_poll ring sock ev token then (
+      table.polled.(fd) <- table.polled.(fd) lor ev
+    ) else (
+      op_release token
+    )
+  in
+
+  let refill () =
+    List.iter (fun fd ->
+      match table.sock.(fd) with
+      | None -> ()
+      | Some sock ->
+	  let kind = table.kind.(fd) in
+	  if kind = recv_posted then (
+	    while table.posted.(fd) < depth
+	      && post_recv fd sock
+	    do () done
+	  ) ;
+	  let want =
+	    (if kind = recv_polled
+	      || (kind = recv_posted && table.posted.(fd) = 0)
+	     then ev_recv else 0) lor
+	    (if table.xmit.(fd) != ident then ev_xmit else 0)
+	  in
+	  let missing = want land (lnot table.polled.(fd)) in
+	  if missing land ev_recv <> 0 then post_poll fd sock ev_recv ;
+	  if missing land ev_xmit <> 0 then post_poll fd sock ev_xmit
+    ) !fds
+  in
+
+  let add_fd fd sock =
+    table_grow table fd ;
+    table.sock.(fd) <- Some sock ;
+    if not (List.mem fd !fds) then
+      fds := fd :: !fds
+  and rmv_fd fd =
+    if table.kind.(fd) = recv_none && table.xmit.(fd) == ident then (
+      table.sock.(fd) <- None ;
+      fds := except fd !fds
+    )
+  in
+
+  let prealloc_buf = Buf.create (Buf.len_of_int (Hsys.max_msg_size ())) in
+
+  let socks_recv =
+    Resource.create "URING:socks_recv"
+    (fun fd (sock,h) ->
+      add_fd fd sock ;
+      match h with
+      | Hsys.Handler0 f ->
+	  table.kind.(fd) <- recv_polled ;
+	  table.recv.(fd) <- f
+      | Hsys.Handler1 ->
+	  if Hsys.getsockopt_gro sock then (
+	    table.kind.(fd) <- recv_polled ;
+	    table.recv.(fd) <- Real.recv_gro handlers deliver recv_pool sock
+	  ) else (
+	    table.kind.(fd) <- recv_posted ;
+	    table.recv.(fd) <- Real.recv_single handlers deliver recv_pool sock
+	  ))
+    (fun fd (sock,_) ->
+      table.kind.(fd) <- recv_none ;
+      table.recv.(fd) <- ident ;
+      cancel fd ev_recv ;
+      rmv_fd fd)
+    ignore
+    (fun socks ->
+      log (fun () -> sprintf "socks_recv=%s" (Resource.to_string socks)))
+  in
+
+  let socks_xmit =
+    Resource.create "URING:socks_xmit"
+    (fun fd (sock,f) ->
+      add_fd fd sock ;
+      table.xmit.(fd) <- f)
+    (fun fd (sock,_) ->
+      table.xmit.(fd) <- ident ;
+      cancel fd ev_xmit ;
+      rmv_fd fd)
+    ignore
+    (fun socks ->
+      log (fun () -> sprintf "socks_xmit=%s" (Resource.to_string socks)))
+  in
+
+  let onlypolls = ref ident in
+  let polls =
+    Resource.create "URING:polls"
+    ignore2
+    ignore2
+    (fun polls -> onlypolls := Real.squash_polls (Resource.to_array polls))
+    (fun polls ->
+      log (fun () -> sprintf "polls=%s" (Resource.to_string polls)))
+  in
+
+  (* Sends.  If the ring is full, the message waits in [sends]
+   * with a copy of its header, and so do those after it, until
+   * there is room again.
+   *)
+  let sends = Queue.create () in
+  let sending = ref 0 in
+
+  let send_ring info buf ofs len iovl =
+    let token = op_add (Send iovl) in
+    let n = Hsys.uring_sendsv ring info buf ofs len iovl token in
+    if n <= 0 then (
+      op_release token ;
+      if n = 0 then Iovecl.free iovl
+    ) else (
+      incr sending
+    ) ;
+    n >= 0
+  in
+
+  (* A send that does not fit with no other send outstanding
+   * will not fit later either.  It is sent at once, which keeps
+   * the order, as the earlier ones have completed.
+   *)
+  let send_queued () =
+    while not (Queue.is_empty sends)
+      && (let (info,buf,iovl) = Queue.peek sends in
+	  let len = Buf.length buf in
+	  send_ring info buf len0 len iovl || (
+	    !sending = 0 && (
+	      Hsys.udp_mu_sendsv info buf len0 len iovl ;
+	      Iovecl.free iovl ;
+	      true)))
+    do ignore (Queue.take sends) done
+  in
+
+  let send info buf ofs len iovl =
+    if not (Queue.is_empty sends && send_ring info buf ofs len iovl) then
+      Queue.add (info, Buf.sub buf ofs len, iovl) sends
+  in
+  sender_r := Some send ;
+
+  Trace.install_root (fun () -> [
+    sprintf "URING:posted=%d max=%d" !posted posted_max ;
+    sprintf "URING:recv:%s" (Resource.info socks_recv) ;
+    sprintf "URING:xmit:%s" (Resource.info socks_xmit) ;
+    sprintf "URING:poll:%s" (Resource.info polls) ;
+    sprintf "URING:inflight=%d queued_sends=%d" !inflight (Queue.length sends)
+  ]) ;
+
+  (* Submit the queued operations, wait for at most [timeout],
+   * and handle the completions.  A handler may remove sockets,
+   * their outstanding operations are then cancelled.
+   *)
+  let ready = Array.create (2 * ring_entries) 0 in
+  let wait timeout =
+    send_queued () ;
+    refill () ;
+    let n = Time.mut_uring_wait ring ready timeout in
+    for i = 0 to pred n do
+      let token = ready.(2*i) in
+      let res = ready.(2*i+1) in
+      let op = !ops.(token) in
+      op_release token ;
+      match op with
+      | Recv(fd,slot) ->
+	  table.posted.(fd) <- pred table.posted.(fd) ;
+	  decr posted ;
+	  let mllen,iov = Hsys.uring_recv_packet slot res prealloc_buf in
+	  if mllen <>|| len0 && table.kind.(fd) = recv_posted then (
+	    let iovl = Iovecl.singleton iov in
+	    deliver handlers prealloc_buf len0 mllen iovl
+	  ) else (
+	    Iovec.free iov
+	  )
+      | Poll(fd,ev) ->
+	  table.polled.(fd) <- table.polled.(fd) land (lnot ev) ;
+	  if res >= 0 then (
+	    if ev = ev_recv then table.recv.(fd) () else table.xmit.(fd) ()
+	  )
+      | Send iovl ->
+	  decr sending ;
+	  Iovecl.free iovl
+      | Free ->
+	  failwith "wait:sanity"
+    done ;
+    n > 0
+  in
+
+  let zero = Time.mut () in
+  Time.mut_set zero Time.zero ;
+  let poll_socks () = wait zero in
+
+  let poll_once () = !onlypolls (poll_socks ()) in
+  let poll, onlypoll =
+    if multiread then (
+      (fun () ->
+	if poll_once () then (
+	  while poll_once () do () done ;
+	  true
+	) else false),
+      (fun () ->
+	if !onlypolls false then (
+	  while !onlypolls false do () done ;
+	  true
+	) else false)
+    ) else (
+      poll_once,
+      (fun () -> !onlypolls false)
+    )
+  in
+
+  let space = Time.mut () in
+
+  let alarms = Priq.create (fun _ -> failwith "priq:sanity") in
+
+  let block () =
+    if Priq.size alarms = 0 then (
+      Time.mut_set space Time.neg_one
+    ) else (
+      Time.mut_gettimeofday space ;
+      let next = Priq.min alarms in
+      if Time.mut_ge space next then (
+      	Time.mut_set space Time.zero
+      ) else (
+      	Time.mut_sub_rev next space
+      )
+    ) ;
+    ignore (wait space) ;
+    if multiread then
+      while poll_socks () do () done
+  in
+
+  let gettime = Time.gettimeofday
+
+  and min () = Priq.min alarms
+
+  and check () =
+    Time.mut_gettimeofday space ;
+    let min = Priq.min alarms in
+    if not (Time.mut_ge space min) then
+      false
+    else
+      Priq.getopt alarms (Time.mut_copy space)
+
+  and alarm callback =
+    let disable = ident in
+    let schedule time =
+      Priq.add alarms time callback
+    in Alarm.c_alarm disable schedule
+
+  and poll kind =
+    match kind with
+    | Alarm.SocksPolls -> poll
+    | Alarm.OnlyPolls -> onlypoll
+
+  and add_sock_recv d s h = Resource.add socks_recv d (Hsys.int_of_socket s) (s,h)
+  and rmv_sock_recv s = Resource.remove socks_recv (Hsys.int_of_socket s)
+  and add_sock_xmit d s h = Resource.add socks_xmit d (Hsys.int_of_socket s) (s,h)
+  and rmv_sock_xmit s = Resource.remove socks_xmit (Hsys.int_of_socket s)
+  and add_poll name poll = Resource.add polls name name poll
+  and rmv_poll = Resource.remove polls
+
+  in Alarm.create
+    name
+    gettime
+    alarm
+    check
+    min
+    add_sock_recv
+    rmv_sock_recv
+    add_sock_xmit
+    rmv_sock_xmit
+    block
+    add_poll
+    rmv_poll
+    poll
+    gorp
+
+(**************************************************************)
+
+let alarm gorp =
+  if Hsys.has_uring () then (
+    alarm gorp
+  ) else (
+    eprintf "URING:warning:io_uring not supported, using REAL alarm\n" ;
+    Real.alarm gorp
+  )
+
+let _ = Alarm.install "URING" alarm
+
+(**************************************************************)
@@ -0,0 +1,12 @@
+(**************************************************************)
+(* URING.MLI *)
+(**************************************************************)
+
+(* If the URING alarm is in use, a function for the UDP domain
+ * to queue its sends on the ring with.  As Hsys.udp_mu_sendsv,
+ * but it takes over the iovecs, and releases them when the send
+ * completes.
+ *)
+val sender : unit -> (Hsys.sendto_info -> Buf.t -> Buf.ofs -> Buf.len -> Iovecl.t -> unit) option
+
+(**************************************************************)
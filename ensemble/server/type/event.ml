@@ -173,14 +173,31 @@ type ('a,'b) dirm = UpM of t * 'a | DnM of t * 'b
 let invalid_rank = -1
 
 (**************************************************************)
+(* Allocation counters.  Events built from a field list, by
+ * create and set, allocate the list and its fields besides the
+ * record.  Those built by bodyCore, which the per-message
+ * constructors below use, allocate only the record and its type.
+ *)
 
-let bodyCore debug typ peer = {
-  typ 	  = typ ;
-  c_type  = compact_typ_of_typ typ;
-  peer	  = peer ;
-  applmsg = false ;
-  extend  = []
-}
+let field_events = ref 0
+let core_events = ref 0
+
+let alloc_stats () = (!field_events, !core_events)
+
+let _ =
+  Trace.install_root (fun () -> [
+    sprintf "EVENT:allocs:field_list=%d core=%d" !field_events !core_events
+  ])
+
+(**************************************************************)
+
+let bodyCore debug typ peer = 
+  incr core_events ;
+  { typ     = typ ;
+    c_type  = compact_typ_of_typ typ ;
+    peer    = peer ;
+    applmsg = false ;
+    extend  = [] }
 
 (**************************************************************)
 
@@ -248,6 +265,7 @@ let rec setLoop pee app typ ext usl = match usl with
     | f          -> setLoop pee app typ (f::ext) tl
 
 let set debug {typ=typ;peer=pee;applmsg=app;extend=ext} dsl =
+  incr field_events ;
   setLoop pee app typ ext dsl
 
 let set_typ debug ev typ = {ev with typ=typ; c_type=compact_typ_of_typ typ}
@@ -273,6 +291,7 @@ let setSendUnrelPeer debug ev peer =
 (**************************************************************)
 
 let create debug typ fields =
+  incr field_events ;
   setLoop invalid_rank false typ [] fields
 
 let upCheck debug ev = () (*Iovecl.check ev.iov*)
@@ -495,13 +514,16 @@ let to_string = Trace.debug "" (fun ev ->
 
 (**************************************************************)
 
-let castEv        debug =        create debug (ECast Iovecl.empty) []
-let castUnrelIov  debug	iov    = create debug (ECastUnrel iov) []
-let castUnrel	  debug	       = create debug (ECastUnrel Iovecl.empty) []
-let sendPeer      debug d      = create debug (ESend Iovecl.empty) [Peer d]
-let castPeerIov   debug o iov  = create debug (ECast iov) [Peer o]
-let sendUnrelPeer debug d      = create debug (ESendUnrel Iovecl.empty) [Peer d]
-let sendUnrelPeerIov debug d iov  = create debug (ESendUnrel iov) [Peer d]
+(* Events with only a type and a peer are created for every
+ * message, and are built with bodyCore rather than a field list.
+ *)
+let castEv        debug =        bodyCore debug (ECast Iovecl.empty) invalid_rank
+let castUnrelIov  debug	iov    = bodyCore debug (ECastUnrel iov) invalid_rank
+let castUnrel	  debug	       = bodyCore debug (ECastUnrel Iovecl.empty) invalid_rank
+let sendPeer      debug d      = bodyCore debug (ESend Iovecl.empty) d
+let castPeerIov   debug o iov  = bodyCore debug (ECast iov) o
+let sendUnrelPeer debug d      = bodyCore debug (ESendUnrel Iovecl.empty) d
+let sendUnrelPeerIov debug d iov  = bodyCore debug (ESendUnrel iov) d
 let suspectReason debug s r  = create debug ESuspect[Suspects s;SuspectReason r]
 let timerAlarm    debug t    = create debug ETimer[Alarm t]
 let timerTime     debug t    = create debug ETimer[Time t]
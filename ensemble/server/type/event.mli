@@ -161,6 +161,14 @@ type ('a,'b) dirm = UpM of up * 'a | DnM of dn * 'b
   (* Constructor *)
 val create	: debug -> typ -> field list -> t
 
+(**************************************************************)
+
+  (* Allocation counters: the events built from a field list, by
+   * create and set, and those built directly, by bodyCore and the
+   * per-message constructors that use it.
+   *)
+val alloc_stats	: unit -> int * int
+
 (**************************************************************)
 
   (* Modifier *)
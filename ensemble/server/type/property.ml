@@ -40,6 +40,7 @@ type id =
   | Dbg                                 (* user controlled network partition *)
   | Dbgbatch                            (* batch mode network emulation *)
   | P_pt2ptwp                           (* Use experimental pt2pt flow-control protocol *)
+  | Cong                                (* rate-based congestion control of casts *)
   | Vsync                               (* The set of properties that are called 
 					   virtual-synchrony *)
 
@@ -86,6 +87,7 @@ let mapping = [|
   "SLANDER", Slander ;
   "ASYM", Asym ;
   "P_PT2PTWP", P_pt2ptwp;
+  "CONG", Cong;
   "VSYNC", Vsync
 |]
 
@@ -128,6 +130,7 @@ type r = {
     mutable slander : bool ;
     mutable asym : bool ;
     mutable p_pt2ptwp : bool ;
+    mutable cong : bool ;
 } 
 
 (**************************************************************)
@@ -166,6 +169,7 @@ let flatten props =
     slander = false ;
     asym = false ;
     p_pt2ptwp = false ;
+    cong = false ;
   } in
   List.iter (function
   | Agree	-> r.agree <- true
@@ -199,6 +203,7 @@ let flatten props =
   | Slander     -> r.slander <- true
   | Asym        -> r.asym <- true
   | P_pt2ptwp   -> r.p_pt2ptwp <- true
+  | Cong        -> r.cong <- true
   | Vsync       -> 
       r.gmp <- true;
       r.sync <- true;
@@ -321,6 +326,12 @@ let choose props =
 
 	["Mnak"] ::
 
+	(* Congestion control goes below Mnak, so that it sees
+	 * the casts as they go out, and charges retransmissions
+	 * against the rate.
+	 *)
+	(if p.cong then ["Cong"] else []) ::
+
 	(if p.gcast then ["Gcast"] else []) ::
         (if p.asym then ["Asym"] else []) ::
 	(if p.drop then ["Drop"] else []) ::
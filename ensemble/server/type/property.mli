@@ -37,6 +37,7 @@ type id =
   | Dbg                                 (* on-line modification of network topology *)
   | Dbgbatch                            (* batch mode network emulation *)
   | P_pt2ptwp                           (* Use experimental pt2pt flow-control protocol *)
+  | Cong                                (* rate-based congestion control of casts *)
   (* This is a list of id's, it includes: {Gmp,Sync,Heal,Switch,Frag,Suspect,Flow,Slander}
    *)
   | Vsync 
@@ -197,6 +197,8 @@ let mut_add m t = set m (m.sec10 + t.sec10) (m.usec + t.usec)
 let mut_sub m t = set m (m.sec10 - t.sec10) (m.usec - t.usec)
 let mut_sub_rev t m = set m (t.sec10 - m.sec10) (t.usec - m.usec)
 let mut_select = Hsys.select
+let mut_epoll_wait = Hsys.epoll_wait
+let mut_uring_wait = Hsys.uring_wait
 
 (*
 type m' = m
@@ -52,6 +52,8 @@ val mut_sub     : m -> t -> unit
 val mut_sub_rev : t -> m -> unit
 val mut_gettimeofday : m -> unit
 val mut_select  : Hsys.select_info -> m -> int
+val mut_epoll_wait : Hsys.epoll -> int array -> m -> int
+val mut_uring_wait : Hsys.uring -> int array -> m -> int
 
 (*
 type m' = m
@@ -60,6 +60,7 @@ type socket_option =
       
 (**************************************************************)
 let max_msg_size = Socket.max_msg_size
+let set_max_msg_size = Socket.set_max_msg_size
       
 let bind sock inet port = Socket.bind sock (Unix.ADDR_INET(inet,port))
 let close sock		= Socket.close sock
@@ -73,6 +74,12 @@ let int_of_socket 	= Socket.int_of_socket
 let listen sock i	= Socket.listen sock i
 let select      	= Socket.select
 let poll        	= Socket.poll
+
+type epoll = Socket.epoll
+let has_epoll           = Socket.has_epoll
+let epoll_create        = Socket.epoll_create
+let epoll_modify        = Socket.epoll_modify
+let epoll_wait          = Socket.epoll_wait
   
 (* Convert errors on stdin into a return value of 0.
 *)
@@ -100,6 +107,16 @@ let udp_mu_sendsv info buf ofs len iovl =
   Socket.udp_mu_sendsv info 
     (Buf.string_of buf) (Buf.int_of_len ofs) (Buf.int_of_len len) 
     (Iovecl.to_iovec_array iovl) 
+
+let udp_mu_send_stats = Socket.udp_mu_send_stats
+let udp_rx_stats = Socket.udp_rx_stats
+let udp_rx_drops = Socket.udp_rx_drops
+
+let has_udp_gso = Socket.has_udp_gso
+
+let udp_mu_sendsv_gso info buf ofs_lens iovls n seg =
+  Socket.udp_mu_sendsv_gso info (Buf.string_of buf) ofs_lens
+    (Array.init n (fun i -> Iovecl.to_iovec_array iovls.(i))) n seg
     
 (* PERF: I -hope- ocamlopt removes the allocation.
 *)
@@ -107,6 +124,33 @@ let udp_mu_recv_packet pool sock mlhdr=
 (*  Socket.udp_mu_recv_packet sock (Buf.string_of mlhdr)*)
   let mllen, iov = Socket.udp_mu_recv_packet pool sock (Buf.string_of mlhdr) in
   (Buf.len_of_int mllen), iov
+
+let udp_mu_recv_packets pool sock mlhdrs mllens iovs = 
+  Socket.udp_mu_recv_packets pool sock (Buf.string_of mlhdrs) mllens iovs
+
+let udp_mu_recv_packet_iov pool sock mlhdr = 
+  Socket.udp_mu_recv_packet_iov pool sock (Buf.string_of mlhdr)
+
+let udp_mu_recv_gro pool sock mlhdrs mllens iovs = 
+  Socket.udp_mu_recv_gro pool sock (Buf.string_of mlhdrs) mllens iovs
+let udp_gro_pending = Socket.udp_gro_pending
+
+type uring = Socket.uring
+let has_uring = Socket.has_uring
+let uring_create = Socket.uring_create
+let uring_recv = Socket.uring_recv
+let uring_poll = Socket.uring_poll
+let uring_cancel = Socket.uring_cancel
+let uring_wait = Socket.uring_wait
+
+let uring_recv_packet slot res mlhdr =
+  let mllen, iov = Socket.uring_recv_packet slot res (Buf.string_of mlhdr) in
+  (Buf.len_of_int mllen), iov
+
+let uring_sendsv ring info buf ofs len iovl token =
+  Socket.uring_sendsv ring info
+    (Buf.string_of buf) (Buf.int_of_len ofs) (Buf.int_of_len len) 
+    (Iovecl.to_iovec_array iovl) token
     
 let tcp_recv s b o l 	= 
   len_of_int (Socket.tcp_recv s (Buf.string_of b) (int_of_len o) (int_of_len l))
@@ -223,6 +267,12 @@ let setsockopt sock = function
   | Sendbuf len -> Socket.setsockopt_sendbuf sock len
   | Recvbuf len -> Socket.setsockopt_recvbuf sock len
   | Bsdcompat b  -> Socket.setsockopt_bsdcompat sock b
+
+let setsockopt_gro = Socket.setsockopt_gro
+let getsockopt_gro = Socket.getsockopt_gro
+let setsockopt_reuseport = Socket.setsockopt_reuseport
+let getsockopt_drops = Socket.getsockopt_drops
+let setsockopt_rx_stats = Socket.setsockopt_rx_stats
       
 let in_multicast = Socket.in_multicast 
   (**************************************************************)
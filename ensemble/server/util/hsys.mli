@@ -4,7 +4,8 @@
 (**************************************************************)
 open Buf
 (**************************************************************)
-val max_msg_size : int
+val max_msg_size : unit -> int
+val set_max_msg_size : int -> unit
 
 type debug = string
 type port = int
@@ -144,6 +145,15 @@ val select : select_info -> timeval -> int
  *)
 val poll : select_info -> int
 
+(* Persistent socket sets, see Socket.epoll_wait.  These are
+ * only available if [has_epoll ()] is true.
+ *)
+type epoll
+val has_epoll : unit -> bool
+val epoll_create : unit -> epoll
+val epoll_modify : epoll -> socket -> int -> int -> unit
+val epoll_wait : epoll -> int array -> timeval -> int
+
 (**************************************************************)
 
 (* Optimized sending functions.  You first call sendto_info
@@ -159,8 +169,51 @@ val sendto_info : socket -> (inet * port) array -> sendto_info
 
 val udp_send : sendto_info -> Buf.t -> ofs -> len -> unit
 val udp_mu_sendsv : sendto_info -> Buf.t -> ofs -> len -> Iovecl.t -> unit
+val udp_mu_send_stats : unit -> string
+
+(* Queueing delays and kernel drops of received UDP packets.
+ * See Socket.udp_rx_stats.
+ *)
+val udp_rx_stats : unit -> string
+val udp_rx_drops : unit -> int
+
+(* Send a run of packets with UDP segmentation offload.  See
+ * Socket.udp_mu_sendsv_gso.
+ *)
+val has_udp_gso : unit -> bool
+val udp_mu_sendsv_gso : sendto_info -> Buf.t -> int array -> Iovecl.t array -> int -> int -> bool
 val udp_mu_recv_packet : Iovec.pool -> socket -> Buf.t -> len(*int*) * Iovec.t
 
+(* Receive a batch of packets.  See Socket.udp_mu_recv_packets.
+ * The ML header of the i-th packet is at offset 
+ * [i * max_msg_size] in the buffer.
+ *)
+val udp_mu_recv_packets : Iovec.pool -> socket -> Buf.t -> int array -> Iovec.t array -> int
+
+(* Receive a packet, leaving its ML header in iovec memory.
+ * See Socket.udp_mu_recv_packet_iov.
+ *)
+val udp_mu_recv_packet_iov : Iovec.pool -> socket -> Buf.t -> Iovec.t * Iovec.t
+
+(* Receive a batch of packets from a socket with UDP_GRO set.
+ * See Socket.udp_mu_recv_gro.
+ *)
+val udp_mu_recv_gro : Iovec.pool -> socket -> Buf.t -> int array -> Iovec.t array -> int
+val udp_gro_pending : socket -> bool
+
+(* Asynchronous operations with io_uring.  See Socket.uring_wait
+ * and the functions around it.
+ *)
+type uring
+val has_uring : unit -> bool
+val uring_create : int -> uring
+val uring_recv : uring -> Iovec.pool -> socket -> int -> Iovec.t
+val uring_recv_packet : Iovec.t -> int -> Buf.t -> len * Iovec.t
+val uring_poll : uring -> socket -> int -> int -> bool
+val uring_cancel : uring -> int -> bool
+val uring_sendsv : uring -> sendto_info -> Buf.t -> ofs -> len -> Iovecl.t -> int -> int
+val uring_wait : uring -> int array -> timeval -> int
+
 (* In the TCP functions, exceptions are caught, logged, and len0 
  * is returned instead.
 *)
@@ -191,6 +244,27 @@ type socket_option =
  *)
 val setsockopt : socket -> socket_option -> unit
 
+(* Ask the kernel to coalesce received UDP packets.  Returns
+ * false if this is not supported.  Only udp_mu_recv_gro may be
+ * used on the socket afterwards.
+ *)
+val setsockopt_gro : socket -> bool -> bool
+val getsockopt_gro : socket -> bool
+
+(* Allow several sockets to bind the same port.  Returns false
+ * if this is not supported.  See Socket.setsockopt_reuseport.
+ *)
+val setsockopt_reuseport : socket -> bool -> bool
+
+(* Packets dropped by the kernel on the socket, or -1.
+ *)
+val getsockopt_drops : socket -> int
+
+(* Enable kernel receive timestamps and drop counts on the
+ * socket, for udp_rx_stats.  Returns false if not supported.
+ *)
+val setsockopt_rx_stats : socket -> bool -> bool
+
 (* Is this a class D address ?
 *)
 val in_multicast : Unix.inet_addr -> bool
@@ -14,24 +14,37 @@ exception Error of string
 let error s = raise (Error s)
 
 (**************************************************************)
-type item =
-  | Int of int
-  | String of Buf.t
-  | Buf of Buf.t
-
+(* Items are written straight into a buffer.  When it runs out
+ * of room, it is set aside as a full segment and writing goes on
+ * in a buffer twice its size, so nothing is copied until
+ * marsh_done, and only if there is more than one segment.
+ *)
 type marsh = {
-  mutable buf : item list
+  mutable segs : (Buf.t * len) list ;	(* Full segments, the last first *)
+  mutable buf : Buf.t ;
+  mutable pos : ofs
 } 
 
 let marsh_init () = {
-  buf = []
+  segs = [] ;
+  buf = Buf.create (len_of_int 256) ;
+  pos = len0
 } 
 
-let add m v =
-  m.buf <- v :: m.buf
+let reserve m len =
+  let size = Buf.length m.buf in
+  if m.pos +|| len >|| size then (
+    if m.pos >|| len0 then
+      m.segs <- (m.buf,m.pos) :: m.segs ;
+    let size = size +|| size in
+    m.buf <- Buf.create (if len >|| size then len else size) ;
+    m.pos <- len0
+  )
 
 let write_int m i =
-  add m (Int i)
+  reserve m len4 ;
+  Buf.write_int32 m.buf m.pos i ;
+  m.pos <- m.pos +|| len4
 
 let write_len m i =
   write_int m (int_of_len i)
@@ -40,11 +53,18 @@ let write_bool m b =
   write_int m (if b then 1 else 0)
 
 let write_buf m b =
-  add m (Buf b)
+  let len = Buf.length b in
+  write_int m (int_of_len len) ;
+  reserve m len ;
+  Buf.blit b len0 m.buf m.pos len ;
+  m.pos <- m.pos +|| len
 
 let write_string m s =
-  let buf = Buf.of_string s in
-  add m (String buf)
+  let len = len_of_int (String.length s) in
+  write_int m (int_of_len len) ;
+  reserve m len ;
+  Buf.blit_str s 0 m.buf m.pos len ;
+  m.pos <- m.pos +|| len
 
 let write_list m f l =
   write_int m (List.length l) ;
@@ -61,40 +81,21 @@ let write_option m f o =
       write_bool m true ;
       f o
 
-let length = function
-  | Int _ -> len4
-  | String buf 
-  | Buf buf -> Buf.length buf +|| len4
-
-(* The total length accumulated in a list of objects. 
-*)
-let len l = List.fold_left (fun accu item -> 
-  accu +|| length item
-) len0 l
-  
-(* Marshal a list into a set 
+(* Return the bytes written so far, as a buffer and their
+ * length from its start.
  *)
-let marsh_done msh =
-  let l = List.rev msh.buf in
-  let len = len l in
-  let buf = Buf.create len in
-  let _ = List.fold_left (fun pos it ->
-    let len =
-      match it with
-	| Int i ->
-	    Buf.write_int32 buf pos i ;
-	    len4
-	| String str
-	| Buf str -> 
-	    let len = Buf.length str in
-	    Buf.write_int32 buf pos (int_of_len len) ;
-	    Buf.blit str len0 buf (pos+||len4) len;
-	    len +|| len4
-    in
-    pos +|| len
-  ) len0 l 
-  in
-  buf
+let marsh_done m =
+  match m.segs with
+  | [] -> (m.buf,m.pos)
+  | segs ->
+      let segs = List.rev ((m.buf,m.pos) :: segs) in
+      let total = List.fold_left (fun total (_,len) -> total +|| len) len0 segs in
+      let buf = Buf.create total in
+      ignore (List.fold_left (fun ofs (seg,len) ->
+	Buf.blit seg len0 buf ofs len ;
+	ofs +|| len
+      ) len0 segs) ;
+      (buf,total)
     
 (**************************************************************)
       
@@ -19,9 +19,10 @@ type marsh
  *)
 val marsh_init : unit -> marsh
 
-(* Convert a marshaller into a buffer.
+(* Convert a marshaller into a buffer, and the length of the
+ * data at its start.  The buffer may be longer.
  *)
-val marsh_done : marsh -> Buf.t
+val marsh_done : marsh -> Buf.t * Buf.len
 
 (* Functions for adding data to a string.
  *)
@@ -0,0 +1,55 @@
+(**************************************************************)
+(* RTO.ML : round-trip time and retransmission timeout estimation *)
+(* Uses Jacobson's algorithm, as in TCP (RFC 2988). *)
+(**************************************************************)
+open Printf
+(**************************************************************)
+
+type t = {
+  mutable sampled : bool ;		(* Whether there was a sample *)
+  mutable srtt   : float ;
+  mutable rttvar : float ;
+  mutable rto    : float ;
+  min_rto        : float ;
+  max_rto        : float
+}
+
+let bound t rto =
+  if rto < t.min_rto then t.min_rto
+  else if rto > t.max_rto then t.max_rto
+  else rto
+
+let create init min max =
+  let t = {
+    sampled = false ;
+    srtt   = 0.0 ;
+    rttvar = 0.0 ;
+    rto    = 0.0 ;
+    min_rto = Time.to_float min ;
+    max_rto = Time.to_float max
+  } in
+  t.rto <- bound t (Time.to_float init) ;
+  t
+
+let sample t rtt =
+  if not t.sampled then (
+    t.sampled <- true ;
+    t.srtt <- rtt ;
+    t.rttvar <- rtt /. 2.0
+  ) else (
+    t.rttvar <- 0.75 *. t.rttvar +. 0.25 *. abs_float (t.srtt -. rtt) ;
+    t.srtt <- 0.875 *. t.srtt +. 0.125 *. rtt
+  ) ;
+  t.rto <- bound t (t.srtt +. 4.0 *. t.rttvar)
+
+let backoff t =
+  t.rto <- bound t (2.0 *. t.rto)
+
+let rto t = t.rto
+let srtt t = t.srtt
+let sampled t = t.sampled
+
+let to_string t =
+  sprintf "{srtt=%.6f;rttvar=%.6f;rto=%.6f}" t.srtt t.rttvar t.rto
+
+(**************************************************************)
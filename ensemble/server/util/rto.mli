@@ -0,0 +1,32 @@
+(**************************************************************)
+(* RTO.MLI : round-trip time and retransmission timeout estimation *)
+(**************************************************************)
+
+type t
+
+(* [create init min max] returns an estimator with timeout
+ * [init] until the first sample, kept between [min] and [max].
+ *)
+val create : Time.t -> Time.t -> Time.t -> t
+
+(* [sample t rtt] adds a round-trip time sample, in seconds.
+ * By Karn's rule, samples must not come from messages that
+ * were retransmitted.
+ *)
+val sample : t -> float -> unit
+
+(* [backoff t] doubles the timeout, after it expired.
+ *)
+val backoff : t -> unit
+
+(* The current timeout and smoothed round-trip time, in
+ * seconds.  The latter is meaningful only once [sampled] holds,
+ * as a round trip may take no measurable time.
+ *)
+val rto : t -> float
+val srtt : t -> float
+val sampled : t -> bool
+
+val to_string : t -> string
+
+(**************************************************************)